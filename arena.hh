@@ -0,0 +1,129 @@
+#ifndef ARENA_HH
+#define ARENA_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace kcc
+{
+
+// バンプアロケータ
+// ブロック単位で確保したメモリを先頭から切り出すだけで、個別には解放しない.
+// 確保したメモリはアリーナの破棄 (または Reset) でまとめて解放される.
+// AllocateArray で置けるのはトリビアルに破棄できる型に限る.
+// New で作ったオブジェクトはアリーナの破棄 (または Reset) の時に作った順と逆順でデストラクタを呼ぶ.
+class Arena
+{
+  public:
+    static const size_t kBlockSize = 64 * 1024;
+
+    Arena() : ptr_(nullptr), end_(nullptr), used_(0) {}
+    ~Arena() { Reset(); }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *Allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~static_cast<uintptr_t>(align - 1);
+        if (!ptr_ || p + size > reinterpret_cast<uintptr_t>(end_))
+        {
+            // ブロックの 1/4 を超える要求は専用のブロックにする (現在のブロックの残りを捨てない)
+            if (size + align > kBlockSize / 4)
+                return AllocateLarge(size, align);
+            NewBlock();
+            p = (reinterpret_cast<uintptr_t>(ptr_) + align - 1) & ~static_cast<uintptr_t>(align - 1);
+        }
+        ptr_ = reinterpret_cast<char *>(p + size);
+        used_ += size;
+        return reinterpret_cast<void *>(p);
+    }
+
+    // 初期化していない T の配列
+    template <typename T>
+    T *AllocateArray(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return static_cast<T *>(Allocate(sizeof(T) * n, alignof(T)));
+    }
+
+    // アリーナ上に T を構築する
+    template <typename T, typename... Args>
+    T *New(Args &&... args)
+    {
+        T *p = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value)
+            destructors_.push_back(Destructor{p, &Destroy<T>});
+        return p;
+    }
+
+    // [b, e) をコピーした配列
+    template <typename T>
+    T *Copy(const T *b, const T *e)
+    {
+        T *p = AllocateArray<T>(e - b);
+        if (b != e)
+            std::memcpy(p, b, sizeof(T) * (e - b));
+        return p;
+    }
+
+    // 確保したバイト数
+    size_t BytesUsed() const { return used_; }
+
+    // すべてのブロックを解放する
+    void Reset()
+    {
+        for (auto d = destructors_.rbegin(); d != destructors_.rend(); ++d)
+            d->destroy(d->object);
+        destructors_.clear();
+        for (char *block : blocks_)
+            delete[] block;
+        blocks_.clear();
+        ptr_ = end_ = nullptr;
+        used_ = 0;
+    }
+
+  private:
+    struct Destructor
+    {
+        void *object;
+        void (*destroy)(void *);
+    };
+
+    template <typename T>
+    static void Destroy(void *p)
+    {
+        static_cast<T *>(p)->~T();
+    }
+
+    void NewBlock()
+    {
+        blocks_.push_back(new char[kBlockSize]);
+        ptr_ = blocks_.back();
+        end_ = ptr_ + kBlockSize;
+    }
+
+    void *AllocateLarge(size_t size, size_t align)
+    {
+        char *block = new char[size + align];
+        blocks_.push_back(block);
+        used_ += size;
+        uintptr_t p = (reinterpret_cast<uintptr_t>(block) + align - 1) & ~static_cast<uintptr_t>(align - 1);
+        return reinterpret_cast<void *>(p);
+    }
+
+    char *ptr_;
+    char *end_;
+    size_t used_;
+    std::vector<char *> blocks_;
+    std::vector<Destructor> destructors_;
+};
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,274 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../line_table.hh"
+#include "../parallel_tokenizer.hh"
+#include "../preprocessor.hh"
+#include "../token_document.hh"
+#include "../tokenizer.hh"
+
+// 字句解析のマイクロベンチマーク
+//   ./cmd.sh bench
+// 識別子の多い入力を生成し、予約語判定と Tokenize 全体の処理時間を計測する.
+
+namespace kcc
+{
+namespace bench
+{
+
+// 比較用: 32 個の予約語を順に比較する従来の判定
+static TokenType ClassifyKeywordLinear(const StringRef &str)
+{
+    static const char *words[] = {
+        "auto", "break", "case", "char", "const", "continue", "default", "do",
+        "double", "else", "enum", "extern", "float", "for", "goto", "if",
+        "int", "long", "register", "return", "short", "signed", "sizeof", "static",
+        "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while"};
+    for (int i = 0; i < 32; ++i)
+    {
+        if (str == words[i])
+            return static_cast<TokenType>(tkAuto + i);
+    }
+    return tkWord;
+}
+
+// 識別子の多いソースを生成する
+static std::vector<char> GenerateSource(int lines)
+{
+    static const char *types[] = {"int", "long", "char", "unsigned", "double"};
+    std::string src;
+    for (int i = 0; i < lines; ++i)
+    {
+        src += "    ";
+        src += types[i % 5];
+        src += " value_" + std::to_string(i) + " = input_buffer_" + std::to_string(i % 97) +
+               " + offset_table_" + std::to_string(i % 13) + ";\n";
+        if (i % 8 == 0)
+            src += "    if (result_count) return result_count;\n";
+    }
+    return std::vector<char>(src.begin(), src.end());
+}
+
+template <typename F>
+static double Measure(int iterations, F fn)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count() / iterations;
+}
+
+// ライセンス文のような大きなコメントを多く含むソースを生成する
+static std::vector<char> GenerateCommentedSource(int blocks)
+{
+    std::string banner = "/*\n";
+    for (int i = 0; i < 40; ++i)
+        banner += " * Permission is hereby granted, free of charge, to any person obtaining a copy\n";
+    banner += " */\n";
+
+    std::string src;
+    for (int i = 0; i < blocks; ++i)
+    {
+        src += banner;
+        src += "int f" + std::to_string(i) + "(void)\n{\n        return " + std::to_string(i) + ";\n}\n\n";
+    }
+    return std::vector<char>(src.begin(), src.end());
+}
+
+// スキャンカーネルでコメントと空白を読み飛ばした場合の処理時間
+static double MeasureSkip(int iterations, const std::vector<char> &src, scan::ScanFunc skip_blanks, scan::ScanFunc find_comment_end)
+{
+    volatile size_t sink = 0;
+    return Measure(iterations, [&]() {
+        const char *p = src.data();
+        const char *end = p + src.size();
+        while (p != end)
+        {
+            p = skip_blanks(p, end);
+            if (p + 1 < end && p[0] == '/' && p[1] == '*')
+            {
+                p = find_comment_end(p + 2, end);
+                p = (p == end) ? end : p + 2;
+            }
+            else if (p != end)
+                ++p;
+        }
+        sink += p - src.data();
+    });
+}
+
+static void Run()
+{
+    const int iterations = 20;
+    auto src = GenerateSource(200000);
+
+    std::vector<Token> tokens;
+    Tokenizer tzr;
+    tzr.Tokenize(src, &tokens);
+
+    std::vector<StringRef> words;
+    for (auto &t : tokens)
+    {
+        if (t.type == tkWord || (tkAuto <= t.type && t.type <= tkWhile))
+            words.push_back(t.token);
+    }
+
+    volatile int sink = 0;
+    double linear = Measure(iterations, [&]() {
+        for (auto &w : words)
+            sink += ClassifyKeywordLinear(w);
+    });
+    double hashed = Measure(iterations, [&]() {
+        for (auto &w : words)
+            sink += ClassifyKeyword(w.data(), w.size());
+    });
+    double tokenize = Measure(iterations, [&]() {
+        std::vector<Token> dest;
+        Tokenizer t;
+        t.Tokenize(src, &dest);
+        sink += dest.size();
+    });
+
+    double mb = src.size() / (1024.0 * 1024.0);
+    std::printf("input            : %.2f MB, %zu tokens, %zu words\n", mb, tokens.size(), words.size());
+    std::printf("keyword (linear) : %8.3f ms\n", linear);
+    std::printf("keyword (hash)   : %8.3f ms (x%.1f)\n", hashed, linear / hashed);
+
+    // 整数リテラルの変換
+    std::vector<std::string> literals;
+    for (unsigned long long i = 0; i < 200000; ++i)
+        literals.push_back(std::to_string(i * 2654435761u));
+    double stoull = Measure(iterations, [&]() {
+        for (auto &l : literals)
+            sink += std::stoull(l);
+    });
+    double swar = Measure(iterations, [&]() {
+        for (auto &l : literals)
+        {
+            uint64_t v;
+            ParseIntegerLiteral(l.data(), l.data() + l.size(), &v);
+            sink += v;
+        }
+    });
+    std::printf("integer (stoull) : %8.3f ms\n", stoull);
+    std::printf("integer (swar)   : %8.3f ms (x%.1f)\n", swar, stoull / swar);
+    std::printf("tokenize         : %8.3f ms (%.1f MB/s)\n", tokenize, mb / (tokenize / 1000.0));
+
+    // 行番号が必要になった時の行頭位置の表の構築
+    double line_table = Measure(iterations, [&]() {
+        LineTable lines;
+        lines.Reset(src.data(), src.size());
+        sink += lines.Line(static_cast<uint32_t>(src.size() - 1));
+    });
+    std::printf("line table       : %8.3f ms (%.1f MB/s, %s)\n", line_table, mb / (line_table / 1000.0), scan::kKernels.name);
+
+    // エディタでの 1 文字の編集 (50000 行)
+    auto edited = GenerateSource(50000);
+    TokenDocument doc;
+    doc.Assign(edited.data(), edited.size());
+    double full = Measure(iterations, [&]() {
+        std::vector<Token> dest;
+        Tokenizer t;
+        t.Tokenize(edited, &dest);
+        sink += dest.size();
+    });
+    size_t edit_pos = edited.size() / 2;
+    double incremental = Measure(iterations * 50, [&]() {
+        // 挿入と削除を交互に行い、入力を元に戻す
+        static bool insert = true;
+        if (insert)
+            doc.Edit(edit_pos, 0, "x");
+        else
+            doc.Edit(edit_pos, 1, "");
+        insert = !insert;
+    });
+    std::printf("retokenize       : %8.3f us (full %.3f ms, %zu lines, %zu chunks)\n", incremental * 1000.0, full,
+                static_cast<size_t>(50000), doc.ChunkCount());
+
+    ThreadPool pool;
+    double tokenize_parallel = Measure(iterations, [&]() {
+        std::vector<Token> dest;
+        ParallelTokenizer t(pool);
+        t.Tokenize(src, &dest);
+        sink += dest.size();
+    });
+    std::printf("tokenize (mt)    : %8.3f ms (%.1f MB/s, %zu threads)\n", tokenize_parallel, mb / (tokenize_parallel / 1000.0), pool.Size());
+
+    auto commented = GenerateCommentedSource(5000);
+    double skip_scalar = MeasureSkip(iterations, commented, scan::SkipBlanksScalar, scan::FindCommentEndScalar);
+    double skip_simd = MeasureSkip(iterations, commented, scan::kKernels.skip_blanks, scan::kKernels.find_comment_end);
+    double tokenize_commented = Measure(iterations, [&]() {
+        std::vector<Token> dest;
+        Tokenizer t;
+        t.Tokenize(commented, &dest);
+        sink += dest.size();
+    });
+
+    mb = commented.size() / (1024.0 * 1024.0);
+    std::printf("commented input  : %.2f MB\n", mb);
+    std::printf("skip (scalar)    : %8.3f ms\n", skip_scalar);
+    std::printf("skip (simd)      : %8.3f ms (x%.1f, %s)\n", skip_simd, skip_scalar / skip_simd, scan::kKernels.name);
+    std::printf("tokenize         : %8.3f ms (%.1f MB/s)\n", tokenize_commented, mb / (tokenize_commented / 1000.0));
+
+    // 同じヘッダを 3 回インクルードする翻訳単位の前処理
+    // ヘッダキャッシュを翻訳単位ごとに作り直す場合と共有する場合を比べる
+    std::vector<char> header_src = GenerateSource(5000);
+    std::string header = "#ifndef BENCH_H\n#define BENCH_H\n" + std::string(header_src.begin(), header_src.end()) + "#endif\n";
+    SourceFile unit;
+    unit.path = "unit.c";
+    unit.text = "#include \"bench.h\"\n#include \"bench.h\"\n#include \"bench.h\"\nint main;\n";
+    unit.src = unit.text.data();
+    unit.size = unit.text.size();
+    unit.Prepare();
+
+    HeaderCache shared;
+    shared.AddFile("bench.h", header);
+    auto preprocess = [&](HeaderCache &cache) {
+        std::vector<Token> dest;
+        Preprocessor pp(cache);
+        pp.Run(unit, &dest);
+        sink += dest.size();
+    };
+    double uncached = Measure(iterations, [&]() {
+        HeaderCache cache;
+        cache.AddFile("bench.h", header);
+        preprocess(cache);
+    });
+    double cached = Measure(iterations, [&]() { preprocess(shared); });
+    std::printf("preprocess       : %8.3f ms per unit (shared header cache %.3f ms)\n", uncached, cached);
+
+    // X マクロの展開. 項目数を倍にしても時間が倍程度で済むこと
+    for (int entries = 5000; entries <= 10000; entries *= 2)
+    {
+        SourceFile xmacro;
+        xmacro.path = "xmacro.c";
+        xmacro.text = "#define LIST";
+        for (int i = 0; i < entries; ++i)
+            xmacro.text += " X(item_" + std::to_string(i) + ", " + std::to_string(i) + ")";
+        xmacro.text += "\n#define CAT(a, b) a ## b\n#define X(n, v) CAT(k_, n) = v,\nLIST\n"
+                       "#undef X\n#define X(n, v) case v: return #n;\nLIST\n";
+        xmacro.src = xmacro.text.data();
+        xmacro.size = xmacro.text.size();
+        xmacro.Prepare();
+
+        size_t output = 0;
+        double expand = Measure(iterations, [&]() {
+            std::vector<Token> dest;
+            Preprocessor pp(shared);
+            pp.Run(xmacro, &dest);
+            output = dest.size();
+        });
+        std::printf("x-macro expand   : %8.3f ms (%zu entries, %zu tokens)\n", expand, static_cast<size_t>(entries), output);
+    }
+}
+
+} // namespace bench
+} // namespace kcc
+
+int main()
+{
+    kcc::bench::Run();
+}
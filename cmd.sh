@@ -4,14 +4,27 @@ BINKCC="./bin/kcc.exe"
 
 CC=$(which clang++)
 CC=$(which g++)
-OPTS="-std=c++11 -g3"
+OPTS="-std=c++11 -g3 -pthread"
 
 
 function build() {
-    sources=$(find . -type f -name "*.cc" -and -not -name "*_test.cc")
+    sources=$(find . -type f -name "*.cc" -and -not -name "*_test.cc" -and -not -path "./bench/*")
     ${CC} ${OPTS} ${sources} -o ${BINKCC}
 }
 
+function bench() {
+
+    echo "##### begin benchmarks #####"
+
+    for SRC in `ls bench/*_bench.cc`
+    do
+        executable="./bench/bin/$(basename ${SRC%%.cc})"
+        ${CC} -std=c++11 -O2 -pthread ${SRC} -o ${executable} && ${executable}
+    done
+
+    echo "##### Finished all benchmarks #####"
+}
+
 function utest() {
 
     echo "##### begin tests #####"
@@ -22,7 +35,7 @@ function utest() {
     for SRC in `ls test/*_test.cc`
     do
         executable="./test/bin/$(basename ${SRC##.cc})"
-        sources=$(find . -type f -name "*.cc" -and -not -name "*_test.cc" -and -not -name "main.cc")
+        sources=$(find . -type f -name "*.cc" -and -not -name "*_test.cc" -and -not -name "main.cc" -and -not -path "./bench/*")
         ${CC} ${OPTS} ${SRC} ${sources} -o ${executable}
 
         if [[ $? == 0 ]]; then
@@ -57,8 +70,11 @@ if [ "$1" == "build" ]; then
 elif [ "$1" == "test" ]; then
     test -e ./test/bin || mkdir ./test/bin
     utest
+elif [ "$1" == "bench" ]; then
+    test -e ./bench/bin || mkdir ./bench/bin
+    bench
 elif [ "$1" == "all" ]; then
     build && utest
 else
-    echo "./cmd.sh (build|test|ast)"
+    echo "./cmd.sh (build|test|bench|ast)"
 fi
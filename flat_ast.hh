@@ -0,0 +1,332 @@
+#ifndef FLAT_AST_HH
+#define FLAT_AST_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "assembler.hh"
+
+namespace kcc
+{
+
+enum NodeType
+{
+    kProgram,
+    kDecl,
+    kObjectType,
+
+    kIntegerLiteral,
+    kStringLiteral,
+    kDeclRefExpr,
+
+    kVariableDecl,
+
+    kFuncDefinition,
+    kFuncStorageClassSpecifier, // auto, register, static, extern, typedef,
+                                // __decpspec(ms-specific)
+    kFuncIdentifier,
+    kFuncCompoundStmt,
+    kFuncParamList,
+    kFuncParam,
+    kReturnStmt,
+
+    kExprStmt,
+    kPrimaryExpr,
+    kBinaryExpr,
+    kAssignmentExpr,
+    kUnaryExpr,
+    kConditionalExpr,
+
+    kNull
+};
+
+enum OperatorType
+{
+    kPlus,         // +
+    kMinus,        // -
+    kMul,          // *
+    kDiv,          // /
+    kMod,          // %
+    kShiftLeft,    // <<
+    kShiftRight,   // >>
+    kLess,         // <
+    kGreater,      // >
+    kLessEqual,    // <=
+    kGreaterEqual, // >=
+    kEqual,        // ==
+    kNotEqual,     // !=
+    kBitAnd,       // &
+    kBitXor,       // ^
+    kBitOr,        // |
+    kLogicalAnd,   // &&
+    kLogicalOr,    // ||
+    kComma,        // ,
+    kAssign,       // = (複合代入は対応する二項演算子で表す)
+
+    // 単項演算子
+    kUnaryPlus,     // +x
+    kNegate,        // -x
+    kLogicalNot,    // !x
+    kBitNot,        // ~x
+    kDeref,         // *x
+    kAddressOf,     // &x
+    kPreIncrement,  // ++x
+    kPreDecrement,  // --x
+    kPostIncrement, // x++
+    kPostDecrement, // x--
+    kSizeof,        // sizeof x, sizeof(型名)
+    kCast,          // (型名)x
+};
+
+// 平坦な AST のノードの位置
+typedef uint32_t NodeIndex;
+static const NodeIndex kNoNode = 0xffffffffu;
+
+// 平坦な AST のノード
+// value の意味はノードの種別ごとに異なる
+//   kIntegerLiteral, kStringLiteral : リテラルの綴り (文字列表の位置)
+//   kFuncDefinition                 : 関数名 (文字列表の位置)
+//   kDeclRefExpr, kVariableDecl     : 変数の rbp からの相対アドレス (size は値のバイト数)
+//   kBinaryExpr                     : OperatorType
+//   kAssignmentExpr                 : OperatorType (kAssign か複合代入の演算子). 最初の子が代入先
+//   kUnaryExpr                      : OperatorType (size はキャスト・sizeof の型名のバイト数)
+struct FlatNode
+{
+    NodeType type;
+    uint32_t value;
+    uint32_t size;
+    uint32_t first; // 子の先頭 (子の添字の表の位置)
+    uint32_t count; // 子の数
+};
+
+// 平坦な AST
+// ノードは 1 つの配列に後順 (子が親より前) で並び、子は 32bit の添字で参照する.
+// 根は最後のノード. 木全体の走査はポインタをたどらずに配列を先頭から見るだけで済む.
+class FlatAST
+{
+  public:
+    FlatAST() {}
+
+    // ノードを追加する. 子 [children, children + n) は先に追加しておくこと
+    NodeIndex Add(NodeType type, uint32_t value, uint32_t size, const NodeIndex *children, size_t n)
+    {
+        FlatNode node = {type, value, size, static_cast<uint32_t>(children_.size()), static_cast<uint32_t>(n)};
+        children_.insert(children_.end(), children, children + n);
+        nodes_.push_back(node);
+        return static_cast<NodeIndex>(nodes_.size() - 1);
+    }
+
+    NodeIndex Add(NodeType type, uint32_t value = 0, uint32_t size = 0)
+    {
+        return Add(type, value, size, nullptr, 0);
+    }
+
+    NodeIndex Add(NodeType type, uint32_t value, uint32_t size, const std::vector<NodeIndex> &children)
+    {
+        return Add(type, value, size, children.data(), children.size());
+    }
+
+    // 文字列表に追加して位置を返す
+    uint32_t AddString(const std::string &s)
+    {
+        strings_.push_back(s);
+        return static_cast<uint32_t>(strings_.size() - 1);
+    }
+
+    const FlatNode &operator[](NodeIndex i) const { return nodes_[i]; }
+
+    // i 番目のノードの k 番目の子
+    NodeIndex Child(NodeIndex i, size_t k) const { return children_[nodes_[i].first + k]; }
+
+    const std::string &String(uint32_t i) const { return strings_[i]; }
+
+    NodeIndex Root() const { return nodes_.empty() ? kNoNode : static_cast<NodeIndex>(nodes_.size() - 1); }
+
+    size_t size() const { return nodes_.size(); }
+
+    const std::vector<FlatNode> &nodes() const { return nodes_; }
+
+    void Clear()
+    {
+        nodes_.clear();
+        children_.clear();
+        strings_.clear();
+    }
+
+  private:
+    std::vector<FlatNode> nodes_;
+    std::vector<NodeIndex> children_;
+    std::vector<std::string> strings_;
+};
+
+// 平坦な AST からアセンブリを生成する
+// ノードの種別で switch して 1 つの文字列に追記していく (仮想関数呼び出しも中間の文字列もない)
+class FlatAssembler
+{
+  public:
+    FlatAssembler(const FlatAST &ast, AssemblyConfig &conf) : ast_(ast), conf_(conf) {}
+
+    std::string Assemble()
+    {
+        code_.clear();
+        if (ast_.Root() != kNoNode)
+            Emit(ast_.Root());
+        return code_;
+    }
+
+  private:
+    // 値を表すノード (リテラル・変数参照. 一次式はその中身) のオペランド. それ以外は空
+    std::string Operand(NodeIndex i) const
+    {
+        const FlatNode &node = ast_[i];
+        switch (node.type)
+        {
+        case kPrimaryExpr:
+            return (node.count != 0) ? Operand(ast_.Child(i, 0)) : std::string();
+        case kIntegerLiteral:
+        case kStringLiteral:
+            return ast_.String(node.value);
+        case kDeclRefExpr:
+            return PtrType(node.size) + "[rbp-" + std::to_string(node.value) + "]";
+        default:
+            return std::string();
+        }
+    }
+
+    static std::string PtrType(uint32_t size)
+    {
+        switch (size)
+        {
+        case 1:
+            return "BYTE PTR";
+        case 2:
+            return "WORD PTR";
+        case 4:
+            return "DWORD PTR";
+        case 8:
+            return "QWORD PTR";
+        default:
+            return std::string();
+        }
+    }
+
+    // 木を行きがけと帰りがけで辿る. 深い木でも再帰しないよう明示的なスタックを使う
+    void Emit(NodeIndex root)
+    {
+        struct Frame
+        {
+            NodeIndex node;
+            uint32_t next; // 次に辿る子
+        };
+        std::vector<Frame> stack;
+        if (Enter(root))
+            stack.push_back({root, 0});
+
+        while (!stack.empty())
+        {
+            Frame &frame = stack.back();
+            if (frame.next < ast_[frame.node].count)
+            {
+                const NodeIndex child = ast_.Child(frame.node, frame.next++);
+                if (Enter(child))
+                    stack.push_back({child, 0});
+                continue;
+            }
+            Leave(frame.node);
+            stack.pop_back();
+        }
+    }
+
+    // 子より前に出力する部分
+    //   戻り値 : 子を辿るなら true
+    bool Enter(NodeIndex i)
+    {
+        const FlatNode &node = ast_[i];
+        switch (node.type)
+        {
+        case kProgram:
+            if (conf_.mode == kIntel)
+                code_ += conf_.asm_.Directive("intel_syntax noprefix");
+            return true;
+
+        case kFuncDefinition:
+            if (ast_.String(node.value) == "main")
+            {
+                code_ += conf_.asm_.Directive("globl _main");
+                code_ += conf_.asm_.Label("_main");
+            }
+            code_ += conf_.asm_.Asm("push", {"rbp"});
+            code_ += conf_.asm_.Asm("mov", {"rbp", "rsp"});
+            return true;
+
+        case kReturnStmt:
+        case kExprStmt:
+            return true;
+
+        case kPrimaryExpr:
+            if (node.count != 0)
+                code_ += conf_.asm_.Asm("mov", {"rax", Operand(ast_.Child(i, 0))});
+            return false;
+
+        case kIntegerLiteral:
+        case kDeclRefExpr:
+            code_ += Operand(i);
+            return false;
+
+        case kStringLiteral:
+            code_ += "\"" + Operand(i) + "\"";
+            return false;
+
+        case kAssignmentExpr:
+            EmitAssignment(i);
+            return false;
+
+        // 変数宣言・二項演算式のコード生成は未実装
+        default:
+            return false;
+        }
+    }
+
+    // 子の後に出力する部分
+    void Leave(NodeIndex i)
+    {
+        if (ast_[i].type == kFuncDefinition)
+        {
+            code_ += conf_.asm_.Asm("mov", {"rsp", "rbp"});
+            code_ += conf_.asm_.Asm("pop", {"rbp"});
+            code_ += conf_.asm_.Asm("ret");
+        }
+    }
+
+    // 変数への単純代入 (右辺がリテラルか変数のもの). 複合代入と右辺が式のものは未実装
+    void EmitAssignment(NodeIndex i)
+    {
+        const FlatNode &node = ast_[i];
+        const NodeIndex target = ast_.Child(i, 0);
+        const NodeIndex source = ast_.Child(i, 1);
+        const std::string src = Operand(source);
+        if (node.value != kAssign || ast_[target].type != kDeclRefExpr || src.empty())
+            return;
+
+        // メモリ間の mov はないので変数の値は rax を経由する
+        const NodeIndex value = (ast_[source].type == kPrimaryExpr) ? ast_.Child(source, 0) : source;
+        if (ast_[value].type == kDeclRefExpr)
+        {
+            code_ += conf_.asm_.Asm("mov", {"rax", src});
+            code_ += conf_.asm_.Asm("mov", {Operand(target), "rax"});
+        }
+        else
+        {
+            code_ += conf_.asm_.Asm("mov", {Operand(target), src});
+        }
+    }
+
+    const FlatAST &ast_;
+    AssemblyConfig &conf_;
+    std::string code_;
+};
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef HEADER_CACHE_HH
+#define HEADER_CACHE_HH
+
+#include <climits>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "line_table.hh"
+#include "source.hh"
+#include "symbol.hh"
+#include "tokenizer.hh"
+
+namespace kcc
+{
+
+// 字句解析済みのソースファイル
+// トークンはバッファを参照するので、ファイルはトークンより長く生存させること.
+struct SourceFile
+{
+    SourceFile() : src(nullptr), size(0), guard(kNoSymbol) {}
+
+    SourceFile(const SourceFile &) = delete;
+    SourceFile &operator=(const SourceFile &) = delete;
+
+    std::string path;
+    const char *src;
+    size_t size;
+
+    std::vector<Token> tokens;
+    std::vector<bool> line_start; // トークンが行頭 (前のトークンとの間に改行がある) か
+
+    // インクルードガード (#ifndef X / #define X ... #endif) のマクロ名. なければ kNoSymbol
+    SymbolID guard;
+
+    // 診断メッセージ用の行番号表
+    mutable LineTable lines;
+
+    // ファイルの内容 (mmap したバッファ、またはメモリ上のテキスト)
+    SourceBuffer buffer;
+    std::string text;
+
+    // path 中のディレクトリ部分 ("a/b.h" -> "a/")
+    std::string Directory() const
+    {
+        size_t slash = path.find_last_of('/');
+        return (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+    }
+
+    // src を字句解析してトークン・行頭フラグ・インクルードガードを求める
+    // 行の継続 (\ + 改行) があれば、つなげたものを text に置いて src とする
+    void Prepare()
+    {
+        if (FindLineSplice(src, src + size))
+        {
+            std::string spliced;
+            SpliceLines(src, size, &spliced);
+            text.swap(spliced);
+            src = text.data();
+            size = text.size();
+        }
+
+        tokens.clear();
+        Tokenizer tzr;
+        tzr.Tokenize(src, size, &tokens);
+        Index();
+    }
+
+    // 字句解析済みの tokens から行頭フラグ・インクルードガードを求める
+    void Index()
+    {
+        line_start.assign(tokens.size(), false);
+        const char *prev_end = src;
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            const char *p = tokens[i].token.data();
+            line_start[i] = (i == 0) || HasNewline(prev_end, p);
+            prev_end = p + tokens[i].token.size();
+        }
+
+        lines.Reset(src, size);
+        guard = FindIncludeGuard();
+    }
+
+    // i 番目のトークンが '#' で始まる指令の先頭か
+    bool IsDirective(size_t i) const
+    {
+        return line_start[i] && tokens[i].type == tkHash;
+    }
+
+    // i 番目のトークンを含む行の次の行の先頭トークンの位置
+    size_t NextLine(size_t i) const
+    {
+        for (++i; i < tokens.size() && !line_start[i];)
+            ++i;
+        return i;
+    }
+
+  private:
+    static bool HasNewline(const char *p, const char *end)
+    {
+        for (; p != end; ++p)
+        {
+            if (*p == '\n' || *p == '\r')
+                return true;
+        }
+        return false;
+    }
+
+    // 指令名 (# の次のトークン) が name であるか
+    bool IsDirectiveName(size_t i, const char *name) const
+    {
+        return IsDirective(i) && i + 1 < tokens.size() && !line_start[i + 1] && tokens[i + 1].token == name;
+    }
+
+    // ファイル全体が次の形であればガードのマクロ名を返す
+    //   #ifndef X
+    //   #define X ...
+    //   ...
+    //   #endif
+    // 対応する #endif の後ろにトークンがあったり、#else / #elif で分岐する場合はガードではない
+    SymbolID FindIncludeGuard() const
+    {
+        if (!IsDirectiveName(0, "ifndef") || tokens.size() < 3 || tokens[2].type != tkWord || line_start[2])
+            return kNoSymbol;
+        const SymbolID name = tokens[2].symbol;
+
+        size_t i = NextLine(0);
+        if (!IsDirectiveName(i, "define") || i + 2 >= tokens.size() || tokens[i + 2].symbol != name)
+            return kNoSymbol;
+
+        int depth = 1;
+        for (i = NextLine(i); i < tokens.size(); i = NextLine(i))
+        {
+            if (!IsDirective(i))
+                continue;
+            if (IsDirectiveName(i, "if") || IsDirectiveName(i, "ifdef") || IsDirectiveName(i, "ifndef"))
+                ++depth;
+            else if (depth == 1 && (IsDirectiveName(i, "else") || IsDirectiveName(i, "elif")))
+                return kNoSymbol;
+            else if (IsDirectiveName(i, "endif") && --depth == 0)
+                return (NextLine(i) == tokens.size()) ? name : kNoSymbol;
+        }
+        return kNoSymbol;
+    }
+};
+
+// ヘッダファイルのキャッシュ
+// ヘッダは最初に参照された時に一度だけ mmap して字句解析し、以降は同じ SourceFile を共有する.
+// 同じプロセスで複数の翻訳単位をコンパイルする場合もヘッダを読み直さない.
+// 見つからなかったパスも記録しておき、インクルードパスの探索で何度も open しない.
+// Load は複数のスレッドから呼んでよい (字句解析で登録する GlobalSymbols() もスレッドセーフ).
+class HeaderCache
+{
+  public:
+    HeaderCache() : loaded_(0) {}
+
+    HeaderCache(const HeaderCache &) = delete;
+    HeaderCache &operator=(const HeaderCache &) = delete;
+
+    // path のヘッダを取得する. 開けなければ nullptr
+    std::shared_ptr<const SourceFile> Load(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = files_.find(path);
+        if (it != files_.end())
+            return it->second;
+
+        // 別の綴りのパスで読み込み済みであれば共有する
+        std::string canonical = Canonicalize(path);
+        std::shared_ptr<const SourceFile> file;
+        if (!canonical.empty())
+        {
+            auto c = files_.find(canonical);
+            if (c != files_.end())
+            {
+                file = c->second;
+            }
+            else
+            {
+                std::shared_ptr<SourceFile> f(new SourceFile);
+                if (f->buffer.Open(canonical))
+                {
+                    f->path = path;
+                    f->src = f->buffer.data();
+                    f->size = f->buffer.size();
+                    f->Prepare();
+                    file = f;
+                    ++loaded_;
+                }
+                files_[canonical] = file;
+            }
+        }
+
+        files_[path] = file;
+        return file;
+    }
+
+    // メモリ上のテキストをヘッダとして登録する (組み込みヘッダ・テスト用)
+    void AddFile(const std::string &path, const std::string &text)
+    {
+        std::shared_ptr<SourceFile> f(new SourceFile);
+        f->path = path;
+        f->text = text;
+        f->src = f->text.data();
+        f->size = f->text.size();
+        f->Prepare();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_[path] = f;
+        ++loaded_;
+    }
+
+    // これまでに読み込んで字句解析したファイル数
+    size_t LoadCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return loaded_;
+    }
+
+  private:
+    // 実在するファイルの正規化したパス. 存在しなければ空文字列
+    static std::string Canonicalize(const std::string &path)
+    {
+#ifndef _WIN32
+        char resolved[PATH_MAX];
+        if (!::realpath(path.c_str(), resolved))
+            return std::string();
+        return resolved;
+#else
+        FILE *fp = std::fopen(path.c_str(), "rb");
+        if (!fp)
+            return std::string();
+        std::fclose(fp);
+        return path;
+#endif
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const SourceFile>> files_;
+    size_t loaded_;
+};
+
+// 翻訳単位間で共有するヘッダキャッシュ
+inline HeaderCache &GlobalHeaderCache()
+{
+    static HeaderCache cache;
+    return cache;
+}
+
+} // namespace kcc
+
+#endif
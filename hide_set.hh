@@ -0,0 +1,128 @@
+#ifndef HIDE_SET_HH
+#define HIDE_SET_HH
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "arena.hh"
+#include "symbol.hh"
+
+namespace kcc
+{
+
+// マクロ展開のハイドセット (展開してはいけないマクロ名の集合)
+// シンボル ID の昇順の連結リストで、nullptr が空集合.
+// HideSetTable が同じ集合を常に同じノードで表す (ハッシュコンシング) ので、ポインタの比較で集合を比較できる.
+struct HideSet
+{
+    SymbolID symbol;
+    const HideSet *next;
+};
+
+// ハイドセットの生成と集合演算
+// ノードはアリーナに置き、和集合・積集合の結果はメモ化する.
+class HideSetTable
+{
+  public:
+    explicit HideSetTable(Arena &arena) : arena_(arena) {}
+
+    HideSetTable(const HideSetTable &) = delete;
+    HideSetTable &operator=(const HideSetTable &) = delete;
+
+    static bool Contains(const HideSet *hs, SymbolID symbol)
+    {
+        for (; hs && hs->symbol <= symbol; hs = hs->next)
+        {
+            if (hs->symbol == symbol)
+                return true;
+        }
+        return false;
+    }
+
+    const HideSet *Add(const HideSet *hs, SymbolID symbol)
+    {
+        return Union(hs, Cons(symbol, nullptr));
+    }
+
+    const HideSet *Union(const HideSet *a, const HideSet *b)
+    {
+        if (a == b || !b)
+            return a;
+        if (!a)
+            return b;
+
+        Key key(a, b);
+        auto it = unions_.find(key);
+        if (it != unions_.end())
+            return it->second;
+
+        const HideSet *result;
+        if (a->symbol == b->symbol)
+            result = Cons(a->symbol, Union(a->next, b->next));
+        else if (a->symbol < b->symbol)
+            result = Cons(a->symbol, Union(a->next, b));
+        else
+            result = Cons(b->symbol, Union(a, b->next));
+        unions_[key] = result;
+        return result;
+    }
+
+    const HideSet *Intersect(const HideSet *a, const HideSet *b)
+    {
+        if (a == b)
+            return a;
+        if (!a || !b)
+            return nullptr;
+
+        Key key(a, b);
+        auto it = intersections_.find(key);
+        if (it != intersections_.end())
+            return it->second;
+
+        const HideSet *result;
+        if (a->symbol == b->symbol)
+            result = Cons(a->symbol, Intersect(a->next, b->next));
+        else if (a->symbol < b->symbol)
+            result = Intersect(a->next, b);
+        else
+            result = Intersect(a, b->next);
+        intersections_[key] = result;
+        return result;
+    }
+
+  private:
+    typedef std::pair<const void *, const void *> Key;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &k) const
+        {
+            return std::hash<const void *>()(k.first) * 31 + std::hash<const void *>()(k.second);
+        }
+    };
+
+    // (symbol, next) のノード. 同じ組には同じノードを返す
+    const HideSet *Cons(SymbolID symbol, const HideSet *next)
+    {
+        Key key(reinterpret_cast<const void *>(static_cast<uintptr_t>(symbol)), next);
+        auto it = nodes_.find(key);
+        if (it != nodes_.end())
+            return it->second;
+
+        HideSet *node = arena_.AllocateArray<HideSet>(1);
+        node->symbol = symbol;
+        node->next = next;
+        nodes_[key] = node;
+        return node;
+    }
+
+    Arena &arena_;
+    std::unordered_map<Key, const HideSet *, KeyHash> nodes_;
+    std::unordered_map<Key, const HideSet *, KeyHash> unions_;
+    std::unordered_map<Key, const HideSet *, KeyHash> intersections_;
+};
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef LINE_TABLE_HH
+#define LINE_TABLE_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "scan.hh"
+#include "util.hh"
+
+namespace kcc
+{
+
+// バイト位置から行番号・桁番号を求める表
+// トークンはバイト位置しか持たないので、診断メッセージ等で行番号が必要になった時に使う.
+// 行頭位置の表は最初の問い合わせ時にスキャンカーネルで改行を列挙して作る.
+class LineTable
+{
+  public:
+    LineTable() : src_(nullptr), size_(0), built_(false) {}
+
+    // src はこのオブジェクトより長く生存させること
+    void Reset(const char *src, size_t size)
+    {
+        if (size > std::numeric_limits<uint32_t>::max())
+        {
+            throw_ln("line table : input is too large");
+        }
+
+        src_ = src;
+        size_ = size;
+        line_starts_.clear();
+        built_ = false;
+    }
+
+    // 行番号 (1 始まり). 入力が設定されていなければ 0
+    size_t Line(uint32_t offset)
+    {
+        if (!src_)
+            return 0;
+        Build();
+        return std::upper_bound(line_starts_.begin(), line_starts_.end(), offset) - line_starts_.begin();
+    }
+
+    // 桁番号 (1 始まり, バイト単位). 入力が設定されていなければ 0
+    size_t Column(uint32_t offset)
+    {
+        size_t line = Line(offset);
+        if (line == 0)
+            return 0;
+        return offset - line_starts_[line - 1] + 1;
+    }
+
+  private:
+    void Build()
+    {
+        if (built_)
+            return;
+
+        // 1 行目の行頭 0 と、改行の直後の位置
+        line_starts_.push_back(0);
+        scan::kKernels.collect_line_starts(src_, src_ + size_, &line_starts_);
+        built_ = true;
+    }
+
+    const char *src_;
+    size_t size_;
+
+    std::vector<uint32_t> line_starts_;
+    bool built_;
+};
+
+} // namespace kcc
+
+#endif
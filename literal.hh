@@ -0,0 +1,154 @@
+#ifndef LITERAL_HH
+#define LITERAL_HH
+
+#include <cstdint>
+#include <string>
+
+#include "number.hh"
+#include "symbol.hh"
+
+namespace kcc
+{
+
+// 文字列リテラルの ID (リテラルプールの添字)
+typedef uint32_t LiteralID;
+
+// 文字列リテラルのプール
+// エスケープシーケンスを解いた内容を重複なく保持する. 同じ内容の文字列リテラルは同じ ID になるので、
+// そのままコード生成の .rodata のテーブルとして使える. 識別子と同じく SymbolTable で管理する.
+inline SymbolTable &GlobalLiterals()
+{
+    static SymbolTable table;
+    return table;
+}
+
+namespace literal
+{
+
+static inline int HexValue(char c)
+{
+    if ('0' <= c && c <= '9')
+        return c - '0';
+    if ('a' <= c && c <= 'f')
+        return c - 'a' + 10;
+    if ('A' <= c && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// p が指すエスケープシーケンス (\ の直後) を 1 つ解いて value に格納し、次の位置を返す
+static inline const char *DecodeEscape(const char *p, const char *e, unsigned int *value, uint8_t *flags)
+{
+    char c = *p++;
+    switch (c)
+    {
+    case 'n': *value = '\n'; return p;
+    case 't': *value = '\t'; return p;
+    case 'r': *value = '\r'; return p;
+    case 'a': *value = '\a'; return p;
+    case 'b': *value = '\b'; return p;
+    case 'f': *value = '\f'; return p;
+    case 'v': *value = '\v'; return p;
+    case '\\': case '\'': case '"': case '?':
+        *value = static_cast<unsigned char>(c);
+        return p;
+    case 'x':
+    {
+        unsigned int v = 0;
+        const char *digits = p;
+        for (int d; p != e && (d = HexValue(*p)) >= 0; ++p)
+        {
+            if (v > 0xff)
+                *flags |= nfOverflow;
+            v = (v << 4) | d;
+        }
+        if (p == digits)
+            *flags |= nfInvalid;
+        *value = v & 0xff;
+        if (v > 0xff)
+            *flags |= nfOverflow;
+        return p;
+    }
+    default:
+        if ('0' <= c && c <= '7')
+        {
+            // 8 進数は最大 3 桁
+            unsigned int v = c - '0';
+            for (int i = 0; i < 2 && p != e && '0' <= *p && *p <= '7'; ++i, ++p)
+                v = (v << 3) | (*p - '0');
+            if (v > 0xff)
+                *flags |= nfOverflow;
+            *value = v & 0xff;
+            return p;
+        }
+        // 未知のエスケープはその文字自身とする
+        *flags |= nfInvalid;
+        *value = static_cast<unsigned char>(c);
+        return p;
+    }
+}
+
+} // namespace literal
+
+// 引用符の内側 [s, e) のエスケープシーケンスを解いて out に格納する
+//   戻り値 : NumberFlag の組み合わせ (nfInvalid, nfOverflow)
+static inline uint8_t DecodeStringLiteral(const char *s, const char *e, std::string *out)
+{
+    uint8_t flags = 0;
+    out->clear();
+    out->reserve(e - s);
+    while (s != e)
+    {
+        if (*s != '\\')
+        {
+            out->push_back(*s++);
+            continue;
+        }
+
+        unsigned int v;
+        if (++s == e)
+            return flags | nfInvalid;
+        s = literal::DecodeEscape(s, e, &v, &flags);
+        out->push_back(static_cast<char>(v));
+    }
+    return flags;
+}
+
+// 文字定数の引用符の内側 [s, e) の値を求める
+// 複数文字の場合は gcc と同じく先頭から 8bit ずつ詰める. char は符号付きとして扱う
+//   戻り値 : NumberFlag の組み合わせ (nfInvalid, nfOverflow)
+static inline uint8_t DecodeCharacterLiteral(const char *s, const char *e, uint64_t *value)
+{
+    uint8_t flags = 0;
+    uint32_t v = 0;
+    int count = 0;
+    while (s != e)
+    {
+        unsigned int c;
+        if (*s == '\\')
+        {
+            if (++s == e)
+                return flags | nfInvalid;
+            s = literal::DecodeEscape(s, e, &c, &flags);
+        }
+        else
+        {
+            c = static_cast<unsigned char>(*s++);
+        }
+        v = (v << 8) | c;
+        ++count;
+    }
+
+    if (count == 0)
+        flags |= nfInvalid;
+    else if (count > 4)
+        flags |= nfOverflow;
+
+    int32_t result = (count == 1) ? static_cast<signed char>(v) : static_cast<int32_t>(v);
+    *value = static_cast<uint64_t>(static_cast<int64_t>(result));
+    return flags;
+}
+
+} // namespace kcc
+
+#endif
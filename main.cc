@@ -1,8 +1,14 @@
+#include <cstring>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <vector>
 
+#include "parallel_tokenizer.hh"
+#include "pch.hh"
+#include "preprocessor.hh"
+#include "source.hh"
 #include "tokenizer.hh"
 #include "parser.hh"
 
@@ -13,25 +19,122 @@ struct CmdOptions
 {
     std::string module_name;
     std::string assembly_filename;
+
+    // number of threads used for lexing and parsing (-j)
+    unsigned int threads = 1;
+
+    // directories searched by #include (-I)
+    std::vector<std::string> include_paths;
+
+    // precompiled header written after parsing the input (--emit-pch)
+    std::string emit_pch;
+
+    // precompiled header loaded before parsing the input (--include-pch)
+    std::string include_pch;
+
+    // print the trace buffer to stderr when the compiler exits (--dump-trace).
+    // only trace points enabled by KCC_TRACE_LEVEL at build time are recorded.
+    bool dump_trace = false;
 };
 
 // Compile
 // Compiling a source codesource codes.
-int Compile(std::string &assembly, const std::string &module_name, std::vector<char> &buffer)
+int Compile(std::string &assembly, const CmdOptions &opts, const SourceBuffer &source)
 {
-    PDEBUG("======= Tokenization =======");
+    TRACE_PHASE("tokenization");
 
     auto compiler_state = std::shared_ptr<CompilerState>(new CompilerState);
+    compiler_state->lines.Reset(source.data(), source.size());
+
+    // tokens are lexed lazily as the parser pulls them, unless more threads
+    // are requested, in which case the whole file is lexed up front and the
+    // top-level definitions are parsed in parallel on the same pool.
+    // sources containing '#' go through the built-in preprocessor; headers
+    // are taken from the shared header cache.
+    // a precompiled header is mapped, not loaded: macros, types and
+    // identifiers are pulled out of it as they are referenced.
+    std::unique_ptr<ThreadPool> pool;
+    if (opts.threads > 1)
+    {
+        pool.reset(new ThreadPool(opts.threads));
+    }
+
+    TokenArray tokens;
+    std::vector<Token> preprocessed;
+    Preprocessor preprocessor; // owns the tokens created by '#' and '##'
+    PrecompiledHeader pch;     // owns the bodies of macros taken from the PCH
+    if (!opts.include_pch.empty())
+    {
+        if (!pch.Open(opts.include_pch))
+        {
+            throw std::invalid_argument("Cannot read precompiled header: " + opts.include_pch);
+        }
+        preprocessor.UsePch(&pch);
+        compiler_state->pch = &pch;
+    }
+
+    if (std::memchr(source.data(), '#', source.size()) || pch.IsOpen() || !opts.emit_pch.empty())
+    {
+        SourceFile file;
+        file.path = opts.module_name;
+        file.src = source.data();
+        file.size = source.size();
+        if (pool)
+        {
+            ParallelTokenizer tokenizer(*pool);
+            tokenizer.Tokenize(file.src, file.size, &file.tokens);
+            file.Index();
+        }
+        else
+        {
+            file.Prepare();
+        }
+
+        for (auto &dir : opts.include_paths)
+        {
+            preprocessor.AddIncludePath(dir);
+        }
+        if (!preprocessor.Run(file, &preprocessed))
+        {
+            throw std::runtime_error("preprocessing failed");
+        }
+        compiler_state->tokens.Assign(preprocessed);
+    }
+    else if (pool)
+    {
+        ParallelTokenizer tokenizer(*pool);
+        tokenizer.Tokenize(source.data(), source.size(), &tokens);
+        compiler_state->tokens.Assign(tokens);
+    }
+    else
+    {
+        compiler_state->tokens.Open(source.data(), source.size());
+    }
 
-    Tokenizer tokenizer;
-    tokenizer.Tokenize(buffer, &(compiler_state->buf));
-    
-    compiler_state->iter = std::end(compiler_state->buf);
- 
     Parser parser(compiler_state);
-    auto prog = parser.SyntaxCheck();
 
-    PDEBUG("======= Code Generation ========");
+    // a header usually has nothing but directives left after preprocessing
+    if (!opts.emit_pch.empty())
+    {
+        if (!preprocessed.empty())
+        {
+            parser.SyntaxCheck();
+        }
+
+        PchWriter writer;
+        preprocessor.ExportMacros(&writer);
+        compiler_state->ExportPch(&writer);
+        if (!writer.Write(opts.emit_pch))
+        {
+            throw std::runtime_error("Cannot write precompiled header: " + opts.emit_pch);
+        }
+        return 0;
+    }
+
+    TRACE_PHASE("parsing");
+    auto prog = pool ? parser.ParallelSyntaxCheck(*pool) : parser.SyntaxCheck();
+
+    TRACE_PHASE("code generation");
 
     parser.GenerateAssembly(prog, &assembly);
     return 0;
@@ -66,9 +169,50 @@ std::unique_ptr<CmdOptions> ReadOptions(int argc, char **argv)
             continue;
         }
 
+        if (o->compare("-j") == 0) {
+            ++o;
+            if (o == opts_array.end()) {
+                throw std::invalid_argument("No specific number of threads");
+            }
+            opts->threads = std::stoul(*o);
+            continue;
+        }
+
+        if (o->compare(0, 2, "-I") == 0) {
+            if (o->size() == 2) {
+                ++o;
+                if (o == opts_array.end()) {
+                    throw std::invalid_argument("No specific include directory");
+                }
+                opts->include_paths.push_back(*o);
+            } else {
+                opts->include_paths.push_back(o->substr(2));
+            }
+            continue;
+        }
+
+        if (o->compare("--dump-trace") == 0) {
+            opts->dump_trace = true;
+            continue;
+        }
+
+        if (o->compare("--emit-pch") == 0 || o->compare("--include-pch") == 0) {
+            std::string &path = (o->compare("--emit-pch") == 0) ? opts->emit_pch : opts->include_pch;
+            ++o;
+            if (o == opts_array.end()) {
+                throw std::invalid_argument("No specific precompiled header file");
+            }
+            path = *o;
+            continue;
+        }
+
         opts->module_name = std::string(argv[1]);
     }
 
+    if (!opts->emit_pch.empty() && !opts->include_pch.empty()) {
+        throw std::invalid_argument("--emit-pch cannot be combined with --include-pch");
+    }
+
     return opts;
 }
 
@@ -77,31 +221,22 @@ std::unique_ptr<CmdOptions> ReadOptions(int argc, char **argv)
 // main function
 int main(int argc, char **argv)
 {
+    bool dump_trace = false;
     try
     {
         auto opts = kcc::ReadOptions(argc, argv);
-        std::fstream fin;
-        fin.open(opts->module_name.c_str(), std::ios::in);
-        if (!fin)
+        dump_trace = opts->dump_trace;
+
+        // Map the source file read-only ("-" reads from stdin)
+        kcc::SourceBuffer source;
+        if (!source.Open(opts->module_name))
         {
             throw std::invalid_argument("Cannot open file.");
         }
 
-        fin.seekg(0, std::fstream::end);
-        auto eofPos = fin.tellg();
-        fin.seekg(0, std::fstream::beg);
-        auto beginPos = fin.tellg();
-
-        auto size = eofPos - beginPos;
-
-        std::vector<char> buf(size);
-        fin.read(&buf[0], size);
-
-        //PrintCharVector(buf);
-
         // Compiling a source code
         std::string assembly_code = "";
-        kcc::Compile(assembly_code, opts->module_name, buf);
+        kcc::Compile(assembly_code, *opts, source);
 
         // Output file
         if (!opts->assembly_filename.empty())
@@ -114,7 +249,16 @@ int main(int argc, char **argv)
     {
         std::cerr << e.what() << std::endl;
 
+        if (dump_trace)
+        {
+            kcc::GlobalTrace().Dump(std::cerr);
+        }
         return 1;
     }
+
+    if (dump_trace)
+    {
+        kcc::GlobalTrace().Dump(std::cerr);
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#ifndef NUMBER_HH
+#define NUMBER_HH
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace kcc
+{
+
+// 数値リテラルの解析結果のフラグ
+enum NumberFlag
+{
+    nfUnsigned = 1 << 0,     // u, U
+    nfLong = 1 << 1,         // l, L (浮動小数点数では long double)
+    nfLongLong = 1 << 2,     // ll, LL
+    nfFloat = 1 << 3,        // f, F (浮動小数点数のみ)
+    nfOverflow = 1 << 4,     // 値が表現できる範囲を超えた
+    nfInvalid = 1 << 5,      // 不正な数字・サフィックス
+    nfUnterminated = 1 << 6, // 閉じていない文字列リテラル・文字定数
+};
+
+// 数値リテラルの値
+// 整数リテラルは integer、浮動小数点数リテラルは real を使う
+union NumberValue
+{
+    uint64_t integer;
+    double real;
+};
+
+namespace number
+{
+
+// 8 byte がすべて '0'-'9' であるか (SWAR)
+static inline bool IsEightDigits(uint64_t v)
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) ==
+           0x3333333333333333ull;
+}
+
+// 8 桁の 10 進数を一度に変換する (SWAR, リトルエンディアン)
+static inline uint32_t ParseEightDigits(uint64_t v)
+{
+    v -= 0x3030303030303030ull;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+         (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >>
+        32;
+    return static_cast<uint32_t>(v);
+}
+
+static inline uint64_t Load8(const char *p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline bool IsLittleEndian()
+{
+    const uint16_t v = 1;
+    return *reinterpret_cast<const unsigned char *>(&v) == 1;
+}
+
+static inline int DigitValue(char c)
+{
+    if ('0' <= c && c <= '9')
+        return c - '0';
+    if ('a' <= c && c <= 'f')
+        return c - 'a' + 10;
+    if ('A' <= c && c <= 'F')
+        return c - 'A' + 10;
+    return 99;
+}
+
+// 整数のサフィックス u, l, ll の組み合わせ (大文字小文字・順序は問わない. lL は不可)
+static inline uint8_t ParseIntegerSuffix(const char *p, const char *e)
+{
+    uint8_t flags = 0;
+    while (p != e)
+    {
+        if ((*p == 'u' || *p == 'U') && !(flags & nfUnsigned))
+        {
+            flags |= nfUnsigned;
+            ++p;
+        }
+        else if ((*p == 'l' || *p == 'L') && !(flags & (nfLong | nfLongLong)))
+        {
+            if (p + 1 != e && p[1] == *p)
+            {
+                flags |= nfLongLong;
+                p += 2;
+            }
+            else
+            {
+                flags |= nfLong;
+                ++p;
+            }
+        }
+        else
+        {
+            return flags | nfInvalid;
+        }
+    }
+    return flags;
+}
+
+// 10 のべき乗 (double で正確に表現できる範囲)
+static const double kExactPowersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+} // namespace number
+
+// 整数リテラル [s, e) を解析する (10 進数, 0x で始まる 16 進数, 0 で始まる 8 進数)
+//   戻り値 : NumberFlag の組み合わせ
+static inline uint8_t ParseIntegerLiteral(const char *s, const char *e, uint64_t *value)
+{
+    uint64_t v = 0;
+    uint8_t flags = 0;
+    const char *p = s;
+
+    if (e - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+        p += 2;
+        const char *digits = p;
+        for (int d; p != e && (d = number::DigitValue(*p)) < 16; ++p)
+        {
+            if (v >> 60)
+                flags |= nfOverflow;
+            v = (v << 4) | d;
+        }
+        if (p == digits)
+            flags |= nfInvalid;
+    }
+    else if (e - p >= 2 && p[0] == '0' && ('0' <= p[1] && p[1] <= '9'))
+    {
+        for (int d; p != e && (d = number::DigitValue(*p)) < 10; ++p)
+        {
+            if (d >= 8)
+                flags |= nfInvalid;
+            if (v >> 61)
+                flags |= nfOverflow;
+            v = (v << 3) | (d & 7);
+        }
+    }
+    else
+    {
+        // 8 桁ずつ変換し、残りを 1 桁ずつ変換する
+        const uint64_t kMax = UINT64_MAX;
+        if (number::IsLittleEndian())
+        {
+            while (e - p >= 8 && number::IsEightDigits(number::Load8(p)))
+            {
+                uint32_t chunk = number::ParseEightDigits(number::Load8(p));
+                if (v > (kMax - chunk) / 100000000u)
+                    flags |= nfOverflow;
+                v = v * 100000000u + chunk;
+                p += 8;
+            }
+        }
+        for (; p != e && '0' <= *p && *p <= '9'; ++p)
+        {
+            unsigned d = *p - '0';
+            if (v > (kMax - d) / 10)
+                flags |= nfOverflow;
+            v = v * 10 + d;
+        }
+    }
+
+    *value = v;
+    return flags | number::ParseIntegerSuffix(p, e);
+}
+
+// 浮動小数点数リテラル [s, e) を解析する (1.5, .5, 1e10, 1.5e-3f)
+// 仮数部が 2^53 以下かつ指数の絶対値が 22 以下であれば 10 のべき乗との 1 回の乗除算で正確に求まる.
+// それ以外は strtod で求める.
+//   戻り値 : NumberFlag の組み合わせ
+static inline uint8_t ParseFloatLiteral(const char *s, const char *e, double *value)
+{
+    uint64_t mantissa = 0;
+    int digits = 0;   // 仮数部の有効桁数
+    int exponent = 0; // 10 進の指数
+    bool truncated = false;
+    const char *p = s;
+
+    for (; p != e && '0' <= *p && *p <= '9'; ++p)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += (mantissa != 0);
+        }
+        else
+        {
+            ++exponent;
+            truncated |= (*p != '0');
+        }
+    }
+    if (p != e && *p == '.')
+    {
+        for (++p; p != e && '0' <= *p && *p <= '9'; ++p)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += (mantissa != 0);
+                --exponent;
+            }
+            else
+            {
+                truncated |= (*p != '0');
+            }
+        }
+    }
+    if (p != e && (*p == 'e' || *p == 'E'))
+    {
+        ++p;
+        bool negative = (p != e && *p == '-');
+        if (p != e && (*p == '+' || *p == '-'))
+            ++p;
+        int exp = 0;
+        for (; p != e && '0' <= *p && *p <= '9'; ++p)
+        {
+            if (exp < 100000)
+                exp = exp * 10 + (*p - '0');
+        }
+        exponent += negative ? -exp : exp;
+    }
+    const char *number_end = p;
+
+    uint8_t flags = 0;
+    if (p != e)
+    {
+        if (e - p == 1 && (*p == 'f' || *p == 'F'))
+            flags |= nfFloat;
+        else if (e - p == 1 && (*p == 'l' || *p == 'L'))
+            flags |= nfLong;
+        else
+            flags |= nfInvalid;
+    }
+
+    if (!truncated && mantissa <= (1ull << 53) && -22 <= exponent && exponent <= 22)
+    {
+        double v = static_cast<double>(mantissa);
+        *value = (exponent < 0) ? v / number::kExactPowersOf10[-exponent] : v * number::kExactPowersOf10[exponent];
+        return flags;
+    }
+
+    std::string str(s, number_end);
+    errno = 0;
+    *value = std::strtod(str.c_str(), nullptr);
+    if (errno == ERANGE && std::isinf(*value))
+        flags |= nfOverflow;
+    return flags;
+}
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef PARALLEL_TOKENIZER_HH
+#define PARALLEL_TOKENIZER_HH
+
+#include <cstring>
+#include <vector>
+
+#include "scan.hh"
+#include "thread_pool.hh"
+#include "token_array.hh"
+#include "tokenizer.hh"
+
+namespace kcc
+{
+
+// 大きな入力を並列に字句解析する
+// 入力を改行の直後でチャンクに分割し、各チャンクをスレッドプールで字句解析して連結する.
+// 結果は Tokenizer::Tokenize と同一になる.
+//
+// トークン (文字列リテラルを含む) は改行をまたがないので、チャンク境界で問題になるのはブロックコメントだけである.
+// そこで各チャンクを「コード中から始まる場合」と「コメント中から始まる場合」の両方について
+// 並列に軽く走査し、先頭から順に境界の状態を確定させてから字句解析する.
+class ParallelTokenizer
+{
+  public:
+    static const size_t kDefaultChunkSize = 1 << 20;
+
+    explicit ParallelTokenizer(ThreadPool &pool, size_t chunk_size = kDefaultChunkSize)
+        : pool_(pool), chunk_size_(chunk_size), symbols_(&GlobalSymbols()), literals_(&GlobalLiterals()) {}
+
+    // 識別子を登録するシンボルテーブル (Tokenizer::SetSymbolTable と同じ)
+    void SetSymbolTable(SymbolTable *symbols)
+    {
+        symbols_ = symbols;
+    }
+
+    // 文字列リテラルを登録するリテラルプール (Tokenizer::SetLiteralPool と同じ)
+    void SetLiteralPool(SymbolTable *literals)
+    {
+        literals_ = literals;
+    }
+
+    int Tokenize(const std::vector<char> &buf, std::vector<Token> *dest)
+    {
+        return Tokenize(buf.data(), buf.size(), dest);
+    }
+
+    // トークンはバッファを参照するため一時オブジェクトは受け付けない
+    int Tokenize(std::vector<char> &&buf, std::vector<Token> *dest) = delete;
+
+    int Tokenize(const char *src, size_t size, std::vector<Token> *dest)
+    {
+        // 小さい入力は分割しない
+        if (!IsWorthSplitting(size))
+        {
+            Tokenizer tzr = NewTokenizer();
+            return tzr.Tokenize(src, size, dest);
+        }
+
+        std::vector<Chunk> chunks;
+        LexChunks(src, size, &chunks);
+
+        size_t total = dest->size();
+        for (auto &c : chunks)
+            total += c.tokens.size();
+        dest->reserve(total);
+        for (auto &c : chunks)
+            dest->insert(dest->end(), c.tokens.begin(), c.tokens.end());
+
+        return 0;
+    }
+
+    // TokenArray へ出力する. チャンクごとのトークン列は連結したものから解放する
+    int Tokenize(const char *src, size_t size, TokenArray *dest)
+    {
+        if (!IsWorthSplitting(size))
+        {
+            Tokenizer tzr = NewTokenizer();
+            dest->Build(src, size, &tzr);
+            return 0;
+        }
+
+        std::vector<Chunk> chunks;
+        LexChunks(src, size, &chunks);
+
+        dest->Reset(src, size);
+        for (auto &c : chunks)
+        {
+            for (auto &tok : c.tokens)
+                dest->Append(tok);
+            std::vector<Token>().swap(c.tokens);
+        }
+
+        return 0;
+    }
+
+  private:
+    struct Chunk;
+
+    Tokenizer NewTokenizer() const
+    {
+        Tokenizer tzr;
+        tzr.SetSymbolTable(symbols_);
+        tzr.SetLiteralPool(literals_);
+        return tzr;
+    }
+
+    bool IsWorthSplitting(size_t size) const
+    {
+        return pool_.Size() > 1 && size >= chunk_size_ * 2;
+    }
+
+    // チャンクに分割して並列に字句解析する
+    void LexChunks(const char *src, size_t size, std::vector<Chunk> *result)
+    {
+        const char *end = src + size;
+        std::vector<Chunk> &chunks = *result;
+        Split(src, end, &chunks);
+
+        // 1. 各チャンクを両方の開始状態について走査する
+        pool_.ParallelFor(chunks.size(), [&](size_t i) { Scan(chunks[i]); });
+
+        // 2. 先頭から境界の状態を確定させる
+        bool in_comment = false;
+        for (auto &c : chunks)
+        {
+            if (!in_comment)
+                c.lex_begin = c.begin;
+            else if (c.resume)
+                c.lex_begin = c.resume;
+            in_comment = c.ends_in_comment[in_comment];
+        }
+
+        // 次に字句解析を始める位置までを担当する
+        const char *lex_end = end;
+        for (size_t i = chunks.size(); i-- > 0;)
+        {
+            chunks[i].lex_end = lex_end;
+            if (chunks[i].lex_begin)
+                lex_end = chunks[i].lex_begin;
+        }
+
+        // 3. 並列に字句解析する
+        pool_.ParallelFor(chunks.size(), [&](size_t i) {
+            Chunk &c = chunks[i];
+            if (!c.lex_begin)
+                return;
+
+            // ID が逐次の字句解析と同じ順になるよう、シンボルテーブル・リテラルプールにはここでは登録しない
+            Tokenizer tzr;
+            tzr.SetSymbolTable(nullptr);
+            tzr.SetLiteralPool(nullptr);
+            tzr.Init(src, c.lex_begin, c.lex_end);
+            Token tok;
+            while (tzr.Next(&tok))
+                c.tokens.push_back(tok);
+        });
+
+        // 4. 識別子と文字列リテラルを先頭から順に登録する. 逐次の字句解析と同じ ID になる
+        Tokenizer interner = NewTokenizer();
+        for (auto &c : chunks)
+        {
+            for (auto &tok : c.tokens)
+                interner.Intern(&tok);
+        }
+    }
+
+    struct Chunk
+    {
+        const char *begin;
+        const char *end;
+
+        // 走査結果
+        bool ends_in_comment[2];  // [コメント中から始まったか] -> チャンク末尾でコメント中か
+        const char *resume;       // コメント中から始まった場合にコメントが閉じた直後の位置
+
+        // 字句解析の範囲
+        const char *lex_begin;
+        const char *lex_end;
+        std::vector<Token> tokens;
+    };
+
+    void Split(const char *src, const char *end, std::vector<Chunk> *chunks)
+    {
+        const char *p = src;
+        while (p != end)
+        {
+            const char *q = end;
+            if (static_cast<size_t>(end - p) > chunk_size_)
+            {
+                const void *lf = std::memchr(p + chunk_size_, '\n', end - (p + chunk_size_));
+                if (lf)
+                    q = static_cast<const char *>(lf) + 1;
+            }
+
+            Chunk c = {};
+            c.begin = p;
+            c.end = q;
+            chunks->push_back(c);
+            p = q;
+        }
+    }
+
+    static void Scan(Chunk &c)
+    {
+        // コード中から始まる場合
+        c.ends_in_comment[0] = ScanCode(c.begin, c.end);
+
+        // コメント中から始まる場合
+        const char *close = scan::kKernels.find_comment_end(c.begin, c.end);
+        if (close == c.end)
+        {
+            c.ends_in_comment[1] = true;
+            c.resume = nullptr;
+        }
+        else
+        {
+            c.resume = close + 2;
+            c.ends_in_comment[1] = ScanCode(c.resume, c.end);
+        }
+    }
+
+    // コード中から [p, end) を走査し、末尾でブロックコメント中であれば true
+    // 文字列リテラル・文字定数の中の "/*" や "//" はコメントではない
+    static bool ScanCode(const char *p, const char *end)
+    {
+        while (p != end)
+        {
+            const char *q = p;
+            while (q != end && *q != '/' && *q != '"' && *q != '\'')
+                ++q;
+            if (q == end)
+                return false;
+
+            if (*q != '/')
+            {
+                p = SkipQuoted(q, end);
+                continue;
+            }
+            if (q + 1 == end)
+                return false;
+
+            if (q[1] == '/')
+            {
+                // 行コメントは CR か LF で終わる
+                p = q + 2;
+                while (p != end && *p != '\n' && *p != '\r')
+                    ++p;
+            }
+            else if (q[1] == '*')
+            {
+                const char *close = scan::kKernels.find_comment_end(q + 2, end);
+                if (close == end)
+                    return true;
+                p = close + 2;
+            }
+            else
+            {
+                p = q + 1;
+            }
+        }
+        return false;
+    }
+
+    // 引用符 q から始まるリテラルの直後の位置 (Tokenizer::LexQuoted と同じ規則)
+    static const char *SkipQuoted(const char *q, const char *end)
+    {
+        const char quote = *q++;
+        while (q != end)
+        {
+            char c = *q;
+            if (c == quote)
+                return q + 1;
+            if (c == '\n' || c == '\r')
+                return q;
+            q += (c == '\\' && q + 1 != end && q[1] != '\n' && q[1] != '\r') ? 2 : 1;
+        }
+        return q;
+    }
+
+    ThreadPool &pool_;
+    size_t chunk_size_;
+    SymbolTable *symbols_;
+    SymbolTable *literals_;
+};
+
+} // namespace kcc
+
+#endif
@@ -10,11 +10,131 @@ Parser::Parser(const std::shared_ptr<CompilerState> &compiler_state) : compiler_
     Init();
 }
 
-std::shared_ptr<Program> Parser::SyntaxCheck()
+Program *Parser::SyntaxCheck()
 {
-    std::shared_ptr<Program> prog;
+    Program *prog = nullptr;
     bool result = MakeProgram(prog);
+    return CheckErrors(prog, result);
+}
+
+// トップレベルの定義ごとに並列に構文解析する
+//   1. 波括弧の対応だけを見てトップレベルの定義の境界を求め、関数をファイルスコープに宣言しておく
+//   2. 定義を kDefinitionsPerBatch 個ずつのバッチに分け、スレッドプールで構文解析する.
+//      バッチは自分の CompilerState (トークン列の一部, スコープ, アリーナ, エラー) を持ち、
+//      凍結したファイルスコープ (型と、前のバッチまでの関数) は読むだけ
+//   3. バッチの順に Program::decl, エラー, ファイルスコープの識別子を連結し、バッチをまたいだ再定義を見つける.
+//      最初に失敗したバッチより後は捨てるので、結果はスレッド数によらず逐次の構文解析と同じになる
+//   4. 別のバッチから参照された static 関数の本体を読む
+// トークン列が字句解析済みでない場合や、定義が 1 バッチに収まる場合は SyntaxCheck と同じ
+Program *Parser::ParallelSyntaxCheck(ThreadPool &pool)
+{
+    static const size_t kDefinitionsPerBatch = 32;
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    if (!compiler_state->tokens.IsStored() || pool.Size() < 2 || !ScanTopLevel(ranges) ||
+        ranges.size() <= kDefinitionsPerBatch)
+    {
+        return SyntaxCheck();
+    }
+
+    compiler_state->LoadPchReferences();
 
+    std::vector<size_t> decls_before;
+    DeclareTopLevel(ranges, decls_before);
+
+    const size_t batches = (ranges.size() + kDefinitionsPerBatch - 1) / kDefinitionsPerBatch;
+    std::vector<std::unique_ptr<Parser>> parsers;
+    for (size_t b = 0; b < batches; ++b)
+    {
+        const size_t first = b * kDefinitionsPerBatch;
+        const size_t last = std::min(first + kDefinitionsPerBatch, ranges.size());
+
+        std::shared_ptr<CompilerState> worker(new CompilerState);
+        worker->module_name = compiler_state->module_name;
+        worker->file_scope = compiler_state.get();
+        worker->file_scope_decls = decls_before[first];
+        worker->tokens.Slice(compiler_state->tokens, ranges[first].first, ranges[last - 1].second);
+        compiler_state->workers.push_back(worker);
+        parsers.emplace_back(new Parser(worker));
+    }
+
+    std::vector<Program *> programs(batches, nullptr);
+    std::vector<char> results(batches, false);
+    pool.ParallelFor(batches, [&](size_t b) { results[b] = parsers[b]->MakeProgram(programs[b]); });
+
+    Program *prog = NewNode<Program>();
+    std::unordered_set<SymbolID> defined;
+    std::vector<SymbolID> outside;
+    bool result = true;
+    for (size_t b = 0; b < batches && result; ++b)
+    {
+        CompilerState &worker = *parsers[b]->compiler_state;
+        result = results[b] != 0;
+        if (programs[b])
+        {
+            prog->decl.insert(std::end(prog->decl), std::begin(programs[b]->decl), std::end(programs[b]->decl));
+        }
+
+        for (auto e : worker.errors)
+        {
+            e.line_number = static_cast<int>(compiler_state->lines.Line(e.pos));
+            compiler_state->errors.push_back(e);
+        }
+
+        // 本体を後回しにした static 関数は、本体の位置を全体のトークン番号に直して引き継ぐ
+        const size_t offset = ranges[b * kDefinitionsPerBatch].first;
+        for (auto &deferred : worker.deferred_bodies)
+        {
+            Function *function = deferred.second;
+            function->body_begin += offset;
+            function->body_end += offset;
+            const size_t r = std::upper_bound(std::begin(ranges), std::end(ranges),
+                                              std::make_pair(function->body_begin, SIZE_MAX)) - std::begin(ranges) - 1;
+            function->body_decls = decls_before[r + 1];
+            compiler_state->deferred_bodies.insert(deferred);
+        }
+        outside.insert(std::end(outside), std::begin(worker.outside_references), std::end(worker.outside_references));
+
+        // バッチをまたいだ再定義 (と PCH の識別子の再定義) はここで見つける
+        worker.identifiers.ForEach(0, [&](SymbolID name, const IdentifierInfo &info) {
+            if (!defined.insert(name).second || compiler_state->FindPchID(name))
+            {
+                compiler_state->errors.push_back({compiler_state->module_name,
+                                                  static_cast<int>(compiler_state->lines.Line(info.pos)),
+                                                  "Function : " + GlobalSymbols().Name(name) + " is already defined",
+                                                  info.pos});
+                result = false;
+                return;
+            }
+
+            // 先に宣言しておいた識別子を構文解析した結果で置き換える
+            IdentifierInfo *declared = compiler_state->identifiers.LookupCurrent(name);
+            if (declared)
+            {
+                *declared = info;
+            }
+            else
+            {
+                compiler_state->identifiers.Declare(name, info);
+            }
+        });
+    }
+
+    if (result)
+    {
+        for (auto name : outside)
+        {
+            compiler_state->ReferenceFunction(name);
+        }
+        result = MakeReferencedBodies();
+    }
+
+    return CheckErrors(prog, result);
+}
+
+// エラーがあれば出力して nullptr を返す
+Program *Parser::CheckErrors(Program *prog, bool result)
+{
     if (!result || compiler_state->errors.size() > 0)
     {
         for (auto e : compiler_state->errors)
@@ -28,50 +148,321 @@ std::shared_ptr<Program> Parser::SyntaxCheck()
     return prog;
 }
 
-int Parser::GenerateAssembly(std::shared_ptr<Program> &node, std::string *assembly)
+// トップレベルの関数をファイルスコープに宣言しておく (ワーカーが前のバッチの関数を引けるように)
+// 定義の形 ([static] 型名 関数名 '(') をしていないものは飛ばす (構文解析でエラーになる)
+//   decls_before : (out) 各定義より前に宣言したファイルスコープの識別子の数 (末尾に宣言した数の合計)
+void Parser::DeclareTopLevel(const std::vector<std::pair<size_t, size_t>> &ranges, std::vector<size_t> &decls_before)
 {
-    *assembly = node->Assemble(compiler_state->asm_config);
+    const TokenStream &tokens = compiler_state->tokens;
+    decls_before.clear();
+    for (auto &range : ranges)
+    {
+        decls_before.push_back(compiler_state->identifiers.Count());
+
+        size_t i = range.first;
+        if (tokens.StoredType(i) == tkStatic)
+        {
+            ++i;
+        }
+        if (i + 2 >= range.second || tokens.StoredType(i + 1) != tkWord || tokens.StoredType(i + 2) != tkOpenParent)
+        {
+            continue;
+        }
+
+        const TypeID type = compiler_state->FindType(tokens.StoredToken(i).token);
+        if (type == kNoType)
+        {
+            continue;
+        }
+
+        IdentifierInfo info = {};
+        const Token name = tokens.StoredToken(i + 1);
+        info.name = name.symbol;
+        info.module_name = compiler_state->module_name;
+        info.scope = kNoSymbol;
+        info.id_type = kIdFunction;
+        info.type = type;
+        info.pos = name.pos;
+        compiler_state->identifiers.Declare(info.name, info);
+    }
+    decls_before.push_back(compiler_state->identifiers.Count());
+}
+
+// トップレベルの定義の境界 (トークン番号の範囲 [first, second)) を求める
+// 波括弧の対応と、波括弧の外の ';' だけを見る (定義の直後の ';' はその定義に含める).
+//   false : 波括弧が対応していない、または最後の定義が閉じていない
+bool Parser::ScanTopLevel(std::vector<std::pair<size_t, size_t>> &ranges)
+{
+    const TokenStream &tokens = compiler_state->tokens;
+    size_t depth = 0;
+    size_t begin = 0;
+    for (size_t i = 0; i < tokens.StoredSize(); ++i)
+    {
+        switch (tokens.StoredType(i))
+        {
+        case tkOpenBrace:
+            ++depth;
+            break;
+
+        case tkCloseBrace:
+            if (depth == 0)
+            {
+                return false;
+            }
+            if (--depth == 0)
+            {
+                ranges.push_back(std::make_pair(begin, i + 1));
+                begin = i + 1;
+            }
+            break;
+
+        case tkSemicolon:
+            if (depth == 0)
+            {
+                if (begin == i && !ranges.empty())
+                {
+                    ranges.back().second = i + 1;
+                }
+                else
+                {
+                    ranges.push_back(std::make_pair(begin, i + 1));
+                }
+                begin = i + 1;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+    return depth == 0 && begin == tokens.StoredSize();
+}
+
+// コード生成は平坦な AST に変換してから行う
+int Parser::GenerateAssembly(Program *node, std::string *assembly)
+{
+    FlatAST ast;
+    FlattenAST(node, &ast);
+    *assembly = FlatAssembler(ast, compiler_state->asm_config).Assemble();
     return 0;
 }
 
+// AST のノードの子 (null は除く)
+static void ChildNodes(const ASTNode *node, std::vector<const ASTNode *> *children)
+{
+    auto add_child = [&](const ASTNode *child) {
+        if (child)
+        {
+            children->push_back(child);
+        }
+    };
+
+    switch (node->node_type)
+    {
+    case kProgram:
+        for (auto d : static_cast<const Program *>(node)->decl)
+        {
+            // 参照されず本体を読まなかった static 関数
+            if (d->node_type == kFuncDefinition && static_cast<const Function *>(d)->body_pending)
+            {
+                continue;
+            }
+            add_child(d);
+        }
+        break;
+
+    case kFuncDefinition:
+        for (auto s : static_cast<const Function *>(node)->stmts)
+        {
+            add_child(s);
+        }
+        break;
+
+    case kReturnStmt:
+        add_child(static_cast<const ReturnStmt *>(node)->return_expr);
+        break;
+
+    case kExprStmt:
+        add_child(static_cast<const ExprStmt *>(node)->expr);
+        break;
+
+    case kAssignmentExpr:
+    {
+        auto a = static_cast<const AssignmentExpr *>(node);
+        add_child(a->destination ? static_cast<const ASTNode *>(a->destination) : a->target);
+        add_child(a->expr);
+        break;
+    }
+
+    case kBinaryExpr:
+    {
+        auto b = static_cast<const BinaryExpr *>(node);
+        add_child(b->first);
+        add_child(b->second);
+        break;
+    }
+
+    case kUnaryExpr:
+        add_child(static_cast<const UnaryExpr *>(node)->operand);
+        break;
+
+    case kConditionalExpr:
+    {
+        auto c = static_cast<const ConditionalExpr *>(node);
+        add_child(c->condition);
+        add_child(c->first);
+        add_child(c->second);
+        break;
+    }
+
+    case kPrimaryExpr:
+        add_child(static_cast<const PrimaryExpr *>(node)->literal);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// 平坦な AST のノードの value と size
+static void NodeValue(const ASTNode *node, FlatAST *ast, uint32_t *value, uint32_t *size)
+{
+    *value = 0;
+    *size = 0;
+    switch (node->node_type)
+    {
+    case kFuncDefinition:
+        *value = ast->AddString(static_cast<const Function *>(node)->function_name);
+        break;
+
+    case kVariableDecl:
+    {
+        auto v = static_cast<const VariableDecl *>(node);
+        *value = v->stack_rel_addr;
+        *size = GlobalTypes()[v->type].size;
+        break;
+    }
+
+    case kAssignmentExpr:
+        *value = static_cast<const AssignmentExpr *>(node)->op_type;
+        break;
+
+    case kBinaryExpr:
+        *value = static_cast<const BinaryExpr *>(node)->op_type;
+        break;
+
+    case kUnaryExpr:
+    {
+        auto u = static_cast<const UnaryExpr *>(node);
+        *value = u->op_type;
+        *size = GlobalTypes()[u->type_name].size;
+        break;
+    }
+
+    case kIntegerLiteral:
+    case kStringLiteral:
+        *value = ast->AddString(static_cast<const LiteralBase *>(node)->value);
+        break;
+
+    case kDeclRefExpr:
+    {
+        auto r = static_cast<const DeclRefExpr *>(node);
+        *value = r->decl->Address();
+        *size = r->decl->Size();
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// 子を先に追加する (後順)
+// 長い式は深い木になるので再帰せず、明示的なスタックで辿る
+NodeIndex FlattenAST(const ASTNode *node, FlatAST *ast)
+{
+    if (!node)
+    {
+        return kNoNode;
+    }
+
+    static const size_t kNotExpanded = static_cast<size_t>(-1);
+    struct Work
+    {
+        const ASTNode *node;
+        size_t base; // 子を展開済みなら、子の結果が始まる results の位置
+    };
+    std::vector<Work> work = {{node, kNotExpanded}};
+    std::vector<NodeIndex> results; // 追加済みで、親がまだ追加されていないノード
+    std::vector<const ASTNode *> children;
+
+    while (!work.empty())
+    {
+        Work &w = work.back();
+        if (w.base == kNotExpanded)
+        {
+            // 子を先に処理するため、左の子が先に取り出されるよう逆順に積む
+            w.base = results.size();
+            children.clear();
+            ChildNodes(w.node, &children);
+            for (auto it = children.rbegin(); it != children.rend(); ++it)
+            {
+                work.push_back({*it, kNotExpanded});
+            }
+            continue;
+        }
+
+        uint32_t value, size;
+        NodeValue(w.node, ast, &value, &size);
+        const NodeIndex i = ast->Add(w.node->node_type, value, size, results.data() + w.base, results.size() - w.base);
+        results.resize(w.base);
+        results.push_back(i);
+        work.pop_back();
+    }
+    return results.back();
+}
+
 void Parser::Init()
 {
-    compiler_state->type_store["char"] = {"char", false, 1};
-    compiler_state->type_store["int"] = {"int", false, 8};
-    compiler_state->type_store["long"] = {"long", false, 8};
-    compiler_state->type_store["float"] = {"float", false, 8};
-    compiler_state->type_store["double"] = {"double", false, 16};
+    static const struct
+    {
+        const char *name;
+        uint32_t size;
+    } basic_types[] = {{"char", 1}, {"int", 8}, {"long", 8}, {"float", 8}, {"double", 16}};
+
+    for (auto &t : basic_types)
+    {
+        SymbolID name = GlobalSymbols().Intern(t.name);
+        compiler_state->type_names[name] = GlobalTypes().Basic(name, t.size);
+    }
 }
 
-bool Parser::IsEqual(std::vector<kcc::Token>::iterator &it, char c)
+bool Parser::IsEqual(const kcc::Token &tok, char c)
 {
-    return (it->token.c_str()[0] == c) && (it->token.length() == 1);
+    return (tok.token.length() == 1) && (tok.token[0] == c);
 }
 
 
 bool Parser::IsDefinedType(const std::string &str)
 {
-    return compiler_state->type_store.find(str) != std::end(compiler_state->type_store);
+    return compiler_state->HasType(str);
 }
 
-bool Parser::IsDefinedID(const std::string &var)
+bool Parser::IsDefinedID(SymbolID var)
 {
-    DBG_IN(__FUNCTION__);
-    PDEBUG(compiler_state->identifier_store.ToString());
-    DBG_OUT(__FUNCTION__);
-    auto uid = compiler_state->scope + "::" + var;
-    PDEBUG(uid);
-    return compiler_state->identifier_store.find(uid) != std::end(compiler_state->identifier_store);
+    TRACE_IN(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
+    return compiler_state->IsDefinedID(var);
 }
 
 bool Parser::SkipSemicolon()
 {
 
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
 
-    if (IsEqual(compiler_state->iter, ';'))
+    if (IsEqual(GetToken(), ';'))
     {
-        compiler_state->iter++;
+        FwdCursor();
         return true;
     }
     return false;
@@ -79,12 +470,17 @@ bool Parser::SkipSemicolon()
 
 void Parser::SkipLF()
 {
-    while (compiler_state->iter != std::end(compiler_state->buf))
+    while (!compiler_state->tokens.IsEnd())
     {
-        if (IsEqual(compiler_state->iter, '\n'))
+        if (IsEqual(GetToken(), '\n'))
+        {
+            FwdCursor();
+        }
+        else if (GetTokenType() == tkStray)
         {
-            compiler_state->line_number++;
-            compiler_state->iter++;
+            // どのトークンにもならない文字はエラーにして読み飛ばす
+            compiler_state->AddCompileError("stray '" + GetToken().token + "' in program");
+            FwdCursor();
         }
         else
         {
@@ -95,14 +491,15 @@ void Parser::SkipLF()
 
 // -------------------------------------------------------------------------------
 // 型定義
-bool Parser::MakeTypeDefinition(std::shared_ptr<TypeInfo> &type)
+bool Parser::MakeTypeDefinition(TypeID &type)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     auto type_name = GetToken().token;
     ShowTokenInfo();
 
-    compiler_state->iter++;
-    if (compiler_state->type_store.find(type_name) == std::end(compiler_state->type_store))
+    FwdCursor();
+    type = compiler_state->FindType(type_name);
+    if (type == kNoType)
     {
         compiler_state->AddCompileError("Type name is not defined");
         return false;
@@ -110,17 +507,15 @@ bool Parser::MakeTypeDefinition(std::shared_ptr<TypeInfo> &type)
 
     SkipLF();
 
-    type = std::make_shared<TypeInfo>(compiler_state->type_store[type_name]);
-
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
     return true;
 }
 
 // 引数の宣言
-bool Parser::MakeArgumentDecl(std::shared_ptr<Argument> &argument)
+bool Parser::MakeArgumentDecl(Argument *&argument)
 {
-    DBG_IN(__FUNCTION__);
-    DBG_OUT(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
 
     return true;
 }
@@ -128,9 +523,9 @@ bool Parser::MakeArgumentDecl(std::shared_ptr<Argument> &argument)
 // 引数宣言のリスト
 bool Parser::MakeArgumentDeclList(ArgumentList &arguments)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
 
-    if (!IsEqual(compiler_state->iter, '('))
+    if (!IsEqual(GetToken(), '('))
     {
         compiler_state->AddCompileError("Unexpected syntax : " + GetToken().token);
         return false;
@@ -139,34 +534,36 @@ bool Parser::MakeArgumentDeclList(ArgumentList &arguments)
     FwdCursor();
     SkipLF();
 
-    while (!IsEqual(compiler_state->iter, ')'))
+    while (!IsEqual(GetToken(), ')'))
     {
-        std::shared_ptr<Argument> arg;
+        Argument *arg = nullptr;
         MakeArgumentDecl(arg);
         arguments.push_back(arg);
     }
 
     FwdCursor();
     SkipLF();
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
     return true;
 }
 
 // 関数宣言
 // arguments:
-//   id_info : (out) 識別子情報を格納する構造体への参照
+//   function_identifier : (out) 関数名
+//   id_info             : (out) 識別子情報を格納する構造体への参照
 //
-bool Parser::MakeFunctionIdentifier(IdentifierInfo &id_info)
+bool Parser::MakeFunctionIdentifier(std::string &function_identifier, IdentifierInfo &id_info)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
-    auto identifier = GetToken().token;
+    auto tok = GetToken();
+    std::string identifier = tok.token;
+    function_identifier = identifier;
 
-    auto uid = compiler_state->CurrentScope(true) + identifier;
-    compiler_state->iter++;
+    FwdCursor();
 
-    if (compiler_state->IsDefinedID(identifier))
+    if (compiler_state->IsDeclaredInScope(tok.symbol))
     {
         compiler_state->AddCompileError("Function : " + identifier + " is already defined");
         return false;
@@ -174,11 +571,12 @@ bool Parser::MakeFunctionIdentifier(IdentifierInfo &id_info)
 
     SkipLF();
 
-    id_info.name = identifier;
+    id_info.name = tok.symbol;
+    id_info.pos = tok.pos;
 
-    PDEBUG(uid);
-    compiler_state->RegistID(identifier);
-    DBG_OUT(__FUNCTION__);
+    TRACE_DEBUG(compiler_state->CurrentScope(true) + identifier);
+    compiler_state->RegistID(tok.symbol, tok.pos);
+    TRACE_OUT(__FUNCTION__);
 
     return true;
 }
@@ -186,15 +584,16 @@ bool Parser::MakeFunctionIdentifier(IdentifierInfo &id_info)
 // 変数名(識別子)
 bool Parser::MakeVariableIdentifier(std::string &var_name)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
-    auto identifier = GetToken().token;
+    auto tok = GetToken();
+    std::string identifier = tok.token;
 
-    auto uid = compiler_state->scope + "::" + identifier;
-    compiler_state->iter++;
+    FwdCursor();
 
-    if (IsDefinedID(uid))
+    // 外側のスコープの同名の識別子は隠すだけなので、現在のスコープだけを調べる
+    if (compiler_state->IsDeclaredInScope(tok.symbol))
     {
         compiler_state->AddCompileError("Identifier : " + identifier + " is already defined");
         return false;
@@ -204,82 +603,72 @@ bool Parser::MakeVariableIdentifier(std::string &var_name)
 
     var_name = identifier;
 
-    PDEBUG("univ name is : " + uid);
-    compiler_state->RegistID(identifier);
+    TRACE_DEBUG("univ name is : " + compiler_state->CurrentScope(true) + identifier);
+    compiler_state->RegistID(tok.symbol, tok.pos);
 
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
 
     return true;
 }
 
-bool Parser::MakeAssignmentExpr(std::shared_ptr<AssignmentExpr> &assign_expr)
+bool Parser::MakeAssignmentExpr(AssignmentExpr *&assign_expr)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
 
     SkipLF();
     ShowTokenInfo();
 
-    if (GetToken().type == tkOpenParent) {
-        assign_expr->expr = std::shared_ptr<PrimaryExpr>(new PrimaryExpr());
-        auto prim_expr = std::dynamic_pointer_cast<PrimaryExpr>(assign_expr->expr);
-        bool result = MakePrimaryExpr(prim_expr);
-
-        if (GetToken().type != tkCloseParent) {
-            compiler_state->AddCompileError("Unexpected token : " + GetToken().token);
-        }
-        FwdCursor();
-        return true;
-    }
-
-    if (GetToken().type == tkDecimal) {
-
-    }
+    // 初期化子は代入式まで (',' は次の変数との区切り)
+    bool result = MakeExpr(assign_expr->expr, kPrecAssign);
 
-    DBG_OUT(__FUNCTION__);
-    return true;
+    TRACE_OUT(__FUNCTION__);
+    return result;
 }
 
 // 変数 (+初期化)
-bool Parser::MakeInitDecl(const std::shared_ptr<TypeInfo> &type, std::string &var_name, std::shared_ptr<AssignmentExpr> &assign_expr)
+bool Parser::MakeInitDecl(TypeID type, std::string &var_name, AssignmentExpr *&assign_expr)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
     bool result = MakeVariableIdentifier(var_name);
     if (!result)
     {
         compiler_state->AddCompileError("Identifier : " + var_name + " is already defined");
+        return false;
     }
     SkipLF();
 
-    if (GetToken().type == tkSemicolon)
+    // 式から参照できるように識別子に型とアドレスを入れる
+    IdentifierInfo *info = compiler_state->identifiers.LookupCurrent(GlobalSymbols().Find(var_name));
+    info->type = type;
+    info->address = compiler_state->stack_rel_addr + GlobalTypes()[type].size;
+
+    if (GetTokenType() == tkSemicolon)
     {
         return true;
     }
 
     // 初期化式が付与されている場合は後に続く
-    if (GetToken().type != tkEqual)
+    if (GetTokenType() != tkEqual)
     {
         compiler_state->AddCompileError("Unexpected token :" + GetToken().token);
     }
 
-    SkipLF(); // skip "=" token
+    FwdCursor(); // skip "=" token
     SkipLF();
 
-    DeclInfo decl_info;
-    decl_info.identifier.name = var_name;
+    auto decl = compiler_state->nodes.New<DeclInfo>(type, *info);
+    assign_expr = NewNode<AssignmentExpr>(NewNode<DeclRefExpr>(decl));
 
-    assign_expr = std::shared_ptr<AssignmentExpr>(
-        new AssignmentExpr());
-
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
     return MakeAssignmentExpr(assign_expr);
 }
 
 // ローカル変数宣言
-bool Parser::MakeVariableDecl(std::vector<std::shared_ptr<VariableDecl>> &variables)
+bool Parser::MakeVariableDecl(std::vector<VariableDecl *> &variables)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
     /*
@@ -291,14 +680,14 @@ bool Parser::MakeVariableDecl(std::vector<std::shared_ptr<VariableDecl>> &variab
             int g = 0, h = 0;
     */
 
-    auto var_decl = std::shared_ptr<VariableDecl>(new VariableDecl(compiler_state->stack_rel_addr));
+    auto var_decl = NewNode<VariableDecl>(compiler_state->stack_rel_addr);
 
-    auto assign_expr = std::shared_ptr<AssignmentExpr>(new AssignmentExpr());
+    auto assign_expr = NewNode<AssignmentExpr>();
     bool ok = MakeTypeDefinition(var_decl->type) &&
                   MakeInitDecl(var_decl->type, var_decl->variable_name, assign_expr);
 
     // 次の変数のためにスタック相対アドレスを移動しておく
-    compiler_state->stack_rel_addr += var_decl->type->size;
+    compiler_state->stack_rel_addr += GlobalTypes()[var_decl->type].size;
 
     SkipLF();
 
@@ -315,7 +704,7 @@ bool Parser::MakeVariableDecl(std::vector<std::shared_ptr<VariableDecl>> &variab
         {
             SkipLF();
 
-            std::shared_ptr<VariableDecl> var_decl2(new VariableDecl(compiler_state->stack_rel_addr));
+            auto var_decl2 = NewNode<VariableDecl>(compiler_state->stack_rel_addr);
             var_decl2->type = var_decl->type;
 
             bool result2 = MakeInitDecl(var_decl->type, var_decl2->variable_name, assign_expr);
@@ -326,7 +715,7 @@ bool Parser::MakeVariableDecl(std::vector<std::shared_ptr<VariableDecl>> &variab
 
             variables.push_back(var_decl);
             // 次の変数のためにスタック相対アドレスを移動しておく
-            compiler_state->stack_rel_addr += var_decl2->type->size;
+            compiler_state->stack_rel_addr += GlobalTypes()[var_decl2->type].size;
         }
         else
         {
@@ -334,15 +723,15 @@ bool Parser::MakeVariableDecl(std::vector<std::shared_ptr<VariableDecl>> &variab
         }
     }
 
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
 
     return ok;
 }
 
 // return ステートメント
-bool Parser::MakeReturnStmt(std::shared_ptr<ReturnStmt> &return_stmt)
+bool Parser::MakeReturnStmt(ReturnStmt *&return_stmt)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
     if (GetToken().token != "return")
@@ -353,88 +742,56 @@ bool Parser::MakeReturnStmt(std::shared_ptr<ReturnStmt> &return_stmt)
     FwdCursor();
     SkipLF();
 
-    std::shared_ptr<PrimaryExpr> primary_expr;
-    bool result = MakePrimaryExpr(primary_expr);
+    ExprBase *expr = nullptr;
+    if (!MakeExpr(expr))
+    {
+        return false;
+    }
 
-    return_stmt = std::shared_ptr<ReturnStmt>(new ReturnStmt());
-    return_stmt->return_expr = std::static_pointer_cast<ExprBase>(primary_expr);
+    return_stmt = NewNode<ReturnStmt>(expr);
 
     SkipLF();
 
-    if (!IsEqual(compiler_state->iter, ';'))
+    if (!IsEqual(GetToken(), ';'))
     {
         compiler_state->AddCompileError("Unexpected syntax : " + GetToken().token);
         return false;
     }
 
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
 
     return true;
 }
 
-bool Parser::MakeExprStmt(std::shared_ptr<ExprStmt> &stmt)
+bool Parser::MakeExprStmt(ExprStmt *&stmt)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
-    stmt = std::shared_ptr<ExprStmt>(new ExprStmt(NodeType::kExprStmt));
-    if (GetToken().type == tkWord)
-    {
-        // function call returning void expr
-        // increment or decrement expr
-        // assignment expr
-
-        // left operand (or mono operand)
-        auto op_left = GetToken();
-        SkipLF();
-        FwdCursor();
-
-        // TODO: parse arrow operator (member of struct)
 
-        // assignment expr
-        if (GetToken().type == tkEqual)
-        {
-            PDEBUG(op_left.ToString());
-            if (!compiler_state->IsDefinedID(op_left.token))
-            {
-                compiler_state->AddCompileError("Undefined variable : " + op_left.token);
-                return false;
-            }
+    stmt = NewNode<ExprStmt>(NodeType::kExprStmt);
+    if (!MakeExpr(stmt->expr))
+    {
+        return false;
+    }
 
-            std::shared_ptr<AssignmentExpr> assign(new AssignmentExpr);
-
-            auto id = compiler_state->GetID(op_left.token);
-            auto type = compiler_state->type_store[id]
-
-            auto decl = std::shared_ptr<DeclInfo>(new DeclInfo(type, op_left.token));
-            assign->destination = std::shared_ptr<DeclRefExpr>(
-                new DeclRefExpr(
-                    decl
-                )
-            );
-            
-            stmt->expr = std::dynamic_pointer_cast<AssignmentExpr>(assign);
-            
-            MakeAssignmentExpr(assign);
-    ShowTokenInfo();
-    exit(0);
+    SkipLF();
 
-            SkipLF();
-            FwdCursor();
-        }
-        
+    if (!IsEqual(GetToken(), ';'))
+    {
+        compiler_state->AddCompileError("Unexpected syntax : " + GetToken().token);
+        return false;
     }
 
-    
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
     return true;
 }
 
 bool Parser::MakeCompoundStmt(CompoundStmt &compound_stmt)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
-    if (!IsEqual(compiler_state->iter, '{'))
+    if (!IsEqual(GetToken(), '{'))
     {
         // single expr
     }
@@ -450,7 +807,7 @@ bool Parser::MakeCompoundStmt(CompoundStmt &compound_stmt)
             ShowTokenInfo();
 
             // end of compound stmts
-            if (GetToken().type == tkCloseBrace)
+            if (GetTokenType() == tkCloseBrace)
             {
                 FwdCursor();
                 SkipLF();
@@ -463,7 +820,7 @@ bool Parser::MakeCompoundStmt(CompoundStmt &compound_stmt)
             }
 
             // local variable definition
-            std::vector<std::shared_ptr<VariableDecl>> variables;
+            std::vector<VariableDecl *> variables;
             MakeVariableDecl(variables) && SkipSemicolon();
             for (auto v : variables)
                 compound_stmt.push_back(v);
@@ -476,7 +833,7 @@ bool Parser::MakeCompoundStmt(CompoundStmt &compound_stmt)
             ShowTokenInfo();
 
             // end of compound stmts
-            if (GetToken().type == tkCloseBrace)
+            if (GetTokenType() == tkCloseBrace)
             {
                 FwdCursor();
                 SkipLF();
@@ -484,58 +841,72 @@ bool Parser::MakeCompoundStmt(CompoundStmt &compound_stmt)
             }
 
             // expression statement
-            if (GetToken().type == tkWord)
+            if (GetTokenType() != tkReturn)
             {
-                std::shared_ptr<ExprStmt> stmt;
-                MakeExprStmt(stmt);
+                ExprStmt *stmt = nullptr;
+                if (!MakeExprStmt(stmt))
+                {
+                    return false;
+                }
                 SkipSemicolon();
                 SkipLF();
                 compound_stmt.push_back(stmt);
-                break;
                 continue;
             }
 
             // return statement
-            if (GetToken().type == tkReturn)
+            if (GetTokenType() == tkReturn)
             {
-                std::shared_ptr<ReturnStmt> return_stmt;
-                MakeReturnStmt(return_stmt) && SkipSemicolon();
+                ReturnStmt *return_stmt = nullptr;
+                if (!MakeReturnStmt(return_stmt))
+                {
+                    return false;
+                }
+                SkipSemicolon();
                 compound_stmt.push_back(return_stmt);
                 SkipLF();
-                // if (IsEqual(compiler_state->iter, ',')) {
+                // if (IsEqual(GetToken(), ',')) {
                 //     FwdCursor();
                 //     SkipLF();
                 // } else {
-                //     compiler_state->errors.push_back({ compiler_state->module_name, compiler_state->line_number, "Unexpected syntax : " + GetToken().token });
+                //     compiler_state->AddCompileError("Unexpected syntax : " + GetToken().token);
                 //     return false;
                 // }
                 continue;
             }
 
-            // IF_N_RUN(3, { PDEBUG("fuga"); throw_ln("THROW!!");});
+            // IF_N_RUN(3, { TRACE_DEBUG("fuga"); throw_ln("THROW!!");});
         };
     }
 
     SkipLF();
 
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
 
     return true;
 }
 
-bool Parser::MakeFunctionDefinition(std::shared_ptr<Function> &function)
+bool Parser::MakeFunctionDefinition(Function *&function)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
-    function = std::shared_ptr<Function>(new Function());
+    function = NewNode<Function>();
+
+    // ローカル変数のアドレスは関数ごとに振る
+    compiler_state->stack_rel_addr = 0;
 
-    DeclInfo 
     IdentifierInfo id_func;
     id_func.module_name = compiler_state->module_name;
-    id_func.scope = compiler_state->CurrentScope();
+    id_func.scope = compiler_state->CurrentScopeLabel();
     id_func.id_type = kIdFunction;
 
+    if (GetTokenType() == tkStatic)
+    {
+        function->is_static = true;
+        FwdCursor();
+    }
+
     bool result = MakeTypeDefinition(function->type) &&
                   MakeFunctionIdentifier(function->function_name, id_func) &&
                   MakeArgumentDeclList(function->arguments);
@@ -544,137 +915,661 @@ bool Parser::MakeFunctionDefinition(std::shared_ptr<Function> &function)
         return false;
     }
 
-    auto uid = compiler_state->CurrentScope() + function->function_name;
+    // MakeFunctionIdentifier で登録した識別子に関数の情報を入れる (型は戻り値の型)
+    id_func.type = function->type;
+    id_func.address = 0;
+    *compiler_state->identifiers.LookupCurrent(id_func.name) = id_func;
 
-    compiler_state->identifier_store[uid] = id_func;
+    // static 関数の本体は参照されるまで読まない
+    if (function->is_static && SkipFunctionBody(function))
+    {
+        compiler_state->deferred_bodies[id_func.name] = function;
+        TRACE_OUT(__FUNCTION__);
+        return true;
+    }
 
-    compiler_state->PushScope(function->function_name);
+    compiler_state->PushScope(id_func.name);
 
     result &= MakeCompoundStmt(function->stmts);
 
-    DBG_OUT(__FUNCTION__);
+    compiler_state->PopScope();
+
+    TRACE_OUT(__FUNCTION__);
 
     return result;
 }
 
-bool Parser::MakePrimaryExpr(std::shared_ptr<PrimaryExpr>& primary_expr)
+// 関数本体を読み飛ばして、トークン範囲を記録する (波括弧の対応だけを見る)
+//   false : 字句解析済みのトークン列ではない、または本体が閉じていない (本体はその場で読む)
+bool Parser::SkipFunctionBody(Function *function)
 {
-    DBG_IN(__FUNCTION__);
-    ShowTokenInfo();
+    TokenStream &tokens = compiler_state->tokens;
+    if (!tokens.IsStored() || tokens.PeekType() != tkOpenBrace)
+    {
+        return false;
+    }
 
-    std::shared_ptr<Node> expr(new Node);
-    if (GetToken().type == tkWord) {
-        if (compiler_state->IsDefinedID(compiler_state->scope + "::" + GetToken().token))
+    const size_t begin = static_cast<size_t>(tokens.Position());
+    size_t depth = 0;
+    for (size_t i = begin; i < tokens.StoredSize(); ++i)
+    {
+        const TokenType type = tokens.StoredType(i);
+        if (type == tkOpenBrace)
         {
+            ++depth;
         }
+        else if (type == tkCloseBrace && --depth == 0)
+        {
+            function->body_pending = true;
+            function->body_begin = begin;
+            function->body_end = i + 1;
+            function->body_decls = compiler_state->identifiers.Count();
+            tokens.Seek(i + 1);
+            SkipLF();
+            return true;
+        }
+    }
+    return false;
+}
+
+// 参照された static 関数の本体を読む (読んだ本体から参照された関数も続けて読む)
+bool Parser::MakeReferencedBodies()
+{
+    TRACE_IN(__FUNCTION__);
+
+    std::vector<Function *> &referenced = compiler_state->referenced_bodies;
+    if (referenced.empty())
+    {
+        TRACE_OUT(__FUNCTION__);
+        return true;
     }
-    else if (GetToken().type == tkDoubleQuote)
+
+    TokenStream &tokens = compiler_state->tokens;
+    const size_t resume = static_cast<size_t>(tokens.Position());
+
+    bool result = true;
+    for (size_t i = 0; result && i < referenced.size(); ++i)
     {
-        // string literal
-        FwdCursor();
+        Function *function = referenced[i];
+        tokens.Seek(function->body_begin);
+
+        compiler_state->stack_rel_addr = 0;
+        compiler_state->visible_decls = function->body_decls;
+        compiler_state->PushScope(GlobalSymbols().Find(function->function_name));
+        result = MakeCompoundStmt(function->stmts);
+        compiler_state->PopScope();
+        function->body_pending = false;
+    }
+    compiler_state->visible_decls = SIZE_MAX;
+    referenced.clear();
+    tokens.Seek(resume);
 
-        primary_expr = std::shared_ptr<PrimaryExpr>(new PrimaryExpr());
+    TRACE_OUT(__FUNCTION__);
+    return result;
+}
 
-        std::shared_ptr<StringLiteral> string_literal;
-        bool result = MakeStringLiteral(string_literal);
-        if (result)
+// -------------------------------------------------------------------------------
+// 式 (演算子順位法)
+// 演算子と被演算子をそれぞれ明示的なスタックに積み、1 つのループで式全体を読む.
+// 優先順位ごとの再帰もトークンの後戻りもしないので、演算子の多い長い式も線形時間で読める.
+// 括弧や右結合の演算子が深く入れ子になっても伸びるのはスタック (std::vector) だけ.
+
+// 演算子スタックの要素
+struct PendingOperator
+{
+    enum Kind
+    {
+        kBinary,
+        kAssignment,
+        kPrefix,
+        kParen,    // (
+        kQuestion, // ?  (':' を待っている)
+        kColon,    // ?: の ':' (3 つ目の被演算子を待っている)
+    };
+
+    Kind kind;
+    int prec;
+    OperatorType op;
+    TypeID type; // キャスト・sizeof の型名
+};
+
+// 二項演算子・代入演算子
+//   false : トークンが二項演算子ではない
+static bool BinaryOperator(TokenType type, PendingOperator *op)
+{
+    static const struct
+    {
+        TokenType token;
+        PendingOperator::Kind kind;
+        int prec;
+        OperatorType op;
+    } operators[] = {
+        {tkAsterisk, PendingOperator::kBinary, kPrecMultiplicative, kMul},
+        {tkSlash, PendingOperator::kBinary, kPrecMultiplicative, kDiv},
+        {tkPercent, PendingOperator::kBinary, kPrecMultiplicative, kMod},
+        {tkPlus, PendingOperator::kBinary, kPrecAdditive, kPlus},
+        {tkMinus, PendingOperator::kBinary, kPrecAdditive, kMinus},
+        {tkShiftLeft, PendingOperator::kBinary, kPrecShift, kShiftLeft},
+        {tkShiftRight, PendingOperator::kBinary, kPrecShift, kShiftRight},
+        {tkLess, PendingOperator::kBinary, kPrecRelational, kLess},
+        {tkGreater, PendingOperator::kBinary, kPrecRelational, kGreater},
+        {tkLessEqual, PendingOperator::kBinary, kPrecRelational, kLessEqual},
+        {tkGreaterEqual, PendingOperator::kBinary, kPrecRelational, kGreaterEqual},
+        {tkEqualEqual, PendingOperator::kBinary, kPrecEquality, kEqual},
+        {tkNotEqual, PendingOperator::kBinary, kPrecEquality, kNotEqual},
+        {tkAmpersand, PendingOperator::kBinary, kPrecBitAnd, kBitAnd},
+        {tkCaret, PendingOperator::kBinary, kPrecBitXor, kBitXor},
+        {tkBar, PendingOperator::kBinary, kPrecBitOr, kBitOr},
+        {tkLogicalAnd, PendingOperator::kBinary, kPrecLogicalAnd, kLogicalAnd},
+        {tkLogicalOr, PendingOperator::kBinary, kPrecLogicalOr, kLogicalOr},
+        {tkComma, PendingOperator::kBinary, kPrecComma, kComma},
+        {tkEqual, PendingOperator::kAssignment, kPrecAssign, kAssign},
+        {tkAddAssign, PendingOperator::kAssignment, kPrecAssign, kPlus},
+        {tkSubAssign, PendingOperator::kAssignment, kPrecAssign, kMinus},
+        {tkMulAssign, PendingOperator::kAssignment, kPrecAssign, kMul},
+        {tkDivAssign, PendingOperator::kAssignment, kPrecAssign, kDiv},
+        {tkModAssign, PendingOperator::kAssignment, kPrecAssign, kMod},
+        {tkAndAssign, PendingOperator::kAssignment, kPrecAssign, kBitAnd},
+        {tkOrAssign, PendingOperator::kAssignment, kPrecAssign, kBitOr},
+        {tkXorAssign, PendingOperator::kAssignment, kPrecAssign, kBitXor},
+        {tkShiftLeftAssign, PendingOperator::kAssignment, kPrecAssign, kShiftLeft},
+        {tkShiftRightAssign, PendingOperator::kAssignment, kPrecAssign, kShiftRight},
+    };
+
+    for (auto &o : operators)
+    {
+        if (o.token == type)
         {
-            auto temp = std::dynamic_pointer_cast<LiteralBase>(string_literal);
-            primary_expr = std::shared_ptr<PrimaryExpr>(
-                new PrimaryExpr(temp));
-            DBG_OUT(__FUNCTION__);
+            *op = {o.kind, o.prec, o.op, kNoType};
             return true;
         }
     }
-    else if (GetToken().type == tkDecimal)
+    return false;
+}
+
+// 前置の単項演算子
+//   false : トークンが前置の単項演算子ではない
+static bool PrefixOperator(TokenType type, OperatorType *op)
+{
+    switch (type)
     {
-        // number literal
-        bool is_numeric;
-        try
+    case tkPlus:
+        *op = kUnaryPlus;
+        return true;
+    case tkMinus:
+        *op = kNegate;
+        return true;
+    case tkNot:
+        *op = kLogicalNot;
+        return true;
+    case tkTilde:
+        *op = kBitNot;
+        return true;
+    case tkAsterisk:
+        *op = kDeref;
+        return true;
+    case tkAmpersand:
+        *op = kAddressOf;
+        return true;
+    case tkIncrement:
+        *op = kPreIncrement;
+        return true;
+    case tkDecrement:
+        *op = kPreDecrement;
+        return true;
+    case tkSizeof:
+        *op = kSizeof;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 代入・インクリメントの対象にできる式 (変数と '*' による参照)
+static bool IsLvalue(const ExprBase *expr)
+{
+    if (expr->node_type == kPrimaryExpr)
+    {
+        auto literal = static_cast<const PrimaryExpr *>(expr)->literal;
+        return literal && literal->node_type == kDeclRefExpr;
+    }
+    return expr->node_type == kUnaryExpr && static_cast<const UnaryExpr *>(expr)->op_type == kDeref;
+}
+
+// 式
+// arguments:
+//   expr   : (out) 式の木
+//   lowest : 括弧の外でこれより弱い演算子が現れたら、その手前で式を終える
+//            (kPrecComma : 式, kPrecAssign : 代入式 (初期化子など))
+bool Parser::MakeExpr(ExprBase *&expr, int lowest)
+{
+    TRACE_IN(__FUNCTION__);
+    ShowTokenInfo();
+
+    std::vector<PendingOperator> ops;
+    std::vector<ExprBase *> operands;
+    size_t open = 0;             // 閉じていない '(' と '?' の数
+    bool operand_expected = true; // 次は被演算子 (前置の演算子を含む) か
+
+    // 演算子スタックの先頭の演算子を被演算子に適用する
+    auto reduce = [&]() -> bool {
+        const PendingOperator top = ops.back();
+        ops.pop_back();
+
+        ExprBase *second = operands.back();
+        operands.pop_back();
+        switch (top.kind)
+        {
+        case PendingOperator::kPrefix:
+        {
+            if ((top.op == kPreIncrement || top.op == kPreDecrement) && !IsLvalue(second))
+            {
+                compiler_state->AddCompileError("lvalue required as increment operand");
+                return false;
+            }
+            auto unary = NewNode<UnaryExpr>(top.op, second);
+            unary->type_name = top.type;
+            operands.push_back(unary);
+            return true;
+        }
+
+        case PendingOperator::kBinary:
+        {
+            ExprBase *first = operands.back();
+            operands.back() = NewNode<BinaryExpr>(first, second, top.op);
+            return true;
+        }
+
+        case PendingOperator::kAssignment:
+        {
+            ExprBase *target = operands.back();
+            if (!IsLvalue(target))
+            {
+                compiler_state->AddCompileError("lvalue required as left operand of assignment");
+                return false;
+            }
+            auto assign = NewNode<AssignmentExpr>();
+            assign->target = target;
+            if (target->node_type == kPrimaryExpr)
+            {
+                assign->destination = static_cast<DeclRefExpr *>(static_cast<PrimaryExpr *>(target)->literal);
+            }
+            assign->expr = second;
+            assign->op_type = top.op;
+            operands.back() = assign;
+            return true;
+        }
+
+        case PendingOperator::kColon:
+        {
+            ExprBase *first = operands.back();
+            operands.pop_back();
+            ExprBase *condition = operands.back();
+            operands.back() = NewNode<ConditionalExpr>(condition, first, second);
+            return true;
+        }
+
+        default:
+            compiler_state->AddCompileError((top.kind == PendingOperator::kParen) ? "')' is expected"
+                                                                                   : "':' is expected");
+            return false;
+        }
+    };
+
+    while (!compiler_state->tokens.IsEnd())
+    {
+        const TokenType type = GetTokenType();
+
+        if (operand_expected)
+        {
+            PendingOperator op = {PendingOperator::kPrefix, kPrecUnary, kUnaryPlus, kNoType};
+            if (PrefixOperator(type, &op.op))
+            {
+                FwdCursor();
+                ops.push_back(op);
+                continue;
+            }
+
+            if (type == tkOpenParent)
+            {
+                FwdCursor();
+                if (!MakeTypeName(op.type))
+                {
+                    return false;
+                }
+
+                // 括弧で囲んだ式
+                if (op.type == kNoType)
+                {
+                    ops.push_back({PendingOperator::kParen, kPrecMarker, kUnaryPlus, kNoType});
+                    ++open;
+                    continue;
+                }
+
+                if (GetTokenType() != tkCloseParent)
+                {
+                    compiler_state->AddCompileError("')' is expected");
+                    return false;
+                }
+                FwdCursor();
+
+                // sizeof(型名)
+                if (!ops.empty() && ops.back().kind == PendingOperator::kPrefix && ops.back().op == kSizeof)
+                {
+                    ops.pop_back();
+                    auto unary = NewNode<UnaryExpr>(kSizeof, nullptr);
+                    unary->type_name = op.type;
+                    operands.push_back(unary);
+                    operand_expected = false;
+                    continue;
+                }
+
+                // (型名) 式
+                op.op = kCast;
+                ops.push_back(op);
+                continue;
+            }
+
+            PrimaryExpr *primary_expr = nullptr;
+            if (!MakePrimaryExpr(primary_expr))
+            {
+                return false;
+            }
+            operands.push_back(primary_expr);
+            operand_expected = false;
+            continue;
+        }
+
+        // 後置の ++, -- は直前の被演算子にすぐ適用する (前置の演算子より強い)
+        if (type == tkIncrement || type == tkDecrement)
+        {
+            if (!IsLvalue(operands.back()))
+            {
+                compiler_state->AddCompileError("lvalue required as increment operand");
+                return false;
+            }
+            operands.back() = NewNode<UnaryExpr>((type == tkIncrement) ? kPostIncrement : kPostDecrement,
+                                                 operands.back());
+            FwdCursor();
+            continue;
+        }
+
+        if (type == tkCloseParent)
+        {
+            // 式の外の ')' (関数の引数リストの終わりなど)
+            if (open == 0)
+            {
+                break;
+            }
+
+            while (ops.back().kind != PendingOperator::kParen)
+            {
+                if (!reduce())
+                {
+                    return false;
+                }
+            }
+            ops.pop_back();
+            --open;
+            FwdCursor();
+            continue;
+        }
+
+        if (type == tkColon)
         {
-            std::stoi(GetToken().token);
-            is_numeric = true;
+            // 対応する '?' がなければ式の外の ':' (ラベルなど)
+            if (open == 0)
+            {
+                break;
+            }
+
+            while (ops.back().kind != PendingOperator::kQuestion)
+            {
+                if (!reduce())
+                {
+                    return false;
+                }
+            }
+            ops.back().kind = PendingOperator::kColon;
+            ops.back().prec = kPrecConditional;
+            --open;
+            FwdCursor();
+            operand_expected = true;
+            continue;
         }
-        catch (const std::invalid_argument &e)
+
+        PendingOperator op = {PendingOperator::kQuestion, kPrecConditional, kUnaryPlus, kNoType};
+        if (type != tkQuestion && !BinaryOperator(type, &op))
         {
-            is_numeric = false;
+            break;
         }
-        catch (const std::out_of_range &e)
+
+        // 括弧の外の弱い演算子は式の外 (初期化子の後の ',' など)
+        if (open == 0 && op.prec < lowest)
         {
-            is_numeric = false;
+            break;
         }
 
-        if (is_numeric)
+        // 左結合なら同じ優先順位まで、右結合 (代入・条件) ならより強いものだけを先に適用する
+        const bool right_assoc = (op.prec == kPrecAssign || op.prec == kPrecConditional);
+        while (!ops.empty() && (ops.back().prec > op.prec || (!right_assoc && ops.back().prec == op.prec)))
         {
-            std::shared_ptr<IntegerLiteral> integer_literal;
-            bool result = MakeIntegerLiteral(integer_literal);
-            if (result)
+            if (!reduce())
             {
-                auto temp = std::dynamic_pointer_cast<LiteralBase>(integer_literal);
-                primary_expr = std::shared_ptr<PrimaryExpr>(new PrimaryExpr(temp));
-                DBG_OUT(__FUNCTION__);
-                return true;
+                return false;
             }
         }
+
+        if (op.kind == PendingOperator::kQuestion)
+        {
+            op.prec = kPrecMarker;
+            ++open;
+        }
+        ops.push_back(op);
+        FwdCursor();
+        operand_expected = true;
+    }
+
+    if (operand_expected)
+    {
+        compiler_state->AddCompileError(compiler_state->tokens.IsEnd() ? "Expression is expected"
+                                                                        : "Unexpected expr : " + GetToken().token);
+        return false;
+    }
+
+    while (!ops.empty())
+    {
+        if (!reduce())
+        {
+            return false;
+        }
+    }
+
+    expr = operands.back();
+
+    TRACE_OUT(__FUNCTION__);
+    return true;
+}
+
+// 型名 (キャスト・sizeof の括弧の中)
+// 型名でなければトークンを読まずに type を kNoType にする
+//   false : 構文エラー
+bool Parser::MakeTypeName(TypeID &type)
+{
+    type = kNoType;
+    switch (GetTokenType())
+    {
+    case tkStruct:
+        if (GetTokenType(1) != tkWord)
+        {
+            compiler_state->AddCompileError("Unexpected syntax : struct");
+            return false;
+        }
+        type = compiler_state->FindType(GetToken(1).token);
+        if (type == kNoType)
+        {
+            compiler_state->AddCompileError("Type name is not defined : struct " + GetToken(1).token);
+            return false;
+        }
+        FwdCursor(2);
+        break;
+
+    case tkWord:
+    case tkChar:
+    case tkShort:
+    case tkInt:
+    case tkLong:
+    case tkFloat:
+    case tkDouble:
+    case tkSigned:
+    case tkUnsigned:
+    case tkVoid:
+        type = compiler_state->FindType(GetToken().token);
+        if (type == kNoType)
+        {
+            return true;
+        }
+        FwdCursor();
+        break;
+
+    default:
+        return true;
+    }
+
+    while (GetTokenType() == tkAsterisk)
+    {
+        type = GlobalTypes().PointerTo(type);
+        FwdCursor();
+    }
+    return true;
+}
+
+bool Parser::MakePrimaryExpr(PrimaryExpr *&primary_expr)
+{
+    TRACE_IN(__FUNCTION__);
+    ShowTokenInfo();
+
+    if (GetTokenType() == tkWord)
+    {
+        // variable reference
+        const IdentifierInfo *info = compiler_state->FindID(GetToken().symbol);
+        if (!info)
+        {
+            compiler_state->AddCompileError("Undefined variable : " + GetToken().token);
+            return false;
+        }
+        if (info->id_type == kIdFunction)
+        {
+            compiler_state->ReferenceFunction(info->name);
+        }
+
+        auto decl = compiler_state->nodes.New<DeclInfo>(info->type, *info);
+        primary_expr = NewNode<PrimaryExpr>(NewNode<DeclRefExpr>(decl));
+        FwdCursor();
+        TRACE_OUT(__FUNCTION__);
+        return true;
+    }
+    else if (GetTokenType() == tkString)
+    {
+        // string literal (decoded and pooled by the tokenizer)
+        StringLiteral *string_literal = nullptr;
+        bool result = MakeStringLiteral(string_literal);
+        if (result)
+        {
+            primary_expr = NewNode<PrimaryExpr>(string_literal);
+            TRACE_OUT(__FUNCTION__);
+            return true;
+        }
+        return false;
+    }
+    else if (GetTokenType() == tkDecimal || GetTokenType() == tkHexDecimal || GetTokenType() == tkCharacter)
+    {
+        // number / character literal (decoded by the tokenizer)
+        IntegerLiteral *integer_literal = nullptr;
+        bool result = MakeIntegerLiteral(integer_literal);
+        if (result)
+        {
+            primary_expr = NewNode<PrimaryExpr>(integer_literal);
+            TRACE_OUT(__FUNCTION__);
+            return true;
+        }
+        return false;
     }
 
     // error
+    if (GetTokenType() == tkStray)
+    {
+        compiler_state->AddCompileError("stray '" + GetToken().token + "' in program");
+        return false;
+    }
     compiler_state->AddCompileError("Unexpected expr : " + GetToken().token);
     return false;
 }
 
-bool Parser::MakeStringLiteral(std::shared_ptr<StringLiteral> &string_literal)
+bool Parser::MakeStringLiteral(StringLiteral *&string_literal)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
-    std::string strings = GetToken().token;
-    FwdCursor();
-
-    if (!(GetToken().token).compare("\""))
+    auto tok = GetToken();
+    const std::string spelling = tok.token;
+    if (tok.number_flags & nfUnterminated)
+    {
+        compiler_state->AddCompileError("The end of '\"' is not found : " + spelling);
+        FwdCursor();
+        return false;
+    }
+    if (tok.number_flags & nfInvalid)
     {
-        compiler_state->AddCompileError("The end of '\"' is not found : " + GetToken().token);
+        compiler_state->AddCompileError("invalid escape sequence: " + spelling);
         FwdCursor();
         return false;
     }
 
-    string_literal = std::shared_ptr<StringLiteral>(new StringLiteral(strings));
+    // アセンブラにはエスケープを含んだ綴りのまま渡す
+    string_literal = NewNode<StringLiteral>(spelling.substr(1, spelling.size() - 2),
+                                            static_cast<LiteralID>(tok.value.integer));
 
     FwdCursor();
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
     return true;
 }
 
-bool Parser::MakeIntegerLiteral(std::shared_ptr<IntegerLiteral> &integer_literal)
+bool Parser::MakeIntegerLiteral(IntegerLiteral *&integer_literal)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
-    try
+    auto tok = GetToken();
+    if (tok.number_flags & nfUnterminated)
     {
-        std::stoi(GetToken().token);
+        compiler_state->AddCompileError("The end of '\\'' is not found : " + tok.token);
+        return false;
     }
-    catch (const std::invalid_argument &e)
+    if (tok.number_flags & nfInvalid)
     {
-        compiler_state->AddCompileError("invalid argument: " + GetToken().token);
+        compiler_state->AddCompileError("invalid argument: " + tok.token);
         return false;
     }
-    catch (const std::out_of_range &e)
+    if (tok.number_flags & nfOverflow)
     {
-        compiler_state->AddCompileError("out of range: " + GetToken().token);
+        compiler_state->AddCompileError("out of range: " + tok.token);
         return false;
     }
 
-    integer_literal = std::shared_ptr<IntegerLiteral>(new IntegerLiteral(GetToken().token));
+    // 文字定数は int (符号付き)
+    std::string value = (tok.type == tkCharacter) ? std::to_string(static_cast<int64_t>(tok.value.integer))
+                                                  : std::to_string(tok.value.integer);
+    integer_literal = NewNode<IntegerLiteral>(value);
 
     FwdCursor();
-    DBG_OUT(__FUNCTION__);
+    TRACE_OUT(__FUNCTION__);
     return true;
 }
 
-bool Parser::MakeProgram(std::shared_ptr<Program> &program)
+bool Parser::MakeProgram(Program *&program)
 {
-    DBG_IN(__FUNCTION__);
+    TRACE_IN(__FUNCTION__);
     ShowTokenInfo();
 
     if (program)
@@ -682,21 +1577,25 @@ bool Parser::MakeProgram(std::shared_ptr<Program> &program)
         return false;
     }
 
-    compiler_state->scope = compiler_state->module_name;
-
-    program = std::shared_ptr<Program>(new Program());
+    program = NewNode<Program>();
 
-    std::shared_ptr<Function> function;
-
-    bool result = MakeFunctionDefinition(function);
-    if (result)
+    while (!compiler_state->tokens.IsEnd())
     {
+        Function *function = nullptr;
+        if (!MakeFunctionDefinition(function))
+        {
+            return false;
+        }
         program->decl.push_back(function);
-        return true;
     }
 
-    DBG_OUT(__FUNCTION__);
-    return false;
+    if (!MakeReferencedBodies())
+    {
+        return false;
+    }
+
+    TRACE_OUT(__FUNCTION__);
+    return true;
 }
 
 } // namespace kcc
\ No newline at end of file
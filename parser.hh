@@ -2,57 +2,34 @@
 #define __AST_HPP__
 
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "util.hh"
+#include "arena.hh"
 #include "assembler.hh"
+#include "flat_ast.hh"
+#include "line_table.hh"
+#include "literal.hh"
+#include "pch.hh"
+#include "scope.hh"
+#include "symbol.hh"
+#include "thread_pool.hh"
+#include "token_stream.hh"
 #include "tokenizer.hh"
+#include "type_table.hh"
 
 namespace kcc
 {
 
-enum NodeType
-{
-    kProgram,
-    kDecl,
-    kObjectType,
-
-    kIntegerLiteral,
-    kStringLiteral,
-    kDeclRefExpr,
-
-    kVariableDecl,
-
-    kFuncDefinition,
-    kFuncStorageClassSpecifier, // auto, register, static, extern, typedef,
-                                // __decpspec(ms-specific)
-    kFuncIdentifier,
-    kFuncCompoundStmt,
-    kFuncParamList,
-    kFuncParam,
-    kReturnStmt,
-
-    kExprStmt,
-    kPrimaryExpr,
-    kBinaryExpr,
-    kAssignmentExpr,
-
-    kNull
-};
-
-enum OperatorType
-{
-    kPlus,  // +
-    kMinus, // -
-    kMul,   // *
-    kDiv,   // /
-};
-
 enum IdentifierType
 {
     kIdVariable,
@@ -82,39 +59,33 @@ struct CompileErrorInfo
     std::string module_name;
     int line_number;
     std::string message;
-};
-
-// 型情報
-struct TypeInfo
-{
-    std::string type_name;
-    bool is_pointer;
-    unsigned int size; // バイト数
-    std::map<std::string, std::shared_ptr<TypeInfo>> member;
+    uint32_t pos; // 先頭からのバイト位置
 };
 
 // 識別子情報
 struct IdentifierInfo
 {
-    std::string name;
+    SymbolID name;
     std::string module_name;
-    std::string scope;
+    SymbolID scope; // 宣言したスコープの名前 (ファイルスコープは kNoSymbol)
     IdentifierType id_type;
-    unsigned int address;
+    unsigned int address; // 変数は rbp からの相対アドレス
+    TypeID type;          // 変数の型
+    uint32_t pos;         // 宣言した識別子の先頭からのバイト位置
 };
 
 struct DeclInfo
 {
-    TypeInfo type;
+    TypeID type = kNoType;
     IdentifierInfo identifier;
 
     DeclInfo() {}
-    DeclInfo(const TypeInfo &type, const IdentifierInfo &identifier)
+    DeclInfo(TypeID type, const IdentifierInfo &identifier)
         : type(type), identifier(identifier) {}
 
     std::string Name() noexcept
     {
-        return identifier.name;
+        return GlobalSymbols().Name(identifier.name);
     }
 
     std::string Module() noexcept
@@ -124,7 +95,7 @@ struct DeclInfo
 
     std::string Scope() noexcept
     {
-        return identifier.scope;
+        return GlobalSymbols().Name(identifier.scope);
     }
 
     unsigned int Address() noexcept
@@ -134,16 +105,18 @@ struct DeclInfo
 
     std::string TypeName() noexcept
     {
-        return type.type_name;
+        return GlobalTypes().Name(type);
     }
 
     unsigned int Size() noexcept
     {
-        return type.size;
+        return GlobalTypes()[type].size;
     }
 };
 
 // AST のノードとなるベースクラス
+// ノードは翻訳単位ごとのアリーナ (CompilerState::nodes) に置き、ノード間は生ポインタで参照する.
+// コード生成が終わった後、アリーナごとまとめて解放する.
 struct ASTNode
 {
     ASTNode() {}
@@ -174,15 +147,17 @@ struct IntegerLiteral : public LiteralBase
 // 文字列リテラル
 struct StringLiteral : public LiteralBase
 {
-    StringLiteral(std::string value) : LiteralBase(kStringLiteral, value) {}
+    StringLiteral(std::string value, LiteralID id) : LiteralBase(kStringLiteral, value), id(id) {}
     virtual std::string Assemble(AssemblyConfig &conf) { return "\"" + value + "\""; }
     virtual void Stdout() {}
+
+    LiteralID id; // リテラルプールの ID (GlobalLiterals)
 };
 
 // 変数参照
 struct DeclRefExpr : public LiteralBase
 {
-    DeclRefExpr(std::shared_ptr<DeclInfo> &decl) : LiteralBase(kDeclRefExpr, ""), decl(decl) {}
+    DeclRefExpr(DeclInfo *decl) : LiteralBase(kDeclRefExpr, ""), decl(decl) {}
     virtual std::string Assemble(AssemblyConfig &conf)
     {
         std::string type;
@@ -205,7 +180,7 @@ struct DeclRefExpr : public LiteralBase
         return type + "[rbp-" + std::to_string(decl->Address()) + "]";
     }
 
-    std::shared_ptr<DeclInfo> decl;
+    DeclInfo *decl;
 };
 
 // ------------------------------------------------
@@ -215,15 +190,15 @@ struct ExprBase : public ASTNode
     virtual std::string Assemble(AssemblyConfig &conf) { return "ExprBase"; }
     virtual void Stdout() {}
     // child expr
-    std::shared_ptr<ExprBase> expr;
-    TypeInfo type_of_expr;
+    ExprBase *expr = nullptr;
+    TypeID type_of_expr = kNoType;
 };
 
 // 代入式(右辺値)
 struct AssignmentExpr : public ExprBase
 {
     AssignmentExpr() : ExprBase(kAssignmentExpr) {}
-    AssignmentExpr(std::shared_ptr<DeclRefExpr> destination) : ExprBase(kAssignmentExpr), destination(destination) {}
+    AssignmentExpr(DeclRefExpr *destination) : ExprBase(kAssignmentExpr), destination(destination) {}
 
     virtual std::string Assemble(AssemblyConfig &conf)
     {
@@ -239,16 +214,18 @@ struct AssignmentExpr : public ExprBase
 
     virtual void Stdout() {}
 
-    std::shared_ptr<DeclRefExpr> destination; // output
-    std::shared_ptr<ExprBase> expr;
+    DeclRefExpr *destination = nullptr; // output
+    ExprBase *target = nullptr;         // 代入先の式 (変数への代入では destination の一次式)
+    ExprBase *expr = nullptr;
+    OperatorType op_type = kAssign;     // 複合代入は対応する二項演算子
 };
 
 // 二項演算式
 struct BinaryExpr : public ExprBase
 {
     BinaryExpr() : ExprBase(kBinaryExpr) {}
-    BinaryExpr(std::shared_ptr<ExprBase> &first,
-               std::shared_ptr<ExprBase> &second,
+    BinaryExpr(ExprBase *first,
+               ExprBase *second,
                OperatorType operator_type) : ExprBase(kBinaryExpr), first(first), second(second), op_type(operator_type) {}
 
     virtual std::string Assemble(AssemblyConfig &conf)
@@ -260,17 +237,57 @@ struct BinaryExpr : public ExprBase
     {
     }
 
-    std::shared_ptr<ExprBase> first;
-    std::shared_ptr<ExprBase> second;
+    ExprBase *first = nullptr;
+    ExprBase *second = nullptr;
 
     OperatorType op_type;
 };
 
+// 単項演算式 (前置・後置の演算子、キャスト、sizeof)
+struct UnaryExpr : public ExprBase
+{
+    UnaryExpr(OperatorType operator_type, ExprBase *operand)
+        : ExprBase(kUnaryExpr), operand(operand), op_type(operator_type) {}
+
+    virtual std::string Assemble(AssemblyConfig &conf)
+    {
+        return "";
+    }
+
+    virtual void Stdout()
+    {
+    }
+
+    ExprBase *operand = nullptr; // sizeof(型名) では nullptr
+    OperatorType op_type;
+    TypeID type_name = kNoType;  // キャスト・sizeof の型名
+};
+
+// 条件式 (condition ? first : second)
+struct ConditionalExpr : public ExprBase
+{
+    ConditionalExpr(ExprBase *condition, ExprBase *first, ExprBase *second)
+        : ExprBase(kConditionalExpr), condition(condition), first(first), second(second) {}
+
+    virtual std::string Assemble(AssemblyConfig &conf)
+    {
+        return "";
+    }
+
+    virtual void Stdout()
+    {
+    }
+
+    ExprBase *condition = nullptr;
+    ExprBase *first = nullptr;
+    ExprBase *second = nullptr;
+};
+
 // 一次式
 struct PrimaryExpr : public ExprBase
 {
     PrimaryExpr() : ExprBase(kPrimaryExpr) {}
-    PrimaryExpr(std::shared_ptr<LiteralBase> &literal)
+    PrimaryExpr(LiteralBase *literal)
         : ExprBase(kPrimaryExpr), literal(literal) {}
     virtual std::string Assemble(AssemblyConfig &conf)
     {
@@ -278,7 +295,7 @@ struct PrimaryExpr : public ExprBase
     }
     virtual void Stdout() {}
 
-    std::shared_ptr<LiteralBase> literal;
+    LiteralBase *literal = nullptr;
 
     OperatorType op_type;
 };
@@ -295,7 +312,7 @@ struct ExprStmt : public DeclAndStmt
 {
     ExprStmt(NodeType t) : DeclAndStmt(kExprStmt) {}
 
-    std::shared_ptr<ExprBase> expr;
+    ExprBase *expr = nullptr;
 };
 
 struct VariableDecl : public DeclAndStmt
@@ -303,7 +320,7 @@ struct VariableDecl : public DeclAndStmt
     VariableDecl() : DeclAndStmt(kVariableDecl) {}
     VariableDecl(int stack_rel_addr) : stack_rel_addr(stack_rel_addr), DeclAndStmt(kVariableDecl) {}
 
-    std::shared_ptr<TypeInfo> type;
+    TypeID type = kNoType;
     std::string variable_name;
     // std::string storage_class;
     // std::string type_qualifier;
@@ -319,7 +336,7 @@ struct VariableDecl : public DeclAndStmt
 struct ReturnStmt : public DeclAndStmt
 {
     ReturnStmt() : DeclAndStmt(kReturnStmt) {}
-    ReturnStmt(const std::shared_ptr<ExprBase> &e)
+    ReturnStmt(ExprBase *e)
         : DeclAndStmt(kReturnStmt), return_expr(e) {}
 
     virtual std::string Assemble(AssemblyConfig &conf) override
@@ -330,7 +347,7 @@ struct ReturnStmt : public DeclAndStmt
     }
     virtual void Stdout() override {}
 
-    std::shared_ptr<ExprBase> return_expr;
+    ExprBase *return_expr = nullptr;
 };
 
 struct IfStmt : public DeclAndStmt
@@ -350,12 +367,12 @@ struct Argument : public ASTNode
     Argument() : ASTNode(kFuncParamList) {}
     virtual std::string Assemble(AssemblyConfig &conf) { return "Argument"; }
     virtual void Stdout() {}
-    std::shared_ptr<TypeInfo> var_type;
+    TypeID var_type = kNoType;
     IdentifierInfo var;
 };
 
-typedef std::vector<std::shared_ptr<Argument>> ArgumentList;
-typedef std::vector<std::shared_ptr<DeclAndStmt>> CompoundStmt;
+typedef std::vector<Argument *> ArgumentList;
+typedef std::vector<DeclAndStmt *> CompoundStmt;
 
 // ExternalDecl contains Function decl and Global Variable decl;
 struct ExternalDecl : public ASTNode
@@ -368,14 +385,27 @@ struct ExternalDecl : public ASTNode
 struct Function : public ExternalDecl
 {
     Function() : ExternalDecl(kFuncDefinition) {}
-    std::shared_ptr<TypeInfo> type;
+    TypeID type = kNoType;
     std::string function_name;
     ArgumentList arguments;
     CompoundStmt stmts;
+    bool is_static = false;
+
+    // 本体を後で読む (参照されるまで本体のトークン範囲 [body_begin, body_end) だけを持つ)
+    // 参照されなかった static 関数は本体を読まず、コードも生成しない.
+    // 本体はこの関数の位置で見えていたファイルスコープの宣言 (先頭から body_decls 個) だけで読む
+    bool body_pending = false;
+    size_t body_begin = 0;
+    size_t body_end = 0;
+    size_t body_decls = 0;
 
     std::string Assemble(AssemblyConfig &conf) override
     {
         std::string code = "";
+        if (body_pending)
+        {
+            return code;
+        }
         if (function_name.compare("main") == 0)
         {
             code += conf.asm_.Directive("globl _main");
@@ -397,7 +427,7 @@ struct Function : public ExternalDecl
 
     void Stdout() override
     {
-        std::cout << function_name << " " << type->type_name << "(" << std::endl;
+        std::cout << function_name << " " << GlobalTypes().Name(type) << "(" << std::endl;
         for (auto a : arguments)
         {
             a->Stdout();
@@ -414,7 +444,7 @@ struct Function : public ExternalDecl
 struct Program : public ASTNode
 {
     Program() : ASTNode(kProgram) {}
-    std::vector<std::shared_ptr<ExternalDecl>> decl;
+    std::vector<ExternalDecl *> decl;
 
     std::string Assemble(AssemblyConfig &conf) override
     {
@@ -439,10 +469,10 @@ struct Program : public ASTNode
             std::cout << d->node_type << std::endl;
             if (d->node_type == kFuncDefinition)
             {
-                std::shared_ptr<Function> f = std::dynamic_pointer_cast<Function>(d);
+                Function *f = static_cast<Function *>(d);
 
                 std::cout << f->function_name << std::endl;
-                std::cout << f->type->type_name << std::endl;
+                std::cout << GlobalTypes().Name(f->type) << std::endl;
 
                 f->Stdout();
             }
@@ -450,139 +480,322 @@ struct Program : public ASTNode
     }
 };
 
+// ポインタでつないだ AST を平坦な AST に変換して node の位置を返す (node が nullptr なら kNoNode)
+NodeIndex FlattenAST(const ASTNode *node, FlatAST *ast);
+
 struct CompilerState
 {
-    // 識別子が登録済みであるかを判定
+    // 識別子が見えるかを判定 (現在のスコープから外側へ、最後に PCH を探す)
     //   true  : 登録済み
     //   false : 未登録
-    bool IsDefinedID(const std::string &id)
+    bool IsDefinedID(SymbolID id)
     {
-        auto uid = scope + "::" + id;
-        return identifier_store.find(uid) != std::end(identifier_store);
+        return FindID(id) != nullptr;
     }
 
-    bool IsDefinedID(const std::string &id, const std::string &scope)
+    // 識別子が現在のスコープで宣言済みかを判定 (再定義の検出用)
+    //   true  : 宣言済み
+    //   false : 未宣言 (外側のスコープの同名の識別子は隠れる)
+    bool IsDeclaredInScope(SymbolID id)
     {
-        auto uid = scope + "::" + id;
-        return identifier_store.find(uid) != std::end(identifier_store);
+        if (identifiers.LookupCurrent(id))
+            return true;
+        return identifiers.Depth() == 0 && FindPchID(id);
     }
 
-    // 識別子ストアへの登録
+    // 現在のスコープへの登録
     //   true  : 登録成功
     //   false : 登録失敗
-    bool RegistID(const std::string &id)
+    bool RegistID(SymbolID id, uint32_t pos)
     {
-        auto uid = scope + "::" + id;
-        if (IsDefinedID(uid))
+        if (IsDeclaredInScope(id))
             return false;
 
-        identifier_store[uid] = IdentifierInfo{id, scope};
-        PDEBUG("!!!REGIST an identifier : " + uid);
-        PDEBUG(identifier_store.ToString());
+        IdentifierInfo info = {};
+        info.name = id;
+        info.scope = CurrentScopeLabel();
+        info.pos = pos;
+        identifiers.Declare(id, info);
+        TRACE_DEBUG("!!!REGIST an identifier : " + CurrentScope(true) + GlobalSymbols().Name(id));
         return true;
     }
 
-    bool RegistID(const std::string &id, const std::string &scope)
+    // 識別子の情報. なければ nullptr (次の登録まで有効)
+    const IdentifierInfo *FindID(SymbolID id)
     {
-        auto uid = scope + "::" + id;
-        if (IsDefinedID(uid))
-            return false;
-
-        identifier_store[uid] = IdentifierInfo{id, scope};
-        PDEBUG("!!!REGIST an identifier : " + uid);
-        PDEBUG(identifier_store.ToString());
-        return true;
+        const IdentifierInfo *info = identifiers.LookupVisible(id, visible_decls);
+        if (info)
+            return info;
+        return file_scope ? file_scope->FindFrozenID(id, file_scope_decls) : FindPchID(id);
     }
 
     // 識別子ストアから取得
-    IdentifierInfo GetID(const std::string &id)
+    IdentifierInfo GetID(SymbolID id)
     {
-        auto uid = scope + "::" + id;
-        return identifier_store[uid];
+        const IdentifierInfo *info = FindID(id);
+        return info ? *info : IdentifierInfo();
     }
-    
-    IdentifierInfo GetID(const std::string &id, const std::string &scope)
+
+    // 凍結したファイルスコープの識別子 (並列構文解析のワーカーから読むだけ. PCH は引かない)
+    // ファイルスコープの宣言は先頭から visible 個だけを見る
+    const IdentifierInfo *FindFrozenID(SymbolID id, size_t visible) const
+    {
+        const IdentifierInfo *info = identifiers.LookupVisible(id, visible);
+        if (info)
+            return info;
+        auto it = pch_identifiers.find(id);
+        return (it != std::end(pch_identifiers)) ? &it->second : nullptr;
+    }
+
+    // PCH のファイルスコープの識別子 (最初の参照で pch_identifiers へ写す)
+    IdentifierInfo *FindPchID(SymbolID id)
+    {
+        if (!pch)
+            return nullptr;
+
+        auto it = pch_identifiers.find(id);
+        if (it != std::end(pch_identifiers))
+            return &it->second;
+
+        PchIdentifier pid;
+        if (!pch->FindIdentifier("", GlobalSymbols().Name(id), &pid))
+            return nullptr;
+
+        IdentifierInfo &info = pch_identifiers[id];
+        info.name = id;
+        info.module_name = pid.module_name;
+        info.scope = kNoSymbol;
+        info.id_type = static_cast<IdentifierType>(pid.id_type);
+        info.address = pid.address;
+        return &info;
+    }
+
+    // 型が登録済みであるかを判定
+    //   true  : 登録済み
+    //   false : 未登録
+    bool HasType(const std::string &name)
     {
-        auto uid = scope + "::" + id;
-        return identifier_store[uid];
+        return FindType(name) != kNoType;
+    }
+
+    // 型名の型. なければ kNoType
+    // 末尾の "*" はポインタ、先頭の "struct " は無視する. PCH の型は最初の参照で型名の表へ登録する
+    TypeID FindType(const std::string &name)
+    {
+        if (!name.empty() && name.back() == '*')
+        {
+            TypeID base = FindType(name.substr(0, name.size() - 1));
+            return (base == kNoType) ? kNoType : GlobalTypes().PointerTo(base);
+        }
+        if (name.compare(0, 7, "struct ") == 0)
+            return FindType(name.substr(7));
+
+        auto it = type_names.find(GlobalSymbols().Find(name));
+        if (it != std::end(type_names))
+            return it->second;
+
+        if (file_scope)
+        {
+            auto frozen = file_scope->type_names.find(GlobalSymbols().Find(name));
+            return (frozen != std::end(file_scope->type_names)) ? frozen->second : kNoType;
+        }
+
+        PchType t;
+        if (!pch || !pch->FindType(name, &t))
+            return kNoType;
+
+        const SymbolID symbol = GlobalSymbols().Intern(name);
+        TypeID id;
+        if (t.members.empty())
+        {
+            id = GlobalTypes().Basic(symbol, t.size);
+        }
+        else
+        {
+            std::vector<std::pair<SymbolID, TypeID>> members;
+            for (auto &m : t.members)
+                members.push_back(std::make_pair(GlobalSymbols().Intern(m.first), FindType(m.second)));
+            id = GlobalTypes().NewStruct(symbol, members);
+        }
+        type_names[symbol] = id;
+        return id;
+    }
+
+    // 字句解析済みのトークン列が参照する PCH の型と識別子を読み込んでおく
+    // 並列構文解析のワーカーはファイルスコープを読むだけで PCH を引かないので、その前に呼ぶ
+    void LoadPchReferences()
+    {
+        if (!pch)
+            return;
+
+        for (size_t i = 0; i < tokens.StoredSize(); ++i)
+        {
+            if (tokens.StoredType(i) != tkWord)
+                continue;
+
+            const Token tok = tokens.StoredToken(i);
+            FindPchID(tok.symbol);
+            FindType(tok.token);
+        }
+    }
+
+    // 型ストアと識別子ストアを PCH に書き出す
+    void ExportPch(PchWriter *writer) const
+    {
+        const TypeTable &types = GlobalTypes();
+        for (auto &e : type_names)
+        {
+            const Type &type = types[e.second];
+            PchType t;
+            t.name = GlobalSymbols().Name(e.first);
+            t.is_pointer = (type.kind == kTypePointer);
+            t.size = type.size;
+            for (const TypeMember *m = types.MembersBegin(e.second); m != types.MembersEnd(e.second); ++m)
+                t.members.push_back(std::make_pair(GlobalSymbols().Name(m->name), types.Name(m->type)));
+            writer->AddType(t);
+        }
+
+        // ファイルスコープの識別子だけを書き出す
+        identifiers.ForEach(0, [writer](SymbolID name, const IdentifierInfo &info) {
+            PchIdentifier id;
+            id.name = GlobalSymbols().Name(name);
+            id.module_name = info.module_name;
+            id.id_type = info.id_type;
+            id.address = info.address;
+            writer->AddIdentifier(id);
+        });
     }
 
     // スコープ管理
 
-    // 現在のスコープ
+    // 現在のスコープ名 (i.e.: module::func). 診断用で、呼ぶたびに組み立てる
     // @param [in] suffix   true 末尾に "::" をつける. default: false
-    inline std::string CurrentScope(bool suffix = false)
+    std::string CurrentScope(bool suffix = false) const
     {
-        if (suffix)
-            return compiler_state->scope + "::";
-        return compiler_state->scope;
+        std::string name = module_name;
+        for (size_t depth = 1; depth <= identifiers.Depth(); ++depth)
+            name += "::" + GlobalSymbols().Name(identifiers.Label(depth));
+        return suffix ? name + "::" : name;
     }
 
-    void PushScope(std::string label)
+    // 現在のスコープの名前 (ファイルスコープは kNoSymbol)
+    SymbolID CurrentScopeLabel() const
     {
-        scope += "::" + label;
+        return (identifiers.Depth() == 0) ? kNoSymbol : identifiers.Label(identifiers.Depth());
+    }
+
+    void PushScope(SymbolID label)
+    {
+        identifiers.Push(label);
     }
 
-    // i.e.:  aaa::bbb::ccc -> aaa::bbb
     void PopScope()
     {
-        int p = scope.find_last_of("::");
-        scope = scope.substr(0, p);
+        identifiers.Pop();
+    }
+
+    // 関数が参照された. 本体を後回しにしていれば、読む関数の列へ移す
+    // 並列構文解析のワーカーでは、前のバッチの関数への参照を結果をまとめる時のために覚えておく
+    void ReferenceFunction(SymbolID id)
+    {
+        auto it = deferred_bodies.find(id);
+        if (it != std::end(deferred_bodies))
+        {
+            referenced_bodies.push_back(it->second);
+            deferred_bodies.erase(it);
+        }
+        else if (file_scope && !identifiers.Lookup(id))
+        {
+            outside_references.push_back(id);
+        }
     }
 
     // コンパイルエラー登録
+    // 行番号は現在のトークンの位置から求める (並列構文解析のワーカーでは結果をまとめる時に求める)
     void AddCompileError(std::string msg)
     {
+        const uint32_t pos = tokens.Peek().pos;
+        size_t line = (tokens.IsEnd() || file_scope) ? 0 : lines.Line(pos);
         errors.push_back({
-                scope,
-                line_number,
-                msg
+                CurrentScope(),
+                static_cast<int>(line),
+                msg,
+                pos
         });
     }
 
     // module name
     std::string module_name;
 
-    // line number in module
-    int line_number = 0;
+    // line table of the module (built on the first diagnostic)
+    LineTable lines;
 
-    // input data
-    std::vector<Token> buf;
+    // input data (pulled from the tokenizer on demand)
+    TokenStream tokens;
 
-    // current position
-    std::vector<Token>::iterator iter;
+    // type names of the module (the types themselves live in GlobalTypes())
+    std::unordered_map<SymbolID, TypeID> type_names;
 
-    // type information store
-    std::map<std::string, TypeInfo> type_store;
+    // identifier information store (lexical scopes keyed by symbol ID)
+    ScopeStack<IdentifierInfo> identifiers;
 
-    // identifier information store
-    class IdentifierMap : public std::map<std::string, IdentifierInfo> {
-      public:
-        std::string ToString() {
-            std::string str = "{";
-            bool first = true;
-            for (auto e : *this) {
-                if (!first) str += ", ";
-                first = false;
-                str += "\"" + e.first + "\": \"" + e.second.name + "\"";
-            }
-            str += "}";
-            return str;
-        }
-    };
-    IdentifierMap identifier_store;
+    // identifiers taken from the precompiled header
+    std::unordered_map<SymbolID, IdentifierInfo> pch_identifiers;
 
     // error information
     std::vector<CompileErrorInfo> errors;
 
-    // current scope
-    std::string scope;
+    // precompiled header (types and identifiers are loaded on first reference)
+    const PrecompiledHeader *pch = nullptr;
 
     // assembly config
     AssemblyConfig asm_config;
 
     // relative address of base stack pointer
     int stack_rel_addr = 0;
+
+    // static functions whose bodies are skipped until they are referenced,
+    // and referenced ones whose bodies are still to be parsed
+    std::unordered_map<SymbolID, Function *> deferred_bodies;
+    std::vector<Function *> referenced_bodies;
+
+    // number of file scope declarations visible while a deferred body is parsed
+    // (those before the function). all of them otherwise
+    size_t visible_decls = SIZE_MAX;
+
+    // functions of earlier batches referenced by a parallel parsing worker
+    std::vector<SymbolID> outside_references;
+
+    // AST nodes of the module (all freed at once with the compiler state)
+    Arena nodes;
+
+    // file scope of the module, frozen while the workers of parallel parsing read it.
+    // a worker sees only the first file_scope_decls declarations (those before its batch)
+    const CompilerState *file_scope = nullptr;
+    size_t file_scope_decls = 0;
+
+    // states of the parallel parsing workers (they own the AST nodes of their functions)
+    std::vector<std::shared_ptr<CompilerState>> workers;
+};
+
+// 演算子の優先順位 (大きいほど強く結合する)
+enum OperatorPrecedence
+{
+    kPrecMarker,         // 括弧と条件演算子の '?' (演算子スタック上で還元を止める)
+    kPrecComma,          // ,
+    kPrecAssign,         // = += -= ... (右結合)
+    kPrecConditional,    // ?: (右結合)
+    kPrecLogicalOr,      // ||
+    kPrecLogicalAnd,     // &&
+    kPrecBitOr,          // |
+    kPrecBitXor,         // ^
+    kPrecBitAnd,         // &
+    kPrecEquality,       // == !=
+    kPrecRelational,     // < > <= >=
+    kPrecShift,          // << >>
+    kPrecAdditive,       // + -
+    kPrecMultiplicative, // * / %
+    kPrecUnary,          // 前置の単項演算子・キャスト
 };
 
 struct Node
@@ -593,8 +806,8 @@ struct Node
     NodeType type;
     std::string syntax;
 
-    std::shared_ptr<Node> parent;
-    std::vector<std::shared_ptr<Node>> child;
+    Node *parent = nullptr; // 所有しない
+    std::vector<Node *> child;
 };
 
 class Parser
@@ -602,74 +815,82 @@ class Parser
   public:
     Parser(const std::shared_ptr<CompilerState> &compiler_state);
 
-    std::shared_ptr<Program> SyntaxCheck();
-    int GenerateAssembly(std::shared_ptr<Program> &node, std::string *assembly);
+    Program *SyntaxCheck();
+    Program *ParallelSyntaxCheck(ThreadPool &pool);
+    int GenerateAssembly(Program *node, std::string *assembly);
 
   private:
     void Init();
+    Program *CheckErrors(Program *prog, bool result);
+    bool ScanTopLevel(std::vector<std::pair<size_t, size_t>> &ranges);
+    void DeclareTopLevel(const std::vector<std::pair<size_t, size_t>> &ranges, std::vector<size_t> &decls_before);
 
-    bool IsEqual(std::vector<kcc::Token>::iterator &it, char c);
+    bool IsEqual(const kcc::Token &tok, char c);
     bool IsDefinedType(const std::string &str);
-    bool IsDefinedID(const std::string &var);
+    bool IsDefinedID(SymbolID var);
 
     bool SkipSemicolon();
     void SkipLF();
 
-    bool MakeVariableDecl(std::vector<std::shared_ptr<VariableDecl>> &variables);
+    bool MakeVariableDecl(std::vector<VariableDecl *> &variables);
     bool MakeVariableIdentifier(std::string &var_name);
-    bool MakeInitDecl(const std::shared_ptr<TypeInfo> &type, std::string &var_name, std::shared_ptr<AssignmentExpr> &assign_expr);
-    bool MakeAssignmentExpr(std::shared_ptr<AssignmentExpr> &assign_expr);
-    bool MakeExprStmt(std::shared_ptr<ExprStmt> &stmt);
+    bool MakeInitDecl(TypeID type, std::string &var_name, AssignmentExpr *&assign_expr);
+    bool MakeAssignmentExpr(AssignmentExpr *&assign_expr);
+    bool MakeExprStmt(ExprStmt *&stmt);
 
-    bool MakeTypeDefinition(std::shared_ptr<TypeInfo> &type);
-    bool MakeArgumentDecl(std::shared_ptr<Argument> &argument);
+    bool MakeTypeDefinition(TypeID &type);
+    bool MakeArgumentDecl(Argument *&argument);
     bool MakeArgumentDeclList(ArgumentList &arguments);
     bool MakeFunctionIdentifier(std::string &function_identifier, IdentifierInfo &id_info);
 
-    bool MakeReturnStmt(std::shared_ptr<ReturnStmt> &return_stmt);
+    bool MakeReturnStmt(ReturnStmt *&return_stmt);
     bool MakeCompoundStmt(CompoundStmt &compound_stmt);
-    bool MakeFunctionDefinition(std::shared_ptr<Function> &function);
+    bool MakeFunctionDefinition(Function *&function);
+    bool SkipFunctionBody(Function *function);
+    bool MakeReferencedBodies();
 
-    bool MakeBinaryExpr(std::shared_ptr<BinaryExpr> &primary_expr);
-    bool MakePrimaryExpr(std::shared_ptr<PrimaryExpr> &primary_expr);
+    bool MakeExpr(ExprBase *&expr, int lowest = kPrecComma);
+    bool MakeTypeName(TypeID &type);
+    bool MakePrimaryExpr(PrimaryExpr *&primary_expr);
 
-    bool MakeStringLiteral(std::shared_ptr<StringLiteral> &string_literal);
-    bool MakeIntegerLiteral(std::shared_ptr<IntegerLiteral> &integer_literal);
+    bool MakeStringLiteral(StringLiteral *&string_literal);
+    bool MakeIntegerLiteral(IntegerLiteral *&integer_literal);
 
-    bool MakeProgram(std::shared_ptr<Program> &program);
+    bool MakeProgram(Program *&program);
 
-    inline const kcc::Token GetToken(int n = 0)
+    // AST のノードを翻訳単位のアリーナに作る
+    template <typename T, typename... Args>
+    T *NewNode(Args &&... args)
     {
-        if (compiler_state->iter + n >= std::end(compiler_state->buf))
-        {
-            throw_ln("tokens : out of range");
-        }
-        return *(compiler_state->iter + n);
+        return compiler_state->nodes.New<T>(std::forward<Args>(args)...);
     }
 
-    inline const std::vector<kcc::Token>::iterator FwdCursor(int n = 1)
+    // 先読みはリングの要素への参照 (範囲の検査なし. 入力の終端から先は tkEof)
+    inline const kcc::Token &GetToken(int n = 0)
     {
-        if (compiler_state->iter + n > std::end(compiler_state->buf))
-        {
-            throw_ln("tokens : out of range");
-        }
-        return (compiler_state->iter += n);
+        return compiler_state->tokens.Peek(n);
     }
 
-    inline const std::vector<kcc::Token>::iterator BwdCursor(int n = 1)
+    // 種別だけを参照する先読み
+    inline kcc::TokenType GetTokenType(int n = 0)
     {
-        if (compiler_state->iter - n <= std::begin(compiler_state->buf) - 1)
-        {
-            throw_ln("tokens : out of range");
-        }
-        return (compiler_state->iter -= n);
+        return compiler_state->tokens.PeekType(n);
+    }
+
+    inline void FwdCursor(int n = 1)
+    {
+        compiler_state->tokens.Fwd(n);
+    }
+
+    inline void BwdCursor(int n = 1)
+    {
+        compiler_state->tokens.Bwd(n);
     }
 
+    // KCC_TRACE_LEVEL が KCC_TRACE_TOKEN 未満の場合は何もしない
     inline void ShowTokenInfo()
     {
-        std::cout << "-- TokenInfo ----" << std::endl;
-        std::cout << " token :" << GetToken().token << std::endl;
-        std::cout << " type  :" << GetToken().type << std::endl;
+        TRACE_TOKEN("token : " + GetToken().token + " type : " + std::to_string(GetTokenType()));
     }
 
     std::shared_ptr<CompilerState> compiler_state;
@@ -0,0 +1,428 @@
+#ifndef PCH_HH
+#define PCH_HH
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "source.hh"
+#include "symbol.hh"
+#include "tokenizer.hh"
+
+namespace kcc
+{
+
+// プリコンパイル済みヘッダ (PCH)
+// ヘッダを処理した後のマクロ・型・識別子の状態を保存したバイナリファイル.
+//
+// ファイル中の参照はすべて各セクションの先頭からのオフセットなので、mmap した位置によらずそのまま読める.
+// 読み込み時に全体を復元せず、マクロ・型・識別子は名前のハッシュ表から必要になった時に 1 つずつ取り出す.
+// 識別子はシンボル ID ではなく綴りで保存するので、読み込む側のシンボルテーブルの状態によらない.
+//
+//   ヘッダ      : FileHeader
+//   レコード    : マクロ・型・識別子 (32bit の値の並び)
+//   ハッシュ表  : マクロ・型・識別子ごとのオープンアドレスの表 (ハッシュ値, レコード位置 + 1)
+//   文字列      : 名前・マクロ本体の綴り
+//
+// 数値はホストのバイトオーダーで書く.
+namespace pch
+{
+
+static const char kMagic[8] = {'K', 'C', 'C', 'P', 'C', 'H', '0', '1'};
+static const uint32_t kVersion = 1;
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t file_size;
+    uint32_t records_offset, records_size;
+    uint32_t strings_offset, strings_size;
+    uint32_t macros_offset, macros_slots;
+    uint32_t types_offset, types_slots;
+    uint32_t identifiers_offset, identifiers_slots;
+};
+
+// マクロのフラグ
+enum MacroFlag
+{
+    mfFunctionLike = 1 << 0,
+    mfVariadic = 1 << 1,
+};
+
+static inline uint32_t Load32(const char *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 識別子のハッシュ値 (スコープ名と識別子名)
+static inline uint32_t IdentifierHash(const std::string &scope, const std::string &name)
+{
+    return SymbolTable::Hash(name.data(), name.size(), SymbolTable::Hash(scope.data(), scope.size() + 1));
+}
+
+} // namespace pch
+
+// PCH から取り出したマクロ. 綴りは mmap したファイルを指す
+struct PchMacro
+{
+    bool function_like;
+    bool variadic;
+    std::vector<StringRef> params; // 可変長引数 (...) は含まない
+    StringRef body;                // 本体の元の綴り (空白・改行を含まない 1 行)
+};
+
+// PCH から取り出した型
+struct PchType
+{
+    std::string name;
+    bool is_pointer;
+    uint32_t size;
+    std::vector<std::pair<std::string, std::string>> members; // (メンバ名, 型名)
+};
+
+// PCH から取り出した識別子
+struct PchIdentifier
+{
+    std::string scope;
+    std::string name;
+    std::string module_name;
+    uint32_t id_type;
+    uint32_t address;
+};
+
+// PCH を書き出す
+class PchWriter
+{
+  public:
+    PchWriter() {}
+
+    PchWriter(const PchWriter &) = delete;
+    PchWriter &operator=(const PchWriter &) = delete;
+
+    void AddMacro(const std::string &name, bool function_like, bool variadic,
+                  const std::vector<std::string> &params, const std::string &body)
+    {
+        uint32_t record = Record();
+        PutString(name);
+        Put((function_like ? pch::mfFunctionLike : 0) | (variadic ? pch::mfVariadic : 0));
+        Put(static_cast<uint32_t>(params.size()));
+        PutString(body);
+        for (auto &p : params)
+            PutString(p);
+        macros_.push_back({SymbolTable::Hash(name.data(), name.size()), record});
+    }
+
+    void AddType(const PchType &type)
+    {
+        uint32_t record = Record();
+        PutString(type.name);
+        Put(type.is_pointer ? 1 : 0);
+        Put(type.size);
+        Put(static_cast<uint32_t>(type.members.size()));
+        for (auto &m : type.members)
+        {
+            PutString(m.first);
+            PutString(m.second);
+        }
+        types_.push_back({SymbolTable::Hash(type.name.data(), type.name.size()), record});
+    }
+
+    void AddIdentifier(const PchIdentifier &id)
+    {
+        uint32_t record = Record();
+        PutString(id.scope);
+        PutString(id.name);
+        PutString(id.module_name);
+        Put(id.id_type);
+        Put(id.address);
+        identifiers_.push_back({pch::IdentifierHash(id.scope, id.name), record});
+    }
+
+    size_t MacroCount() const { return macros_.size(); }
+
+    //   true  : 成功
+    //   false : 書き込めなかった
+    bool Write(const std::string &path) const
+    {
+        std::string image = Build();
+        FILE *fp = std::fopen(path.c_str(), "wb");
+        if (!fp)
+            return false;
+        bool ok = std::fwrite(image.data(), 1, image.size(), fp) == image.size();
+        return (std::fclose(fp) == 0) && ok;
+    }
+
+  private:
+    struct Entry
+    {
+        uint32_t hash;
+        uint32_t record;
+    };
+
+    uint32_t Record() const
+    {
+        return static_cast<uint32_t>(records_.size());
+    }
+
+    void Put(uint32_t v)
+    {
+        records_.append(reinterpret_cast<const char *>(&v), sizeof(v));
+    }
+
+    // 文字列セクションへの参照 (オフセット, 長さ). 同じ文字列は 1 つにまとめる
+    void PutString(const std::string &s)
+    {
+        auto it = string_offsets_.find(s);
+        uint32_t offset;
+        if (it != string_offsets_.end())
+        {
+            offset = it->second;
+        }
+        else
+        {
+            offset = static_cast<uint32_t>(strings_.size());
+            strings_ += s;
+            string_offsets_[s] = offset;
+        }
+        Put(offset);
+        Put(static_cast<uint32_t>(s.size()));
+    }
+
+    // 充填率 1/2 以下のハッシュ表
+    static std::vector<uint32_t> BuildTable(const std::vector<Entry> &entries)
+    {
+        size_t slots = 4;
+        while (slots < entries.size() * 2)
+            slots *= 2;
+
+        std::vector<uint32_t> table(slots * 2, 0);
+        for (auto &e : entries)
+        {
+            size_t i = e.hash & (slots - 1);
+            while (table[i * 2 + 1] != 0)
+                i = (i + 1) & (slots - 1);
+            table[i * 2] = e.hash;
+            table[i * 2 + 1] = e.record + 1;
+        }
+        return table;
+    }
+
+    std::string Build() const
+    {
+        std::vector<uint32_t> tables[3] = {BuildTable(macros_), BuildTable(types_), BuildTable(identifiers_)};
+
+        pch::FileHeader header;
+        std::memcpy(header.magic, pch::kMagic, sizeof(header.magic));
+        header.version = pch::kVersion;
+        uint32_t offset = sizeof(header);
+        header.records_offset = offset;
+        header.records_size = static_cast<uint32_t>(records_.size());
+        offset += header.records_size;
+        uint32_t *table_fields[3][2] = {{&header.macros_offset, &header.macros_slots},
+                                        {&header.types_offset, &header.types_slots},
+                                        {&header.identifiers_offset, &header.identifiers_slots}};
+        for (int t = 0; t < 3; ++t)
+        {
+            *table_fields[t][0] = offset;
+            *table_fields[t][1] = static_cast<uint32_t>(tables[t].size() / 2);
+            offset += static_cast<uint32_t>(tables[t].size() * sizeof(uint32_t));
+        }
+        header.strings_offset = offset;
+        header.strings_size = static_cast<uint32_t>(strings_.size());
+        header.file_size = offset + header.strings_size;
+
+        std::string image(reinterpret_cast<const char *>(&header), sizeof(header));
+        image += records_;
+        for (auto &t : tables)
+            image.append(reinterpret_cast<const char *>(t.data()), t.size() * sizeof(uint32_t));
+        image += strings_;
+        return image;
+    }
+
+    std::string records_;
+    std::string strings_;
+    std::unordered_map<std::string, uint32_t> string_offsets_;
+    std::vector<Entry> macros_;
+    std::vector<Entry> types_;
+    std::vector<Entry> identifiers_;
+};
+
+// mmap した PCH から読み出す
+class PrecompiledHeader
+{
+  public:
+    PrecompiledHeader() : data_(nullptr), size_(0) {}
+
+    PrecompiledHeader(const PrecompiledHeader &) = delete;
+    PrecompiledHeader &operator=(const PrecompiledHeader &) = delete;
+
+    //   true  : 成功
+    //   false : 開けない、または PCH ではない
+    bool Open(const std::string &path)
+    {
+        data_ = nullptr;
+        size_ = 0;
+        if (!buffer_.Open(path) || buffer_.size() < sizeof(pch::FileHeader))
+            return false;
+
+        std::memcpy(&header_, buffer_.data(), sizeof(header_));
+        if (std::memcmp(header_.magic, pch::kMagic, sizeof(header_.magic)) != 0 || header_.version != pch::kVersion ||
+            header_.file_size != buffer_.size())
+            return false;
+
+        const uint64_t size = buffer_.size();
+        if (static_cast<uint64_t>(header_.records_offset) + header_.records_size > size ||
+            static_cast<uint64_t>(header_.strings_offset) + header_.strings_size > size ||
+            !IsValidTable(header_.macros_offset, header_.macros_slots) ||
+            !IsValidTable(header_.types_offset, header_.types_slots) ||
+            !IsValidTable(header_.identifiers_offset, header_.identifiers_slots))
+            return false;
+
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        return true;
+    }
+
+    bool IsOpen() const { return data_ != nullptr; }
+
+    bool FindMacro(const char *name, size_t n, PchMacro *macro) const
+    {
+        Reader r(this);
+        if (!Find(header_.macros_offset, header_.macros_slots, SymbolTable::Hash(name, n),
+                  [&](Reader &rec) { return rec.String() == StringRef(name, n); }, &r))
+            return false;
+
+        uint32_t flags = r.U32();
+        uint32_t nparams = r.U32();
+        macro->function_like = (flags & pch::mfFunctionLike) != 0;
+        macro->variadic = (flags & pch::mfVariadic) != 0;
+        macro->body = r.String();
+        macro->params.clear();
+        for (uint32_t i = 0; i < nparams && r.ok; ++i)
+            macro->params.push_back(r.String());
+        return r.ok;
+    }
+
+    bool FindType(const std::string &name, PchType *type) const
+    {
+        Reader r(this);
+        if (!Find(header_.types_offset, header_.types_slots, SymbolTable::Hash(name.data(), name.size()),
+                  [&](Reader &rec) { return rec.String() == name; }, &r))
+            return false;
+
+        type->name = name;
+        type->is_pointer = r.U32() != 0;
+        type->size = r.U32();
+        uint32_t nmembers = r.U32();
+        type->members.clear();
+        for (uint32_t i = 0; i < nmembers && r.ok; ++i)
+        {
+            std::string member = r.String().str();
+            type->members.push_back(std::make_pair(member, r.String().str()));
+        }
+        return r.ok;
+    }
+
+    bool FindIdentifier(const std::string &scope, const std::string &name, PchIdentifier *id) const
+    {
+        Reader r(this);
+        if (!Find(header_.identifiers_offset, header_.identifiers_slots, pch::IdentifierHash(scope, name),
+                  [&](Reader &rec) { return rec.String() == scope && rec.String() == name; }, &r))
+            return false;
+
+        id->scope = scope;
+        id->name = name;
+        id->module_name = r.String().str();
+        id->id_type = r.U32();
+        id->address = r.U32();
+        return r.ok;
+    }
+
+  private:
+    // レコードを先頭から順に読む. 範囲外を読もうとすると ok が false になる
+    struct Reader
+    {
+        explicit Reader(const PrecompiledHeader *pch) : pch(pch), pos(0), end(0), ok(true) {}
+
+        void Seek(uint32_t record)
+        {
+            pos = pch->header_.records_offset + static_cast<uint64_t>(record);
+            end = pch->header_.records_offset + static_cast<uint64_t>(pch->header_.records_size);
+            ok = true;
+        }
+
+        uint32_t U32()
+        {
+            if (!ok || pos + sizeof(uint32_t) > end)
+            {
+                ok = false;
+                return 0;
+            }
+            uint32_t v = pch::Load32(pch->data_ + pos);
+            pos += sizeof(uint32_t);
+            return v;
+        }
+
+        StringRef String()
+        {
+            uint32_t offset = U32();
+            uint32_t length = U32();
+            if (!ok || static_cast<uint64_t>(offset) + length > pch->header_.strings_size)
+            {
+                ok = false;
+                return StringRef("", 0);
+            }
+            return StringRef(pch->data_ + pch->header_.strings_offset + offset, length);
+        }
+
+        const PrecompiledHeader *pch;
+        uint64_t pos;
+        uint64_t end;
+        bool ok;
+    };
+
+    bool IsValidTable(uint32_t offset, uint32_t slots) const
+    {
+        return slots != 0 && (slots & (slots - 1)) == 0 &&
+               static_cast<uint64_t>(offset) + static_cast<uint64_t>(slots) * 8 <= buffer_.size();
+    }
+
+    // ハッシュ表を引き、キーが一致したレコードのキーの直後に r を置く
+    template <typename Match>
+    bool Find(uint32_t table, uint32_t slots, uint32_t hash, Match match, Reader *r) const
+    {
+        if (!data_)
+            return false;
+
+        for (uint32_t n = 0, i = hash & (slots - 1); n < slots; ++n, i = (i + 1) & (slots - 1))
+        {
+            const char *slot = data_ + table + static_cast<size_t>(i) * 8;
+            uint32_t record = pch::Load32(slot + 4);
+            if (record == 0)
+                return false;
+            if (pch::Load32(slot) != hash)
+                continue;
+
+            r->Seek(record - 1);
+            if (match(*r) && r->ok)
+                return true;
+        }
+        return false;
+    }
+
+    SourceBuffer buffer_;
+    pch::FileHeader header_;
+    const char *data_;
+    size_t size_;
+};
+
+} // namespace kcc
+
+#endif
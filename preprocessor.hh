@@ -0,0 +1,1124 @@
+#ifndef PREPROCESSOR_HH
+#define PREPROCESSOR_HH
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "arena.hh"
+#include "header_cache.hh"
+#include "hide_set.hh"
+#include "pch.hh"
+#include "symbol.hh"
+#include "tokenizer.hh"
+
+namespace kcc
+{
+
+// プリプロセッサ
+// 字句解析済みのトークン列に対して指令 (#include, #define, #undef, #if 系, #pragma once, #error) を処理し、
+// マクロを展開したトークン列を出力する. 出力は TokenStream::Assign でそのまま構文解析器へ渡せる.
+//
+// ヘッダは HeaderCache から取得するので、同じヘッダを何度インクルードしても読み込み・字句解析は 1 回で済む.
+// インクルードガードのマクロが定義済みのヘッダと、#pragma once を処理済みのヘッダは開き直さない.
+//
+// マクロ展開の途中のトークン列はすべてアリーナに置き、展開ごとに std::vector や std::string を作らない.
+// 再帰的な展開はトークンごとのハイドセットで防ぐ.
+//
+// PCH を使う場合、マクロは最初に参照された時に PCH から 1 つずつ取り出す.
+class Preprocessor
+{
+  public:
+    static const int kMaxIncludeDepth = 200;
+
+    explicit Preprocessor(HeaderCache &cache = GlobalHeaderCache())
+        : cache_(cache), pch_(nullptr), hide_sets_(arena_), file_(nullptr), include_depth_(0), cond_base_(0),
+          unevaluated_(0), errors_(0) {}
+
+    Preprocessor(const Preprocessor &) = delete;
+    Preprocessor &operator=(const Preprocessor &) = delete;
+
+    // <...> と "..." のインクルードで探索するディレクトリを追加する (追加した順に探索する)
+    void AddIncludePath(const std::string &dir)
+    {
+        if (dir.empty() || dir.back() == '/')
+            include_paths_.push_back(dir);
+        else
+            include_paths_.push_back(dir + "/");
+    }
+
+    // file を前処理して dest に出力する
+    // 出力したトークンは file・ヘッダキャッシュのバッファと、このオブジェクトのアリーナ (# と ## で作ったトークン) を参照する
+    //   true  : 成功
+    //   false : エラーがあった (メッセージは標準エラー出力に出す)
+    bool Run(const SourceFile &file, std::vector<Token> *dest)
+    {
+        ProcessFile(file, dest);
+        return errors_ == 0;
+    }
+
+    // PCH のマクロを定義済みとして扱う
+    // PCH から取り出したマクロの本体は pch を参照するので、pch は出力したトークンより長く生存させること.
+    void UsePch(const PrecompiledHeader *pch)
+    {
+        pch_ = pch;
+    }
+
+    // マクロが定義されているか
+    bool IsDefined(SymbolID name)
+    {
+        return LookupMacro(name) != nullptr;
+    }
+
+    // 定義されているマクロを PCH に書き出す
+    void ExportMacros(PchWriter *writer) const
+    {
+        const SymbolTable &symbols = GlobalSymbols();
+        for (size_t id = 0; id < macros_.size(); ++id)
+        {
+            const Macro *m = macros_[id].get();
+            if (!m)
+                continue;
+
+            std::vector<std::string> params;
+            for (SymbolID p : m->params)
+                params.push_back(symbols.Name(p));
+
+            // 本体は 1 つのファイルの連続したトークンなので、先頭から末尾までの綴りを保存する
+            std::string body;
+            if (!m->body.empty())
+            {
+                const char *b = m->body.front().token.data();
+                const StringRef &last = m->body.back().token;
+                body.assign(b, last.data() + last.size());
+            }
+            writer->AddMacro(symbols.Name(static_cast<SymbolID>(id)), m->function_like, m->variadic, params, body);
+        }
+    }
+
+    size_t ErrorCount() const { return errors_; }
+
+  private:
+    // 展開中のトークンとそのハイドセット
+    struct PPToken
+    {
+        Token tok;
+        const HideSet *hs;
+    };
+
+    // アリーナ上のトークン列
+    struct Range
+    {
+        const PPToken *begin;
+        const PPToken *end;
+    };
+
+    struct Macro
+    {
+        bool function_like;
+        bool variadic;                // 最後の仮引数が ... (__VA_ARGS__)
+        std::vector<SymbolID> params; // 仮引数名 (可変長引数は含まない)
+        std::vector<Token> body;
+        std::vector<int> body_param; // body の各トークンが何番目の仮引数か (仮引数でなければ -1)
+
+        // オブジェクト形式マクロの置換結果とそのハイドセット (前回の展開のメモ)
+        Range memo;
+        const HideSet *memo_hs;
+    };
+
+    // 展開の入力
+    // 入力ファイルのトークン列 [src, src_end) か、アリーナ上の展開結果 [it, end) のどちらか
+    struct Frame
+    {
+        const Token *src;
+        const Token *src_end;
+        const PPToken *it;
+        const PPToken *end;
+    };
+
+    // #if 系の条件の状態
+    struct Conditional
+    {
+        bool active;        // 現在の分岐が有効か
+        bool parent_active; // 外側の分岐が有効か
+        bool taken;         // いずれかの分岐を有効にしたか
+        bool seen_else;
+    };
+
+    bool IsActive() const
+    {
+        return conds_.empty() || conds_.back().active;
+    }
+
+    void ProcessFile(const SourceFile &file, std::vector<Token> *out)
+    {
+        const SourceFile *saved_file = file_;
+        const size_t saved_base = cond_base_;
+        file_ = &file;
+        cond_base_ = conds_.size();
+
+        const std::vector<Token> &tokens = file.tokens;
+        const size_t n = tokens.size();
+        size_t i = 0;
+        while (i < n)
+        {
+            if (file.IsDirective(i))
+            {
+                size_t next = file.NextLine(i);
+                Directive(i + 1, next, out);
+                i = next;
+                continue;
+            }
+
+            // 次の指令までをまとめて展開する
+            size_t j = i + 1;
+            while (j < n && !file.IsDirective(j))
+                ++j;
+            if (IsActive())
+                Expand(&tokens[i], tokens.data() + j, out);
+            i = j;
+        }
+
+        if (conds_.size() != cond_base_)
+        {
+            Error(n > 0 ? tokens[n - 1] : Token(), "unterminated conditional directive");
+            conds_.resize(cond_base_);
+        }
+
+        file_ = saved_file;
+        cond_base_ = saved_base;
+    }
+
+    // 指令を処理する. [b, e) は # に続く指令名から行末まで
+    void Directive(size_t b, size_t e, std::vector<Token> *out)
+    {
+        if (b == e)
+            return; // 空の指令
+
+        const std::vector<Token> &tokens = file_->tokens;
+        const Token &name = tokens[b];
+
+        // 条件分岐は無効な分岐の中でも入れ子を数える
+        if (name.token == "if" || name.token == "ifdef" || name.token == "ifndef")
+        {
+            Conditional c = {false, IsActive(), false, false};
+            if (c.parent_active)
+            {
+                if (name.token == "if")
+                    c.active = EvalCondition(b + 1, e);
+                else
+                    c.active = IsDefinedName(b + 1, e) == (name.token == "ifdef");
+                c.taken = c.active;
+            }
+            conds_.push_back(c);
+            return;
+        }
+        if (name.token == "elif" || name.token == "else" || name.token == "endif")
+        {
+            if (conds_.size() == cond_base_)
+            {
+                Error(name, "#" + name.token + " without #if");
+                return;
+            }
+            Conditional &c = conds_.back();
+            if (name.token == "endif")
+            {
+                conds_.pop_back();
+                return;
+            }
+            if (c.seen_else)
+            {
+                Error(name, "#" + name.token + " after #else");
+                return;
+            }
+            if (name.token == "else")
+            {
+                c.active = c.parent_active && !c.taken;
+                c.seen_else = true;
+            }
+            else
+            {
+                c.active = c.parent_active && !c.taken && EvalCondition(b + 1, e);
+            }
+            c.taken |= c.active;
+            return;
+        }
+
+        if (!IsActive())
+            return;
+
+        if (name.token == "define")
+            Define(b + 1, e);
+        else if (name.token == "undef")
+            Undef(b + 1, e);
+        else if (name.token == "include")
+            Include(b + 1, e, out);
+        else if (name.token == "pragma")
+            Pragma(b + 1, e);
+        else if (name.token == "error")
+            Error(name, "#error" + LineText(b + 1, e));
+        else if (name.token == "warning")
+            std::cerr << Location(name) << ": warning: #warning" << LineText(b + 1, e) << std::endl;
+        else if (name.token == "line")
+        {
+            // 行番号は LineTable で求めるので無視する
+        }
+        else
+            Error(name, "invalid preprocessing directive #" + name.token);
+    }
+
+    void Define(size_t b, size_t e)
+    {
+        const std::vector<Token> &tokens = file_->tokens;
+        if (b == e || tokens[b].type != tkWord)
+        {
+            Error(tokens[b - 1], "macro names must be identifiers");
+            return;
+        }
+
+        const Token &name = tokens[b];
+        std::unique_ptr<Macro> m(new Macro());
+        m->function_like = false;
+        m->variadic = false;
+        m->memo = Range{nullptr, nullptr};
+        m->memo_hs = nullptr;
+
+        // 名前の直後に空白なしで ( が続けば関数形式マクロ
+        size_t i = b + 1;
+        if (i < e && tokens[i].type == tkOpenParent && tokens[i].token.data() == name.token.data() + name.token.size())
+        {
+            m->function_like = true;
+            for (++i;; ++i)
+            {
+                if (i < e && tokens[i].type == tkCloseParent && m->params.empty() && !m->variadic)
+                    break;
+                if (i < e && tokens[i].type == tkWord && !m->variadic)
+                    m->params.push_back(tokens[i].symbol);
+                else if (i < e && tokens[i].type == tkEllipsis && !m->variadic)
+                    m->variadic = true;
+                else
+                {
+                    Error(name, "invalid macro parameter list");
+                    return;
+                }
+
+                if (++i < e && tokens[i].type == tkCloseParent)
+                    break;
+                if (i >= e || tokens[i].type != tkComma)
+                {
+                    Error(name, "invalid macro parameter list");
+                    return;
+                }
+            }
+            ++i;
+        }
+
+        m->body.assign(tokens.begin() + i, tokens.begin() + e);
+        IndexParams(m.get());
+
+        // # の後ろは仮引数、## は本体の両端に置けない
+        const size_t n = m->body.size();
+        for (size_t k = 0; k < n; ++k)
+        {
+            if (m->function_like && m->body[k].type == tkHash && (k + 1 == n || m->body_param[k + 1] < 0))
+            {
+                Error(m->body[k], "'#' is not followed by a macro parameter");
+                return;
+            }
+            if (m->body[k].type == tkHashHash && (k == 0 || k + 1 == n))
+            {
+                Error(m->body[k], "'##' cannot appear at either end of a macro expansion");
+                return;
+            }
+        }
+
+        SetMacro(name.symbol, std::move(m));
+    }
+
+    // body の各トークンが何番目の仮引数かを求める
+    static void IndexParams(Macro *m)
+    {
+        m->body_param.clear();
+        for (auto &tok : m->body)
+        {
+            int param = -1;
+            for (size_t k = 0; m->function_like && k < m->params.size(); ++k)
+            {
+                if (tok.type == tkWord && tok.symbol == m->params[k])
+                    param = static_cast<int>(k);
+            }
+            if (m->variadic && tok.type == tkWord && tok.token == "__VA_ARGS__")
+                param = static_cast<int>(m->params.size());
+            m->body_param.push_back(param);
+        }
+    }
+
+    // マクロを登録する (m が nullptr なら未定義にする). PCH の同名のマクロより優先する
+    void SetMacro(SymbolID name, std::unique_ptr<Macro> m)
+    {
+        if (macros_.size() <= name)
+            macros_.resize(name + 1);
+        if (pch_checked_.size() <= name)
+            pch_checked_.resize(name + 1, false);
+        macros_[name] = std::move(m);
+        pch_checked_[name] = true;
+    }
+
+    // 名前からマクロを引く. 未定義であれば nullptr
+    Macro *LookupMacro(SymbolID name)
+    {
+        if (name < macros_.size() && macros_[name])
+            return macros_[name].get();
+        if (!pch_ || (name < pch_checked_.size() && pch_checked_[name]))
+            return nullptr;
+
+        // PCH から取り出すのは名前ごとに 1 回だけ
+        const std::string &spelling = GlobalSymbols().Name(name);
+        PchMacro pm;
+        if (!pch_->FindMacro(spelling.data(), spelling.size(), &pm))
+        {
+            SetMacro(name, nullptr);
+            return nullptr;
+        }
+
+        std::unique_ptr<Macro> m(new Macro());
+        m->function_like = pm.function_like;
+        m->variadic = pm.variadic;
+        m->memo = Range{nullptr, nullptr};
+        m->memo_hs = nullptr;
+        for (auto &p : pm.params)
+            m->params.push_back(GlobalSymbols().Intern(p.data(), p.size()));
+        Tokenizer tzr;
+        tzr.Tokenize(pm.body.data(), pm.body.size(), &m->body);
+        IndexParams(m.get());
+
+        Macro *result = m.get();
+        SetMacro(name, std::move(m));
+        return result;
+    }
+
+    void Undef(size_t b, size_t e)
+    {
+        const std::vector<Token> &tokens = file_->tokens;
+        if (b == e || tokens[b].type != tkWord)
+        {
+            Error(tokens[b - 1], "macro names must be identifiers");
+            return;
+        }
+        SetMacro(tokens[b].symbol, nullptr);
+    }
+
+    // #ifdef / #ifndef の対象が定義済みか
+    bool IsDefinedName(size_t b, size_t e)
+    {
+        const std::vector<Token> &tokens = file_->tokens;
+        if (b == e || tokens[b].type != tkWord)
+        {
+            Error(tokens[b - 1], "macro names must be identifiers");
+            return false;
+        }
+        return IsDefined(tokens[b].symbol);
+    }
+
+    void Include(size_t b, size_t e, std::vector<Token> *out)
+    {
+        const std::vector<Token> &tokens = file_->tokens;
+        const Token &directive = tokens[b - 1];
+
+        // "name" と <name> はそのまま、それ以外はマクロを展開してから解釈する
+        std::string name;
+        bool quoted = false;
+        if (b != e && tokens[b].type == tkString)
+        {
+            name = tokens[b].token.str();
+            quoted = true;
+        }
+        else if (b != e && tokens[b].type == tkLess)
+        {
+            size_t k = b + 1;
+            while (k < e && tokens[k].type != tkGreater)
+                ++k;
+            if (k < e)
+            {
+                const char *s = tokens[b].token.data() + 1;
+                name = "<" + std::string(s, tokens[k].token.data()) + ">";
+            }
+        }
+        else if (b != e)
+        {
+            std::vector<Token> expanded;
+            Expand(&tokens[b], tokens.data() + e, &expanded);
+            for (auto &tok : expanded)
+            {
+                name += tok.token;
+                if (tok.type == tkGreater)
+                    break;
+            }
+            quoted = !name.empty() && name[0] == '"';
+        }
+
+        if (name.size() < 3 || name.back() != (quoted ? '"' : '>') || (!quoted && name[0] != '<'))
+        {
+            Error(directive, "#include expects \"FILENAME\" or <FILENAME>");
+            return;
+        }
+        name = name.substr(1, name.size() - 2);
+
+        if (include_depth_ >= kMaxIncludeDepth)
+        {
+            Error(directive, "#include nested too deeply");
+            return;
+        }
+
+        std::shared_ptr<const SourceFile> header = FindHeader(name, quoted);
+        if (!header)
+        {
+            Error(directive, name + ": No such file or directory");
+            return;
+        }
+
+        // 開き直す必要のないヘッダ
+        if (once_.count(header.get()) || (header->guard != kNoSymbol && IsDefined(header->guard)))
+            return;
+
+        included_.push_back(header);
+        ++include_depth_;
+        ProcessFile(*header, out);
+        --include_depth_;
+    }
+
+    std::shared_ptr<const SourceFile> FindHeader(const std::string &name, bool quoted)
+    {
+        if (!name.empty() && name[0] == '/')
+            return cache_.Load(name);
+
+        // "..." はインクルードしたファイルのディレクトリから探す
+        if (quoted)
+        {
+            std::shared_ptr<const SourceFile> header = cache_.Load(file_->Directory() + name);
+            if (header)
+                return header;
+        }
+        for (auto &dir : include_paths_)
+        {
+            std::shared_ptr<const SourceFile> header = cache_.Load(dir + name);
+            if (header)
+                return header;
+        }
+        return nullptr;
+    }
+
+    void Pragma(size_t b, size_t e)
+    {
+        const std::vector<Token> &tokens = file_->tokens;
+        if (b != e && tokens[b].token == "once")
+            once_.insert(file_);
+        // その他の #pragma は無視する
+    }
+
+    // [b, e) のマクロを展開して out に追加する
+    void Expand(const Token *b, const Token *e, std::vector<Token> *out)
+    {
+        if (macros_.empty() && !pch_)
+        {
+            out->insert(out->end(), b, e);
+            return;
+        }
+
+        const size_t base = frames_.size();
+        frames_.push_back(Frame{b, e, nullptr, nullptr});
+        ExpandFrames(base, [out](const PPToken &t) { out->push_back(t.tok); });
+    }
+
+    // [b, e) のマクロを展開した結果をアリーナに置く (実引数の展開用)
+    Range ExpandRange(Range r)
+    {
+        const size_t start = scratch_.size();
+        const size_t base = frames_.size();
+        frames_.push_back(Frame{nullptr, nullptr, r.begin, r.end});
+        ExpandFrames(base, [this](const PPToken &t) { scratch_.push_back(t); });
+        return MoveToArena(start);
+    }
+
+    // 展開の本体 (Prosser のアルゴリズム)
+    // 入力は frames_ の base より上のフレームで、展開結果は先頭から入力へ積み直して再走査する.
+    // トークンのハイドセットに含まれるマクロは展開しないので、再帰的な定義でも停止する.
+    template <typename Emit>
+    void ExpandFrames(size_t base, Emit emit)
+    {
+        PPToken t;
+        while (NextToken(base, &t))
+        {
+            Macro *m = FindMacro(t);
+            if (!m)
+            {
+                emit(t);
+                continue;
+            }
+
+            if (!m->function_like)
+            {
+                PushFrame(ObjectBody(*m, t));
+                continue;
+            }
+
+            // 関数形式マクロは ( が続く場合だけ展開する
+            if (!PeekIs(base, tkOpenParent))
+            {
+                emit(t);
+                continue;
+            }
+
+            Range *args;
+            const HideSet *close_hs;
+            if (!CollectArgs(base, t, *m, &args, &close_hs))
+                continue;
+
+            // HS' = (HS(名前) ∩ HS(')')) ∪ {名前}
+            const HideSet *hs = hide_sets_.Add(hide_sets_.Intersect(t.hs, close_hs), t.tok.symbol);
+            PushFrame(Substitute(*m, t, args, hs));
+        }
+    }
+
+    Macro *FindMacro(const PPToken &t)
+    {
+        if (t.tok.type != tkWord)
+            return nullptr;
+        Macro *m = LookupMacro(t.tok.symbol);
+        return (m && !HideSetTable::Contains(t.hs, t.tok.symbol)) ? m : nullptr;
+    }
+
+    void PushFrame(Range r)
+    {
+        if (r.begin != r.end)
+            frames_.push_back(Frame{nullptr, nullptr, r.begin, r.end});
+    }
+
+    // 入力から次のトークンを取り出す. base より下のフレームは読まない
+    bool NextToken(size_t base, PPToken *t)
+    {
+        while (frames_.size() > base)
+        {
+            Frame &f = frames_.back();
+            if (f.src != f.src_end)
+            {
+                t->tok = *f.src++;
+                t->hs = nullptr;
+                return true;
+            }
+            if (f.it != f.end)
+            {
+                *t = *f.it++;
+                return true;
+            }
+            frames_.pop_back();
+        }
+        return false;
+    }
+
+    // 次のトークンの種別が type であるか (取り出さない)
+    bool PeekIs(size_t base, TokenType type) const
+    {
+        for (size_t k = frames_.size(); k-- > base;)
+        {
+            const Frame &f = frames_[k];
+            if (f.src != f.src_end)
+                return f.src->type == type;
+            if (f.it != f.end)
+                return f.it->tok.type == type;
+        }
+        return false;
+    }
+
+    // scratch_ の start 以降をアリーナへ移す
+    Range MoveToArena(size_t start)
+    {
+        const PPToken *b = scratch_.data() + start;
+        const PPToken *e = scratch_.data() + scratch_.size();
+        PPToken *p = arena_.Copy(b, e);
+        Range r = {p, p + (e - b)};
+        scratch_.resize(start);
+        return r;
+    }
+
+    // オブジェクト形式マクロの置換結果. 本体の各トークンのハイドセットは HS(名前) ∪ {名前}
+    // 同じハイドセットでの展開が続く間は前回の結果をそのまま使う
+    Range ObjectBody(Macro &m, const PPToken &name)
+    {
+        const HideSet *hs = hide_sets_.Add(name.hs, name.tok.symbol);
+        if (!m.memo.begin || m.memo_hs != hs)
+        {
+            PPToken *p = arena_.AllocateArray<PPToken>(m.body.size());
+            for (size_t k = 0; k < m.body.size(); ++k)
+                p[k] = PPToken{m.body[k], hs};
+            m.memo = Range{p, p + m.body.size()};
+            m.memo_hs = hs;
+        }
+        return m.memo;
+    }
+
+    // 関数形式マクロの実引数を取り出す. 次のトークンは (
+    // 実引数は m の仮引数の数 (可変長引数を含む) だけの Range の配列として args に置く
+    bool CollectArgs(size_t base, const PPToken &name, const Macro &m, Range **args, const HideSet **close_hs)
+    {
+        const size_t start = scratch_.size();
+        const size_t bounds_start = bounds_.size();
+
+        PPToken t;
+        NextToken(base, &t); // (
+        int depth = 0;
+        for (;;)
+        {
+            if (!NextToken(base, &t))
+            {
+                Error(name.tok, "unterminated argument list invoking macro \"" + name.tok.token + "\"");
+                scratch_.resize(start);
+                bounds_.resize(bounds_start);
+                return false;
+            }
+
+            if (t.tok.type == tkCloseParent && depth == 0)
+                break;
+            if (t.tok.type == tkOpenParent)
+                ++depth;
+            else if (t.tok.type == tkCloseParent)
+                --depth;
+
+            // 可変長引数の部分ではカンマで区切らない
+            size_t count = bounds_.size() - bounds_start + 1;
+            if (t.tok.type == tkComma && depth == 0 && !(m.variadic && count > m.params.size()))
+                bounds_.push_back(scratch_.size() - start);
+            else
+                scratch_.push_back(t);
+        }
+        *close_hs = t.hs;
+
+        size_t count = bounds_.size() - bounds_start + 1;
+        const size_t expected = m.params.size() + (m.variadic ? 1 : 0);
+        bool empty_call = (count == 1 && scratch_.size() == start);
+        // 引数なしの呼び出し f() と、可変長引数の省略
+        bool ok = (count == expected) || (expected == 0 && empty_call) || (m.variadic && count == m.params.size());
+        if (!ok)
+        {
+            Error(name.tok, "macro \"" + name.tok.token + "\" passed " + std::to_string(count) +
+                                " arguments, but takes " + std::to_string(m.params.size()));
+            scratch_.resize(start);
+            bounds_.resize(bounds_start);
+            return false;
+        }
+
+        Range all = MoveToArena(start);
+        Range *ranges = arena_.AllocateArray<Range>(expected + 1);
+        const PPToken *p = all.begin;
+        for (size_t k = 0; k < expected; ++k)
+        {
+            const PPToken *q = (k + 1 < count) ? all.begin + bounds_[bounds_start + k] : all.end;
+            if (k >= count)
+                q = p; // 省略した可変長引数
+            ranges[k] = Range{p, q};
+            p = q;
+        }
+        bounds_.resize(bounds_start);
+        *args = ranges;
+        return true;
+    }
+
+    // 本体の仮引数を実引数で置き換え、# (文字列化) と ## (連結) を処理する
+    // 結果の各トークンのハイドセットに hs を加える
+    Range Substitute(const Macro &m, const PPToken &name, Range *args, const HideSet *hs)
+    {
+        const size_t nargs = m.params.size() + (m.variadic ? 1 : 0);
+        Range *expanded = arena_.AllocateArray<Range>(nargs);
+        for (size_t k = 0; k < nargs; ++k)
+            expanded[k] = Range{nullptr, nullptr};
+
+        const size_t start = scratch_.size();
+        bool placemarker = false; // 直前に ## の左辺となる空の実引数を置いた
+        const size_t n = m.body.size();
+        for (size_t k = 0; k < n; ++k)
+        {
+            const Token &t = m.body[k];
+            const int param = m.body_param[k];
+
+            if (t.type == tkHash && m.function_like)
+            {
+                // # param (定義時に仮引数が続くことを確認済み)
+                scratch_.push_back(PPToken{Stringize(args[m.body_param[++k]], name.tok), hs});
+                continue;
+            }
+
+            if (t.type == tkHashHash)
+            {
+                // 左辺は直前に出力したトークン、右辺は次のトークン (仮引数は展開しない実引数)
+                Range rhs = (m.body_param[++k] >= 0) ? args[m.body_param[k]] : Range{nullptr, nullptr};
+                PPToken body_rhs = {m.body[k], hs};
+                if (m.body_param[k] < 0)
+                    rhs = Range{&body_rhs, &body_rhs + 1};
+
+                if (rhs.begin == rhs.end)
+                    continue; // 右辺が空であれば左辺がそのまま残る
+                if (placemarker || scratch_.size() == start)
+                {
+                    placemarker = false;
+                    AppendWithHideSet(rhs, hs);
+                    continue;
+                }
+                PPToken &lhs = scratch_.back();
+                lhs.tok = Paste(lhs.tok, rhs.begin->tok, name.tok);
+                lhs.hs = hs;
+                AppendWithHideSet(Range{rhs.begin + 1, rhs.end}, hs);
+                continue;
+            }
+
+            placemarker = false;
+            if (param < 0)
+            {
+                scratch_.push_back(PPToken{t, hs});
+                continue;
+            }
+
+            // ## の左辺の実引数は展開しない
+            if (k + 1 < n && m.body[k + 1].type == tkHashHash)
+            {
+                AppendWithHideSet(args[param], hs);
+                placemarker = (args[param].begin == args[param].end);
+                continue;
+            }
+
+            // 実引数は 1 回だけ展開して使い回す
+            if (!expanded[param].begin)
+            {
+                Range e = ExpandRange(args[param]);
+                expanded[param] = e.begin ? e : Range{args[param].end, args[param].end};
+            }
+            AppendWithHideSet(expanded[param], hs);
+        }
+        return MoveToArena(start);
+    }
+
+    void AppendWithHideSet(Range r, const HideSet *hs)
+    {
+        for (const PPToken *p = r.begin; p != r.end; ++p)
+            scratch_.push_back(PPToken{p->tok, hide_sets_.Union(p->hs, hs)});
+    }
+
+    // 実引数の綴りを文字列リテラルにする
+    // 間に空白のあるトークンは 1 つの空白で区切り、文字列・文字定数の中の " と \ はエスケープする
+    Token Stringize(Range arg, const Token &at)
+    {
+        std::string &s = spelling_;
+        s.assign(1, '"');
+        for (const PPToken *p = arg.begin; p != arg.end; ++p)
+        {
+            const StringRef &text = p->tok.token;
+            if (p != arg.begin && (p - 1)->tok.token.data() + (p - 1)->tok.token.size() != text.data())
+                s += ' ';
+            bool quoted = (p->tok.type == tkString || p->tok.type == tkCharacter);
+            for (size_t i = 0; i < text.size(); ++i)
+            {
+                if (quoted && (text[i] == '"' || text[i] == '\\'))
+                    s += '\\';
+                s += text[i];
+            }
+        }
+        s += '"';
+
+        Token tok;
+        if (!Relex(s, at, &tok))
+            Error(at, "invalid string literal: " + s);
+        return tok;
+    }
+
+    // 2 つのトークンを連結して 1 つのトークンにする
+    Token Paste(const Token &lhs, const Token &rhs, const Token &at)
+    {
+        spelling_ = lhs.token.str() + rhs.token;
+        Token tok;
+        if (!Relex(spelling_, at, &tok))
+        {
+            Error(at, "pasting \"" + lhs.token + "\" and \"" + rhs.token + "\" does not give a valid preprocessing token");
+            return lhs;
+        }
+        return tok;
+    }
+
+    // 生成した綴りをアリーナに置いて字句解析する
+    //   false : 1 つのトークンにならなかった
+    bool Relex(const std::string &s, const Token &at, Token *tok)
+    {
+        char *p = arena_.AllocateArray<char>(s.size());
+        std::memcpy(p, s.data(), s.size());
+
+        Tokenizer tzr;
+        tzr.Init(p, s.size());
+        Token extra;
+        bool ok = tzr.Next(tok) && tok->token.size() == s.size() && !tzr.Next(&extra);
+        if (!ok)
+            *tok = Token{StringRef(p, s.size()), tkNull, at.pos, kNoSymbol, 0, {0}};
+        tok->pos = at.pos;
+        return ok;
+    }
+
+    // #if / #elif の条件式を評価する
+    bool EvalCondition(size_t b, size_t e)
+    {
+        static const char *kZero = "0";
+        static const char *kOne = "1";
+
+        const std::vector<Token> &tokens = file_->tokens;
+        const Token &directive = tokens[b - 1];
+
+        // defined X / defined(X) を展開前に 0 / 1 に置き換える
+        std::vector<Token> line;
+        for (size_t i = b; i < e; ++i)
+        {
+            if (tokens[i].type != tkWord || tokens[i].token != "defined")
+            {
+                line.push_back(tokens[i]);
+                continue;
+            }
+
+            bool paren = (i + 1 < e && tokens[i + 1].type == tkOpenParent);
+            size_t k = i + (paren ? 2 : 1);
+            if (k >= e || tokens[k].type != tkWord || (paren && (k + 1 >= e || tokens[k + 1].type != tkCloseParent)))
+            {
+                Error(tokens[i], "operator \"defined\" requires an identifier");
+                return false;
+            }
+            bool defined = IsDefined(tokens[k].symbol);
+            Token tok = {StringRef(defined ? kOne : kZero, 1), tkDecimal, tokens[i].pos, kNoSymbol, 0, {0}};
+            tok.value.integer = defined ? 1 : 0;
+            line.push_back(tok);
+            i = k + (paren ? 1 : 0);
+        }
+
+        std::vector<Token> expanded;
+        Expand(line.data(), line.data() + line.size(), &expanded);
+        if (expanded.empty())
+        {
+            Error(directive, "#" + directive.token + " with no expression");
+            return false;
+        }
+
+        const Token *p = expanded.data();
+        const Token *end = p + expanded.size();
+        bool ok = true;
+        unevaluated_ = 0;
+        int64_t value = EvalConditional(&p, end, &ok);
+        if (ok && p != end)
+        {
+            Error(*p, "missing binary operator before token \"" + p->token + "\"");
+            return false;
+        }
+        if (!ok)
+        {
+            Error(p != end ? *p : directive, "invalid expression in #" + directive.token);
+            return false;
+        }
+        return value != 0;
+    }
+
+    int64_t EvalConditional(const Token **p, const Token *end, bool *ok)
+    {
+        int64_t cond = EvalBinary(p, end, 1, ok);
+        if (!*ok || *p == end || (*p)->type != tkQuestion)
+            return cond;
+
+        ++*p;
+        unevaluated_ += !cond;
+        int64_t a = EvalConditional(p, end, ok);
+        unevaluated_ -= !cond;
+        if (!*ok || *p == end || (*p)->type != tkColon)
+        {
+            *ok = false;
+            return 0;
+        }
+        ++*p;
+        unevaluated_ += !!cond;
+        int64_t b = EvalConditional(p, end, ok);
+        unevaluated_ -= !!cond;
+        return cond ? a : b;
+    }
+
+    // 二項演算子の優先順位 (大きいほど強い). 二項演算子でなければ 0
+    static int BinaryPrecedence(TokenType type)
+    {
+        switch (type)
+        {
+        case tkAsterisk: case tkSlash: case tkPercent: return 10;
+        case tkPlus: case tkMinus: return 9;
+        case tkShiftLeft: case tkShiftRight: return 8;
+        case tkLess: case tkGreater: case tkLessEqual: case tkGreaterEqual: return 7;
+        case tkEqualEqual: case tkNotEqual: return 6;
+        case tkAmpersand: return 5;
+        case tkCaret: return 4;
+        case tkBar: return 3;
+        case tkLogicalAnd: return 2;
+        case tkLogicalOr: return 1;
+        default: return 0;
+        }
+    }
+
+    int64_t EvalBinary(const Token **p, const Token *end, int min_prec, bool *ok)
+    {
+        int64_t lhs = EvalUnary(p, end, ok);
+        while (*ok && *p != end)
+        {
+            const TokenType op = (*p)->type;
+            const int prec = BinaryPrecedence(op);
+            if (prec == 0 || prec < min_prec)
+                break;
+            ++*p;
+
+            // 短絡評価される側ではゼロ除算をエラーにしない
+            bool skip = (op == tkLogicalAnd && !lhs) || (op == tkLogicalOr && lhs);
+            unevaluated_ += skip;
+            int64_t rhs = EvalBinary(p, end, prec + 1, ok);
+            unevaluated_ -= skip;
+            if (!*ok)
+                break;
+
+            const uint64_t l = static_cast<uint64_t>(lhs), r = static_cast<uint64_t>(rhs);
+            switch (op)
+            {
+            case tkAsterisk: lhs = static_cast<int64_t>(l * r); break;
+            case tkSlash:
+            case tkPercent:
+                if (rhs == 0)
+                {
+                    if (!unevaluated_)
+                        *ok = false;
+                    lhs = 0;
+                }
+                else if (rhs == -1)
+                    lhs = (op == tkSlash) ? static_cast<int64_t>(0 - l) : 0;
+                else
+                    lhs = (op == tkSlash) ? lhs / rhs : lhs % rhs;
+                break;
+            case tkPlus: lhs = static_cast<int64_t>(l + r); break;
+            case tkMinus: lhs = static_cast<int64_t>(l - r); break;
+            case tkShiftLeft: lhs = static_cast<int64_t>(l << (r & 63)); break;
+            case tkShiftRight: lhs = lhs >> (r & 63); break;
+            case tkLess: lhs = lhs < rhs; break;
+            case tkGreater: lhs = lhs > rhs; break;
+            case tkLessEqual: lhs = lhs <= rhs; break;
+            case tkGreaterEqual: lhs = lhs >= rhs; break;
+            case tkEqualEqual: lhs = lhs == rhs; break;
+            case tkNotEqual: lhs = lhs != rhs; break;
+            case tkAmpersand: lhs = lhs & rhs; break;
+            case tkCaret: lhs = lhs ^ rhs; break;
+            case tkBar: lhs = lhs | rhs; break;
+            case tkLogicalAnd: lhs = lhs && rhs; break;
+            case tkLogicalOr: lhs = lhs || rhs; break;
+            default: break;
+            }
+        }
+        return lhs;
+    }
+
+    int64_t EvalUnary(const Token **p, const Token *end, bool *ok)
+    {
+        if (*p == end)
+        {
+            *ok = false;
+            return 0;
+        }
+
+        const Token &tok = **p;
+        ++*p;
+        switch (tok.type)
+        {
+        case tkPlus: return EvalUnary(p, end, ok);
+        case tkMinus: return static_cast<int64_t>(0 - static_cast<uint64_t>(EvalUnary(p, end, ok)));
+        case tkNot: return !EvalUnary(p, end, ok);
+        case tkTilde: return ~EvalUnary(p, end, ok);
+        case tkOpenParent:
+        {
+            int64_t v = EvalConditional(p, end, ok);
+            if (*ok && (*p == end || (*p)->type != tkCloseParent))
+                *ok = false;
+            else if (*ok)
+                ++*p;
+            return v;
+        }
+        case tkDecimal:
+        case tkHexDecimal:
+        case tkCharacter:
+            if (tok.number_flags & (nfInvalid | nfUnterminated))
+            {
+                --*p;
+                *ok = false;
+            }
+            return static_cast<int64_t>(tok.value.integer);
+        default:
+            // 展開後に残った識別子 (予約語を含む) は 0
+            if (tok.type == tkWord || tok.type >= tkAuto)
+                return 0;
+            --*p;
+            *ok = false;
+            return 0;
+        }
+    }
+
+    // [b, e) の元の綴り (診断メッセージ用)
+    std::string LineText(size_t b, size_t e) const
+    {
+        const std::vector<Token> &tokens = file_->tokens;
+        if (b == e)
+            return std::string();
+        const char *s = tokens[b].token.data();
+        const char *t = tokens[e - 1].token.data() + tokens[e - 1].token.size();
+        return " " + std::string(s, t);
+    }
+
+    // ファイル名:行:桁
+    std::string Location(const Token &tok) const
+    {
+        std::string loc = file_ ? file_->path : std::string();
+        if (file_ && tok.token.data() >= file_->src && tok.token.data() < file_->src + file_->size)
+            loc += ":" + std::to_string(file_->lines.Line(tok.pos)) + ":" + std::to_string(file_->lines.Column(tok.pos));
+        return loc;
+    }
+
+    void Error(const Token &tok, const std::string &message)
+    {
+        std::cerr << Location(tok) << ": error: " << message << std::endl;
+        ++errors_;
+    }
+
+    HeaderCache &cache_;
+    std::vector<std::string> include_paths_;
+
+    // シンボル ID で引くマクロ表 (未定義は nullptr)
+    std::vector<std::unique_ptr<Macro>> macros_;
+
+    // マクロを取り出す PCH と、PCH を引き終えた名前 (シンボル ID で引く)
+    const PrecompiledHeader *pch_;
+    std::vector<bool> pch_checked_;
+
+    // 展開に使う領域. scratch_ と bounds_ は入れ子の展開でスタックとして使い回す
+    Arena arena_;
+    HideSetTable hide_sets_;
+    std::vector<Frame> frames_;
+    std::vector<PPToken> scratch_;
+    std::vector<size_t> bounds_; // 実引数の区切り (scratch_ 中の位置)
+    std::string spelling_;       // # と ## で作る綴り
+
+    const SourceFile *file_;        // 処理中のファイル
+    std::set<const SourceFile *> once_; // #pragma once を処理したファイル
+    std::vector<std::shared_ptr<const SourceFile>> included_;
+    int include_depth_;
+
+    std::vector<Conditional> conds_;
+    size_t cond_base_; // 処理中のファイルの conds_ の開始位置
+    int unevaluated_;  // 短絡評価で評価されない部分式の深さ
+    size_t errors_;
+};
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef SCAN_HH
+#define SCAN_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if !defined(KCC_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define KCC_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace kcc
+{
+
+// 字句解析用の高速スキャンカーネル
+// 空白の連続と "*/" の検索、行頭位置の列挙を SSE2 / AVX2 で 16 / 32 byte ずつ処理する.
+// 改行は LF, CR, CR+LF をそれぞれ 1 つと数える.
+// AVX2 は実行時に CPU が対応している場合のみ使用する.
+namespace scan
+{
+
+// SP, HT, LF, VT, FF, CR
+static inline bool IsBlank(char c)
+{
+    return c == ' ' || ('\t' <= c && c <= '\r');
+}
+
+static inline bool IsNewline(const char *p, const char *end)
+{
+    return *p == '\n' || (*p == '\r' && (p + 1 == end || p[1] != '\n'));
+}
+
+// ---------------------------------------------------------------- scalar
+static inline const char *SkipBlanksScalar(const char *p, const char *end)
+{
+    while (p != end && IsBlank(*p))
+        ++p;
+    return p;
+}
+
+// "*/" の先頭位置を返す. 見つからなければ end を返す
+static inline const char *FindCommentEndScalar(const char *p, const char *end)
+{
+    while (p != end)
+    {
+        if (*p == '*' && p + 1 != end && p[1] == '/')
+            break;
+        ++p;
+    }
+    return p;
+}
+
+// [begin, end) の改行の直後の位置 (begin からのオフセット) を line_starts に追加する
+static inline void CollectLineStartsScalar(const char *begin, const char *end, std::vector<uint32_t> *line_starts)
+{
+    for (const char *p = begin; p != end; ++p)
+    {
+        if (IsNewline(p, end))
+            line_starts->push_back(static_cast<uint32_t>(p + 1 - begin));
+    }
+}
+
+#ifdef KCC_SCAN_X86
+
+// 改行の位置のビットマスク (LF と、直後が LF でない CR)
+#define KCC_SCAN_NEWLINE_MASK(movemask, cmpeq, v, v1, lf, cr) \
+    (static_cast<unsigned int>(movemask(cmpeq(v, lf))) |       \
+     (static_cast<unsigned int>(movemask(cmpeq(v, cr))) & ~static_cast<unsigned int>(movemask(cmpeq(v1, lf)))))
+
+// ---------------------------------------------------------------- SSE2
+static inline const char *SkipBlanksSSE2(const char *p, const char *end)
+{
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i lo = _mm_set1_epi8('\t' - 1);
+    const __m128i hi = _mm_set1_epi8('\r' + 1);
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                                     _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+        unsigned int other = ~_mm_movemask_epi8(blank) & 0xffffu;
+        if (other)
+            return p + __builtin_ctz(other);
+        p += 16;
+    }
+    return SkipBlanksScalar(p, end);
+}
+
+// "*/" の判定のため 1 byte 先まで読むので、残りが 17 byte 以上の間だけ処理する
+static inline const char *FindCommentEndSSE2(const char *p, const char *end)
+{
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/');
+
+    while (end - p >= 17)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+        unsigned int m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v, star), _mm_cmpeq_epi8(v1, slash)));
+        if (m)
+            return p + __builtin_ctz(m);
+        p += 16;
+    }
+    return FindCommentEndScalar(p, end);
+}
+
+static inline void CollectLineStartsSSE2(const char *begin, const char *end, std::vector<uint32_t> *line_starts)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    const char *p = begin;
+    while (end - p >= 17)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+        unsigned int nl = KCC_SCAN_NEWLINE_MASK(_mm_movemask_epi8, _mm_cmpeq_epi8, v, v1, lf, cr);
+        for (; nl; nl &= nl - 1)
+            line_starts->push_back(static_cast<uint32_t>(p - begin + __builtin_ctz(nl) + 1));
+        p += 16;
+    }
+
+    size_t base = line_starts->size();
+    CollectLineStartsScalar(p, end, line_starts);
+    for (size_t i = base; i < line_starts->size(); ++i)
+        (*line_starts)[i] += static_cast<uint32_t>(p - begin);
+}
+
+// ---------------------------------------------------------------- AVX2
+__attribute__((target("avx2"))) static inline const char *SkipBlanksAVX2(const char *p, const char *end)
+{
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i lo = _mm256_set1_epi8('\t' - 1);
+    const __m256i hi = _mm256_set1_epi8('\r' + 1);
+
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                                        _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v)));
+        unsigned int other = ~static_cast<unsigned int>(_mm256_movemask_epi8(blank));
+        if (other)
+            return p + __builtin_ctz(other);
+        p += 32;
+    }
+    return SkipBlanksSSE2(p, end);
+}
+
+__attribute__((target("avx2"))) static inline const char *FindCommentEndAVX2(const char *p, const char *end)
+{
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i slash = _mm256_set1_epi8('/');
+
+    while (end - p >= 33)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+        unsigned int m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v, star), _mm256_cmpeq_epi8(v1, slash)));
+        if (m)
+            return p + __builtin_ctz(m);
+        p += 32;
+    }
+    return FindCommentEndSSE2(p, end);
+}
+
+__attribute__((target("avx2"))) static inline void CollectLineStartsAVX2(const char *begin, const char *end, std::vector<uint32_t> *line_starts)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    const char *p = begin;
+    while (end - p >= 33)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+        unsigned int nl = KCC_SCAN_NEWLINE_MASK(_mm256_movemask_epi8, _mm256_cmpeq_epi8, v, v1, lf, cr);
+        for (; nl; nl &= nl - 1)
+            line_starts->push_back(static_cast<uint32_t>(p - begin + __builtin_ctz(nl) + 1));
+        p += 32;
+    }
+
+    size_t base = line_starts->size();
+    CollectLineStartsSSE2(p, end, line_starts);
+    for (size_t i = base; i < line_starts->size(); ++i)
+        (*line_starts)[i] += static_cast<uint32_t>(p - begin);
+}
+
+#undef KCC_SCAN_NEWLINE_MASK
+
+#endif // KCC_SCAN_X86
+
+// ---------------------------------------------------------------- dispatch
+typedef const char *(*ScanFunc)(const char *p, const char *end);
+typedef void (*LineScanFunc)(const char *begin, const char *end, std::vector<uint32_t> *line_starts);
+
+struct ScanKernels
+{
+    const char *name;
+    ScanFunc skip_blanks;
+    ScanFunc find_comment_end;
+    LineScanFunc collect_line_starts;
+};
+
+static inline ScanKernels SelectKernels()
+{
+#ifdef KCC_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return {"avx2", SkipBlanksAVX2, FindCommentEndAVX2, CollectLineStartsAVX2};
+    return {"sse2", SkipBlanksSSE2, FindCommentEndSSE2, CollectLineStartsSSE2};
+#else
+    return {"scalar", SkipBlanksScalar, FindCommentEndScalar, CollectLineStartsScalar};
+#endif
+}
+
+static const ScanKernels kKernels = SelectKernels();
+
+} // namespace scan
+} // namespace kcc
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef SCOPE_HH
+#define SCOPE_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "symbol.hh"
+
+namespace kcc
+{
+
+// 字句スコープのスタック
+// 名前 (シンボル ID) から、見えている中で一番内側の束縛を引くオープンアドレスのハッシュ表を 1 つだけ持つ.
+// 内側のスコープで同じ名前を宣言すると、外側の束縛は新しい束縛の shadowed につないで隠す.
+// Pop はそのスコープの束縛を逆順に外して隠していた束縛に戻すだけで、表を作り直さない.
+//
+// 束縛は宣言順に並ぶので、ファイルスコープの宣言は宣言順の番号 (Count) で区切って一部だけを見せられる.
+//
+// 値へのポインタは次の Declare まで有効.
+template <typename T>
+class ScopeStack
+{
+  public:
+    ScopeStack() : slots_(kInitialSlots), mask_(kInitialSlots - 1), used_(0) {}
+
+    // 内側のスコープに入る. label はスコープ名 (関数名など)
+    void Push(SymbolID label = kNoSymbol)
+    {
+        scopes_.push_back(Scope{static_cast<uint32_t>(bindings_.size()), label});
+    }
+
+    // 内側のスコープを抜ける. ファイルスコープでは何もしない
+    void Pop()
+    {
+        if (scopes_.empty())
+            return;
+
+        const uint32_t begin = scopes_.back().begin;
+        while (bindings_.size() > begin)
+        {
+            const Binding &b = bindings_.back();
+            slots_[FindSlot(b.name)].binding = b.shadowed;
+            bindings_.pop_back();
+        }
+        scopes_.pop_back();
+    }
+
+    // スコープの深さ (ファイルスコープが 0)
+    size_t Depth() const { return scopes_.size(); }
+
+    // 外側から depth 番目 (1 から) のスコープ名
+    SymbolID Label(size_t depth) const { return scopes_[depth - 1].label; }
+
+    // 現在のスコープに name を宣言する
+    //   true  : 成功
+    //   false : 現在のスコープで宣言済み
+    bool Declare(SymbolID name, const T &value)
+    {
+        if (LookupCurrent(name))
+            return false;
+
+        if ((used_ + 1) * 2 > slots_.size())
+            Grow();
+
+        Slot &slot = slots_[FindSlot(name)];
+        if (slot.name == kNoSymbol)
+        {
+            slot.name = name;
+            slot.binding = kNone;
+            ++used_;
+        }
+        bindings_.push_back(Binding{name, static_cast<uint32_t>(Depth()), slot.binding, value});
+        slot.binding = static_cast<uint32_t>(bindings_.size() - 1);
+        return true;
+    }
+
+    // 見えている中で一番内側の束縛. なければ nullptr
+    T *Lookup(SymbolID name)
+    {
+        const Slot &slot = slots_[FindSlot(name)];
+        return (slot.name == kNoSymbol || slot.binding == kNone) ? nullptr : &bindings_[slot.binding].value;
+    }
+
+    const T *Lookup(SymbolID name) const
+    {
+        return const_cast<ScopeStack *>(this)->Lookup(name);
+    }
+
+    // Lookup と同じだが、ファイルスコープの束縛は先頭から visible 個 (宣言した時の Count() より前) だけを見る.
+    // 後から宣言したファイルスコープの束縛はないものとして扱い、それが隠した束縛を返す
+    const T *LookupVisible(SymbolID name, size_t visible) const
+    {
+        const Slot &slot = slots_[FindSlot(name)];
+        if (slot.name == kNoSymbol)
+            return nullptr;
+        for (uint32_t b = slot.binding; b != kNone; b = bindings_[b].shadowed)
+        {
+            if (bindings_[b].depth != 0 || b < visible)
+                return &bindings_[b].value;
+        }
+        return nullptr;
+    }
+
+    // 宣言した束縛の数 (抜けたスコープの束縛は数えない)
+    size_t Count() const { return bindings_.size(); }
+
+    // 現在のスコープで宣言した束縛. なければ nullptr
+    T *LookupCurrent(SymbolID name)
+    {
+        const Slot &slot = slots_[FindSlot(name)];
+        if (slot.name == kNoSymbol || slot.binding == kNone || bindings_[slot.binding].depth != Depth())
+            return nullptr;
+        return &bindings_[slot.binding].value;
+    }
+
+    // depth のスコープで宣言した束縛を宣言順に f(name, value) で列挙する
+    template <typename F>
+    void ForEach(size_t depth, F f) const
+    {
+        for (auto &b : bindings_)
+        {
+            if (b.depth == depth)
+                f(b.name, b.value);
+        }
+    }
+
+  private:
+    static const size_t kInitialSlots = 64;
+    static const uint32_t kNone = 0xffffffffu;
+
+    struct Slot
+    {
+        SymbolID name;    // kNoSymbol なら空き
+        uint32_t binding; // 一番内側の束縛 (bindings_ の位置). 見えている束縛がなければ kNone
+    };
+
+    struct Binding
+    {
+        SymbolID name;
+        uint32_t depth;
+        uint32_t shadowed; // 隠した外側の束縛. なければ kNone
+        T value;
+    };
+
+    struct Scope
+    {
+        uint32_t begin; // このスコープの最初の束縛
+        SymbolID label;
+    };
+
+    // name のスロット、なければ name を置く空きスロットの位置
+    size_t FindSlot(SymbolID name) const
+    {
+        // シンボル ID は連番なので乗算で散らす
+        size_t i = (static_cast<uint32_t>(name) * 2654435761u) & mask_;
+        while (slots_[i].name != kNoSymbol && slots_[i].name != name)
+            i = (i + 1) & mask_;
+        return i;
+    }
+
+    // 一度置いた名前はスロットから消さない (束縛がなくなっても kNone で残す)
+    void Grow()
+    {
+        std::vector<Slot> old(slots_.size() * 2);
+        old.swap(slots_);
+        mask_ = slots_.size() - 1;
+        for (auto &slot : old)
+        {
+            if (slot.name != kNoSymbol)
+                slots_[FindSlot(slot.name)] = slot;
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    size_t used_;
+    std::vector<Binding> bindings_;
+    std::vector<Scope> scopes_;
+};
+
+} // namespace kcc
+
+#endif
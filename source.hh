@@ -0,0 +1,227 @@
+#ifndef SOURCE_HH
+#define SOURCE_HH
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace kcc
+{
+
+// p から始まる改行 ("\n", "\r", "\r\n") の長さ. 改行でなければ 0
+inline size_t NewlineLength(const char *p, const char *end)
+{
+    if (p == end)
+        return 0;
+    if (*p == '\n')
+        return 1;
+    if (*p == '\r')
+        return (p + 1 != end && p[1] == '\n') ? 2 : 1;
+    return 0;
+}
+
+// 最初の行の継続 (\ + 改行) の位置. なければ nullptr
+inline const char *FindLineSplice(const char *p, const char *end)
+{
+    while (p != end)
+    {
+        p = static_cast<const char *>(std::memchr(p, '\\', end - p));
+        if (!p)
+            return nullptr;
+        if (NewlineLength(p + 1, end))
+            return p;
+        ++p;
+    }
+    return nullptr;
+}
+
+// 翻訳フェーズ 2: 行の継続 (\ + 改行) を取り除いて論理行をつなげ、out に書き出す
+// 取り除いた \ は空白に、改行は論理行の末尾の改行の後ろに移すので、
+// バッファの長さ・行数と、論理行より後ろの位置は変わらない
+template <class Buffer> void SpliceLines(const char *src, size_t size, Buffer *out)
+{
+    const char *p = src;
+    const char *end = src + size;
+    out->clear();
+    out->reserve(size);
+
+    size_t spaces = 0;
+    std::string newlines; // 論理行の末尾に移す改行
+    while (p != end)
+    {
+        const char *splice = FindLineSplice(p, end);
+        const char *stop = splice ? splice : end;
+
+        // 継続を取り除いた論理行の末尾で、取り除いた分を補う
+        while (spaces > 0 && p != stop)
+        {
+            const char *nl = p;
+            while (nl != stop && !NewlineLength(nl, end))
+                ++nl;
+            if (nl == stop)
+                break;
+            size_t len = NewlineLength(nl, end);
+            out->insert(out->end(), p, nl);
+            out->insert(out->end(), spaces, ' ');
+            out->insert(out->end(), nl, nl + len);
+            out->insert(out->end(), newlines.begin(), newlines.end());
+            spaces = 0;
+            newlines.clear();
+            p = nl + len;
+        }
+
+        out->insert(out->end(), p, stop);
+        if (!splice)
+            break;
+
+        size_t len = NewlineLength(splice + 1, end);
+        ++spaces;
+        newlines.append(splice + 1, len);
+        p = splice + 1 + len;
+    }
+
+    // 継続で終わるファイル
+    out->insert(out->end(), spaces, ' ');
+    out->insert(out->end(), newlines.begin(), newlines.end());
+}
+
+// ソースコードの入力バッファ
+// 通常ファイルは読み取り専用で mmap し、コピーせずにそのまま字句解析へ渡す.
+// パイプや標準入力 ("-") など mmap できない入力は read してバッファに保持する.
+// 行の継続 (\ + 改行) を含む入力は、継続をつなげたものをバッファに保持する.
+class SourceBuffer
+{
+  public:
+    SourceBuffer() : data_(nullptr), size_(0), mapped_(false) {}
+    ~SourceBuffer() { Close(); }
+
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    // 入力を開く
+    //   true  : 成功
+    //   false : 失敗
+    bool Open(const std::string &path)
+    {
+        Close();
+        if (!Load(path))
+        {
+            return false;
+        }
+
+        if (FindLineSplice(data_, data_ + size_))
+        {
+            std::vector<char> spliced;
+            SpliceLines(data_, size_, &spliced);
+            Close();
+            fallback_.swap(spliced);
+            data_ = fallback_.data();
+            size_ = fallback_.size();
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifndef _WIN32
+        if (mapped_)
+        {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+#endif
+        std::vector<char>().swap(fallback_);
+        data_ = nullptr;
+        size_ = 0;
+        mapped_ = false;
+    }
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool IsMapped() const { return mapped_; }
+
+  private:
+    // path を mmap するか読み込む
+    bool Load(const std::string &path)
+    {
+        if (path == "-")
+        {
+            return ReadStream(stdin);
+        }
+
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+                ::close(fd);
+                data_ = static_cast<const char *>(p);
+                size_ = st.st_size;
+                mapped_ = true;
+                return true;
+            }
+        }
+
+        // mmap できない入力 (FIFO, 空ファイル等) は読み込む
+        FILE *fp = ::fdopen(fd, "rb");
+        if (!fp)
+        {
+            ::close(fd);
+            return false;
+        }
+#else
+        FILE *fp = std::fopen(path.c_str(), "rb");
+        if (!fp)
+        {
+            return false;
+        }
+#endif
+        bool ok = ReadStream(fp);
+        std::fclose(fp);
+        return ok;
+    }
+
+    bool ReadStream(FILE *fp)
+    {
+        char chunk[64 * 1024];
+        size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        {
+            fallback_.insert(fallback_.end(), chunk, chunk + n);
+        }
+
+        if (std::ferror(fp))
+        {
+            return false;
+        }
+
+        data_ = fallback_.data();
+        size_ = fallback_.size();
+        return true;
+    }
+
+    const char *data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> fallback_;
+};
+
+} // namespace kcc
+
+#endif
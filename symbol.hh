@@ -0,0 +1,220 @@
+#ifndef SYMBOL_HH
+#define SYMBOL_HH
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kcc
+{
+
+// 識別子のシンボル ID
+// 同じ綴りの識別子には常に同じ ID が割り当てられるので、文字列の代わりに比較・検索のキーに使える.
+typedef uint32_t SymbolID;
+
+// 識別子ではないことを表す ID
+static const SymbolID kNoSymbol = 0;
+
+// 識別子の文字列を 1 つだけ保持し、連番のシンボル ID を割り当てるテーブル (オープンアドレス法)
+// 複数のスレッドから使ってよい. 新しい綴りの登録はミューテックスで直列化し、
+// 登録済みの綴りの検索と Name はロックしない (スロットは 1 語で書き換え、綴りと古い表は解放しない).
+// ID は登録順に決まるので、ParallelTokenizer はワーカーでは登録せず、連結時に順に登録する.
+class SymbolTable
+{
+  public:
+    SymbolTable() : table_(nullptr), count_(0)
+    {
+        for (auto &chunk : chunks_)
+            chunk.store(nullptr, std::memory_order_relaxed);
+        tables_.emplace_back(new Table(kInitialSlots));
+        table_.store(tables_.back().get(), std::memory_order_release);
+
+        // ID 0 は kNoSymbol
+        Append(std::string());
+    }
+
+    ~SymbolTable()
+    {
+        for (auto &chunk : chunks_)
+            delete[] chunk.load(std::memory_order_relaxed);
+    }
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    // 登録してシンボル ID を返す. 登録済みであれば既存の ID を返す
+    SymbolID Intern(const char *s, size_t n)
+    {
+        const uint32_t hash = Hash(s, n);
+        const SymbolID id = Probe(*table_.load(std::memory_order_acquire), hash, s, n);
+        return (id != kNoSymbol) ? id : Insert(hash, s, n);
+    }
+
+    SymbolID Intern(const std::string &s) { return Intern(s.data(), s.size()); }
+
+    // 登録済みのシンボル ID. 未登録であれば kNoSymbol
+    SymbolID Find(const char *s, size_t n) const
+    {
+        return Probe(*table_.load(std::memory_order_acquire), Hash(s, n), s, n);
+    }
+
+    SymbolID Find(const std::string &s) const { return Find(s.data(), s.size()); }
+
+    // シンボルの綴り. 参照はテーブルが破棄されるまで有効
+    const std::string &Name(SymbolID id) const
+    {
+        size_t chunk, offset;
+        Locate(id, &chunk, &offset);
+        return chunks_[chunk].load(std::memory_order_acquire)[offset];
+    }
+
+    // 登録されているシンボル数 (kNoSymbol を除く)
+    size_t size() const { return count_.load(std::memory_order_acquire) - 1; }
+
+    // FNV-1a. h に前回の値を渡すと続けてハッシュする
+    static uint32_t Hash(const char *s, size_t n, uint32_t h = 2166136261u)
+    {
+        for (size_t i = 0; i < n; ++i)
+            h = (h ^ static_cast<unsigned char>(s[i])) * 16777619u;
+        return h;
+    }
+
+  private:
+    static const size_t kInitialSlots = 1024;
+
+    // 綴りはチャンクに置く. チャンク k の要素数は kFirstChunk << k で、要素は移動しない
+    static const size_t kFirstChunkBits = 10;
+    static const size_t kFirstChunk = size_t(1) << kFirstChunkBits;
+    static const size_t kChunks = 23; // SymbolID の全範囲 (2^32) を覆う
+
+    // スロットは (ハッシュ値 << 32) | ID. ID が kNoSymbol であれば空き
+    struct Table
+    {
+        explicit Table(size_t n) : slots(new std::atomic<uint64_t>[n]), mask(n - 1)
+        {
+            for (size_t i = 0; i < n; ++i)
+                slots[i].store(0, std::memory_order_relaxed);
+        }
+
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+        size_t mask;
+    };
+
+    static SymbolID SlotID(uint64_t slot) { return static_cast<SymbolID>(slot); }
+    static uint32_t SlotHash(uint64_t slot) { return static_cast<uint32_t>(slot >> 32); }
+
+    SymbolID Probe(const Table &table, uint32_t hash, const char *s, size_t n) const
+    {
+        for (size_t i = hash & table.mask;; i = (i + 1) & table.mask)
+        {
+            const uint64_t slot = table.slots[i].load(std::memory_order_acquire);
+            if (SlotID(slot) == kNoSymbol)
+                return kNoSymbol;
+            if (SlotHash(slot) == hash && Equals(SlotID(slot), s, n))
+                return SlotID(slot);
+        }
+    }
+
+    // 未登録の綴りを登録する
+    // 他のスレッドが先に同じ綴りを登録しているかもしれないので、ロックしてから探し直す
+    SymbolID Insert(uint32_t hash, const char *s, size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Table &table = *table_.load(std::memory_order_relaxed);
+        size_t i = hash & table.mask;
+        for (;; i = (i + 1) & table.mask)
+        {
+            const uint64_t slot = table.slots[i].load(std::memory_order_relaxed);
+            if (SlotID(slot) == kNoSymbol)
+                break;
+            if (SlotHash(slot) == hash && Equals(SlotID(slot), s, n))
+                return SlotID(slot);
+        }
+
+        const SymbolID id = Append(std::string(s, n));
+        table.slots[i].store((static_cast<uint64_t>(hash) << 32) | id, std::memory_order_release);
+
+        // 充填率を 1/2 以下に保つ
+        if (static_cast<size_t>(id + 1) * 2 > table.mask + 1)
+            Grow(table);
+        return id;
+    }
+
+    bool Equals(SymbolID id, const char *s, size_t n) const
+    {
+        const std::string &name = Name(id);
+        return name.size() == n && std::memcmp(name.data(), s, n) == 0;
+    }
+
+    // ID の綴りが置かれるチャンクとその中の位置
+    static void Locate(SymbolID id, size_t *chunk, size_t *offset)
+    {
+        const uint64_t i = static_cast<uint64_t>(id) + kFirstChunk;
+#if defined(__GNUC__)
+        const size_t k = (63 - __builtin_clzll(i)) - kFirstChunkBits;
+#else
+        size_t k = 0;
+        while ((static_cast<uint64_t>(kFirstChunk) << (k + 1)) <= i)
+            ++k;
+#endif
+        *chunk = k;
+        *offset = static_cast<size_t>(i - (static_cast<uint64_t>(kFirstChunk) << k));
+    }
+
+    // 次の ID に綴りを置く (mutex_ をロックして呼ぶ)
+    SymbolID Append(std::string name)
+    {
+        const SymbolID id = static_cast<SymbolID>(count_.load(std::memory_order_relaxed));
+        size_t chunk, offset;
+        Locate(id, &chunk, &offset);
+        std::string *names = chunks_[chunk].load(std::memory_order_relaxed);
+        if (!names)
+        {
+            names = new std::string[kFirstChunk << chunk];
+            chunks_[chunk].store(names, std::memory_order_release);
+        }
+        names[offset].swap(name);
+        count_.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    // 2 倍の大きさの表に移す (mutex_ をロックして呼ぶ)
+    // 古い表を読んでいるスレッドがあるので、古い表は解放しない
+    void Grow(const Table &old)
+    {
+        tables_.emplace_back(new Table((old.mask + 1) * 2));
+        Table &table = *tables_.back();
+        for (size_t j = 0; j <= old.mask; ++j)
+        {
+            const uint64_t slot = old.slots[j].load(std::memory_order_relaxed);
+            if (SlotID(slot) == kNoSymbol)
+                continue;
+            size_t i = SlotHash(slot) & table.mask;
+            while (SlotID(table.slots[i].load(std::memory_order_relaxed)) != kNoSymbol)
+                i = (i + 1) & table.mask;
+            table.slots[i].store(slot, std::memory_order_relaxed);
+        }
+        table_.store(&table, std::memory_order_release);
+    }
+
+    std::atomic<Table *> table_;
+    std::vector<std::unique_ptr<Table>> tables_;
+    std::atomic<std::string *> chunks_[kChunks];
+    std::atomic<size_t> count_;
+    std::mutex mutex_;
+};
+
+// 字句解析器と構文解析器で共有するシンボルテーブル
+inline SymbolTable &GlobalSymbols()
+{
+    static SymbolTable table;
+    return table;
+}
+
+} // namespace kcc
+
+#endif
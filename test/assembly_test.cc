@@ -20,6 +20,12 @@ class Assemble_Assembly_Test
     {
         Assemble_BasicTest();
         Assemble_Var_Test();
+        Parse_Expr_Test();
+        Parse_Long_Expr_Test();
+        Parse_Unterminated_Literal_Test();
+        Parse_Stray_Test();
+        Parse_Parallel_Test();
+        Parse_Lazy_Body_Test();
     }
 
     void Assemble_BasicTest()
@@ -44,8 +50,7 @@ _main:
 
         std::shared_ptr<CompilerState> c(new CompilerState);
         Parser p(c);
-        c->buf = tokens;
-        c->iter = std::begin(c->buf);
+        c->tokens.Assign(tokens);
         c->module_name = "Assemble_BasicTest";
         auto ast = p.SyntaxCheck();
 
@@ -62,14 +67,15 @@ _main:
         auto inp = PrepareInput("int main() { int a; a = 1; return a; }");
 
         // output following assembly
-        auto answer = R"(".intel_syntax noprefix
+        auto answer = R"(.intel_syntax noprefix
 .globl _main
 _main:
-    push    rbp
-    mov     rbp, rsp
-    mov     QWORD PTR [rbp-8], 1
-    mov     rax, QWORD PTR [rbp-8]
-    pop     rbp
+    push rbp
+    mov rbp,rsp
+    mov QWORD PTR[rbp-8],1
+    mov rax,QWORD PTR[rbp-8]
+    mov rsp,rbp
+    pop rbp
     ret
 )";
 
@@ -79,8 +85,7 @@ _main:
 
         std::shared_ptr<CompilerState> c(new CompilerState);
         Parser p(c);
-        c->buf = tokens;
-        c->iter = std::begin(c->buf);
+        c->tokens.Assign(tokens);
         c->module_name = "Assemble_Var_Test";
         auto ast = p.SyntaxCheck();
 
@@ -92,6 +97,285 @@ _main:
         TEST_EQUAL(answer, assembly);
     }
 
+    void Parse_Expr_Test()
+    {
+        auto inp = PrepareInput("int main() { int a; a += (1 + 2) * -3; return a > 0 ? a - 1 - 2 : 0, a; }");
+
+        std::vector<kcc::Token> tokens;
+        Tokenizer t;
+        t.Tokenize(inp, &tokens);
+
+        std::shared_ptr<CompilerState> c(new CompilerState);
+        Parser p(c);
+        c->tokens.Assign(tokens);
+        c->module_name = "Parse_Expr_Test";
+        auto ast = p.SyntaxCheck();
+        TEST(ast != nullptr);
+        if (!ast)
+        {
+            return;
+        }
+
+        auto f = static_cast<Function *>(ast->decl[0]);
+        TEST_EQUAL(f->stmts.size(), 3);
+
+        // a += ((1 + 2) * (-3))
+        auto stmt = static_cast<ExprStmt *>(f->stmts[1]);
+        TEST_EQUAL(stmt->expr->node_type, kAssignmentExpr);
+        auto assign = static_cast<AssignmentExpr *>(stmt->expr);
+        TEST_EQUAL(assign->op_type, kPlus);
+        TEST(assign->destination != nullptr);
+        TEST_EQUAL(assign->destination->decl->Address(), 8);
+        auto mul = static_cast<BinaryExpr *>(assign->expr);
+        TEST_EQUAL(mul->op_type, kMul);
+        TEST_EQUAL(static_cast<BinaryExpr *>(mul->first)->op_type, kPlus);
+        TEST_EQUAL(static_cast<UnaryExpr *>(mul->second)->op_type, kNegate);
+
+        // ((a > 0) ? ((a - 1) - 2) : 0), a
+        auto ret = static_cast<ReturnStmt *>(f->stmts[2]);
+        auto comma = static_cast<BinaryExpr *>(ret->return_expr);
+        TEST_EQUAL(comma->op_type, kComma);
+        TEST_EQUAL(comma->first->node_type, kConditionalExpr);
+        auto cond = static_cast<ConditionalExpr *>(comma->first);
+        TEST_EQUAL(static_cast<BinaryExpr *>(cond->condition)->op_type, kGreater);
+        auto sub = static_cast<BinaryExpr *>(cond->first);
+        TEST_EQUAL(sub->op_type, kMinus);
+        TEST_EQUAL(static_cast<BinaryExpr *>(sub->first)->op_type, kMinus);
+        TEST_EQUAL(cond->second->node_type, kPrimaryExpr);
+    }
+
+    void Parse_Long_Expr_Test()
+    {
+        // 項の多い式は深い木になる. 平坦化とコード生成で再帰しないこと
+        const int kTerms = 100000;
+        std::string src = "int main() { return 1";
+        for (int i = 1; i < kTerms; ++i)
+        {
+            src += "+1";
+        }
+        src += "; }";
+        auto inp = PrepareInput(src.c_str());
+
+        std::vector<kcc::Token> tokens;
+        Tokenizer t;
+        t.Tokenize(inp, &tokens);
+
+        std::shared_ptr<CompilerState> c(new CompilerState);
+        Parser p(c);
+        c->tokens.Assign(tokens);
+        c->module_name = "Parse_Long_Expr_Test";
+        auto ast = p.SyntaxCheck();
+        TEST(ast != nullptr);
+        if (!ast)
+        {
+            return;
+        }
+
+        // 翻訳単位・関数・return 文・二項演算式 (kTerms - 1 個)・一次式とリテラル (kTerms 個ずつ)
+        FlatAST flat;
+        FlattenAST(ast, &flat);
+        TEST_EQUAL(flat.size(), 3 + (kTerms - 1) + 2 * kTerms);
+        TEST_EQUAL(flat[flat.Root()].type, kProgram);
+
+        std::string assembly;
+        p.GenerateAssembly(ast, &assembly);
+        TEST(assembly.find("_main:") != std::string::npos);
+    }
+
+    void Parse_Unterminated_Literal_Test()
+    {
+        // 行末の引用符がエスケープされた文字列は閉じていない
+        auto inp = PrepareInput("int main() { return \"abc\\\"; }");
+        std::vector<kcc::Token> tokens;
+        Tokenizer t;
+        t.Tokenize(inp, &tokens);
+
+        std::string assembly;
+        auto c = ParseTokens(tokens, nullptr, &assembly);
+        TEST(assembly.empty());
+        TEST(!c->errors.empty());
+        TEST_EQUAL(c->errors.empty() ? std::string() : c->errors[0].message,
+                   "The end of '\"' is not found : \"abc\\\"; }");
+    }
+
+    void Parse_Stray_Test()
+    {
+        // どのトークンにもならない文字はエラーになる
+        auto inp = PrepareInput("int main() { @ return 2; }");
+        std::vector<kcc::Token> tokens;
+        Tokenizer t;
+        t.Tokenize(inp, &tokens);
+
+        std::string assembly;
+        auto c = ParseTokens(tokens, nullptr, &assembly);
+        TEST(assembly.empty());
+        TEST_EQUAL(c->errors.size(), 1);
+        TEST_EQUAL(c->errors.empty() ? std::string() : c->errors[0].message, "stray '@' in program");
+
+        tokens.clear();
+        inp = PrepareInput("int main() { return \\ 2; }");
+        t.Tokenize(inp, &tokens);
+        c = ParseTokens(tokens, nullptr, &assembly);
+        TEST(assembly.empty());
+        TEST_EQUAL(c->errors.empty() ? std::string() : c->errors[0].message, "stray '\\' in program");
+    }
+
+    void Parse_Parallel_Test()
+    {
+        // 並列の構文解析は逐次と同じ AST・エラーになる
+        std::string functions;
+        for (int i = 0; i < 100; ++i)
+        {
+            functions += "int f" + std::to_string(i) + "() { int a; a = " + std::to_string(i) + "; return a * 2 + 1; }\n";
+        }
+
+        ThreadPool pool(4);
+        std::string sequential;
+        std::string parallel;
+
+        // 前のバッチの関数を参照する
+        auto inp = PrepareInput((functions + "int main() { int x; x = f0; return 0; }\n").c_str());
+        std::vector<kcc::Token> tokens;
+        Tokenizer t;
+        t.Tokenize(inp, &tokens);
+
+        auto c = ParseTokens(tokens, nullptr, &sequential);
+        TEST_EQUAL(c->errors.size(), 0);
+        TEST(!sequential.empty());
+        c = ParseTokens(tokens, &pool, &parallel);
+        TEST_EQUAL(c->errors.size(), 0);
+        TEST(c->workers.size() > 1);
+        TEST_EQUAL(sequential, parallel);
+
+        // 後で定義する関数は (後のバッチにあっても) 参照できない
+        auto fwd_inp = PrepareInput(("int g() { int x; x = later; return 0; }\n" + functions + "int later() { return 0; }\n").c_str());
+        std::vector<kcc::Token> fwd_tokens;
+        t.Tokenize(fwd_inp, &fwd_tokens);
+
+        c = ParseTokens(fwd_tokens, nullptr, &sequential);
+        TEST_EQUAL(c->errors.size(), 1);
+        c = ParseTokens(fwd_tokens, &pool, &parallel);
+        TEST(parallel.empty());
+        TEST_EQUAL(c->errors.size(), 1);
+        TEST_EQUAL(c->errors.empty() ? std::string() : c->errors[0].message, "Undefined variable : later");
+
+        // 別のバッチにある同名の関数
+        auto dup_inp = PrepareInput((functions + "int f0() { return 0; }\n").c_str());
+        std::vector<kcc::Token> dup_tokens;
+        t.Tokenize(dup_inp, &dup_tokens);
+
+        c = ParseTokens(dup_tokens, &pool, &parallel);
+        TEST(parallel.empty());
+        TEST_EQUAL(c->errors.size(), 1);
+        TEST_EQUAL(c->errors.empty() ? std::string() : c->errors[0].message, "Function : f0 is already defined");
+
+        // エラーの位置は再定義した行
+        c.reset(new CompilerState);
+        Parser p(c);
+        c->tokens.Assign(dup_tokens);
+        c->lines.Reset(dup_inp.data(), dup_inp.size());
+        c->module_name = "Parse_Parallel_Test";
+        TEST(p.ParallelSyntaxCheck(pool) == nullptr);
+        TEST_EQUAL(c->errors.size(), 1);
+        TEST_EQUAL(c->errors.empty() ? 0 : c->errors[0].line_number, 101);
+    }
+
+    void Parse_Lazy_Body_Test()
+    {
+        // static 関数の本体は参照されるまで読まない (unused の本体の誤りは見つからない)
+        auto inp = PrepareInput("static int unused() { return 1 +; }\n"
+                                "static int helper() { return 2; }\n"
+                                "static int chained() { int x; x = helper; return 3; }\n"
+                                "int main() { int a; a = chained; return 0; }\n");
+
+        std::vector<kcc::Token> tokens;
+        Tokenizer t;
+        t.Tokenize(inp, &tokens);
+
+        std::shared_ptr<CompilerState> c(new CompilerState);
+        Parser p(c);
+        c->tokens.Assign(tokens);
+        c->module_name = "Parse_Lazy_Body_Test";
+        auto ast = p.SyntaxCheck();
+        TEST(ast != nullptr);
+        TEST_EQUAL(c->errors.size(), 0);
+        if (!ast)
+        {
+            return;
+        }
+
+        TEST_EQUAL(ast->decl.size(), 4);
+        auto unused = static_cast<Function *>(ast->decl[0]);
+        TEST(unused->is_static);
+        TEST(unused->body_pending);
+        TEST_EQUAL(unused->stmts.size(), 0);
+
+        // main から参照された chained と、chained から参照された helper は読む
+        auto helper = static_cast<Function *>(ast->decl[1]);
+        auto chained = static_cast<Function *>(ast->decl[2]);
+        TEST(!helper->body_pending);
+        TEST_EQUAL(helper->stmts.size(), 1);
+        TEST(!chained->body_pending);
+        TEST_EQUAL(chained->stmts.size(), 3);
+        TEST_EQUAL(static_cast<Function *>(ast->decl[3])->stmts.size(), 3);
+
+        // 読まなかった本体のコードは生成しない
+        FlatAST flat;
+        FlattenAST(ast, &flat);
+        TEST_EQUAL(flat[flat.Root()].count, 3);
+
+        // 後回しにした本体からも、その関数より後の宣言は見えない
+        auto later_inp = PrepareInput("static int early() { int x; x = later; return 0; }\n"
+                                      "int later() { return 1; }\n"
+                                      "int main() { int a; a = early; return 0; }\n");
+        std::vector<kcc::Token> later_tokens;
+        t.Tokenize(later_inp, &later_tokens);
+
+        std::string assembly;
+        c = ParseTokens(later_tokens, nullptr, &assembly);
+        TEST(assembly.empty());
+        TEST_EQUAL(c->errors.size(), 1);
+        TEST_EQUAL(c->errors.empty() ? std::string() : c->errors[0].message, "Undefined variable : later");
+
+        // 別のバッチから参照された static 関数の本体も読む
+        std::string src = "static int helper7() { return 7; }\n";
+        for (int i = 0; i < 100; ++i)
+        {
+            src += "int f" + std::to_string(i) + "() { return 0; }\n";
+        }
+        src += "int main() { int a; a = helper7; return 0; }\n";
+        auto batch_inp = PrepareInput(src.c_str());
+        std::vector<kcc::Token> batch_tokens;
+        t.Tokenize(batch_inp, &batch_tokens);
+
+        ThreadPool pool(4);
+        std::string sequential;
+        std::string parallel;
+        ParseTokens(batch_tokens, nullptr, &sequential);
+        c = ParseTokens(batch_tokens, &pool, &parallel);
+        TEST(c->workers.size() > 1);
+        TEST(parallel.find("mov rax,7") != std::string::npos);
+        TEST_EQUAL(sequential, parallel);
+    }
+
+    // tokens を構文解析してアセンブリを返す (pool があれば並列に). 失敗したら assembly は空
+    std::shared_ptr<CompilerState> ParseTokens(const std::vector<kcc::Token> &tokens, ThreadPool *pool,
+                                               std::string *assembly)
+    {
+        std::shared_ptr<CompilerState> c(new CompilerState);
+        Parser p(c);
+        c->tokens.Assign(tokens);
+        c->module_name = "ParseTokens";
+        auto ast = pool ? p.ParallelSyntaxCheck(*pool) : p.SyntaxCheck();
+
+        assembly->clear();
+        if (ast)
+        {
+            p.GenerateAssembly(ast, assembly);
+        }
+        return c;
+    }
+
     std::vector<char> PrepareInput(const char *input)
     {
         std::istringstream ss(input);
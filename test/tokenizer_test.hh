@@ -3,7 +3,15 @@
 
 #include "../util.hh"
 #include "../testing.hh"
+#include "../flat_ast.hh"
+#include "../line_table.hh"
+#include "../parallel_tokenizer.hh"
+#include "../preprocessor.hh"
+#include "../scope.hh"
+#include "../token_document.hh"
+#include "../token_stream.hh"
 #include "../tokenizer.hh"
+#include "../type_table.hh"
 
 namespace kcc
 {
@@ -21,9 +29,35 @@ class Tokenize_Tokenizer_Test
 
     void Run()
     {
+        SkipSpace_BasicTest();
         SkipBlockComment_BasicTest();
         SkipBlockComment_ErrorTest();
         Tokenize_Test();
+        Tokenize_ViewTest();
+        ClassifyKeyword_Test();
+        Tokenize_OperatorTest();
+        Tokenize_NumberTest();
+        ParseNumber_Test();
+        Tokenize_LiteralTest();
+        Tokenize_CommentTest();
+        Scan_KernelTest();
+        TokenStream_Test();
+        ParallelTokenizer_Test();
+        TokenArray_Test();
+        SymbolTable_Test();
+        LineTable_Test();
+        SpliceLines_Test();
+        Retokenize_Test();
+        Preprocessor_MacroTest();
+        Preprocessor_ExpansionTest();
+        Preprocessor_ConditionalTest();
+        Preprocessor_IncludeTest();
+        Pch_Test();
+        Arena_Test();
+        FlatAST_Test();
+        ScopeStack_Test();
+        Trace_Test();
+        TypeTable_Test();
     }
 
     std::vector<char> PrepareInput(const char *input)
@@ -37,16 +71,18 @@ class Tokenize_Tokenizer_Test
     void SkipSpace_BasicTest()
     {
         // input
+        auto inp = PrepareInput("    \n   ");
         Tokenizer tzr;
-        tzr.Init(PrepareInput("    \n   "));
+        tzr.Init(inp);
         TEST(tzr.SkipSpace());
     }
 
     void SkipBlockComment_BasicTest()
     {
         // input
+        auto inp = PrepareInput("/* hoge */");
         Tokenizer tzr;
-        tzr.Init(PrepareInput("/* hoge */"));
+        tzr.Init(inp);
 
         // asserts
         TEST(tzr.SkipBlockComment());
@@ -55,8 +91,9 @@ class Tokenize_Tokenizer_Test
     void SkipBlockComment_ErrorTest()
     {
         // input
+        auto inp = PrepareInput("/* hoge");
         Tokenizer tzr;
-        tzr.Init(PrepareInput("/* hoge"));
+        tzr.Init(inp);
 
         // asserts
         TEST_NOT(tzr.SkipBlockComment());
@@ -68,15 +105,16 @@ class Tokenize_Tokenizer_Test
         // output
         std::vector<Token> tokens;
 
+        auto inp = PrepareInput("int main() {\r\n    return 2;\n}");
         Tokenizer tzr;
-        tzr.Tokenize(PrepareInput("int main() {\r\n    return 2;\n}"), &tokens);
+        tzr.Tokenize(inp, &tokens);
 
         TEST_EQUAL(tokens[0].token, "int");
         TEST_EQUAL(tokens[1].token, "main");
         TEST_EQUAL(tokens[2].token, "(");
         TEST_EQUAL(tokens[3].token, ")");
         TEST_EQUAL(tokens[4].token, "{");
-        TEST_EQUAL(tokens[5].line, 2);
+        TEST_EQUAL(tokens[5].pos, 18);
         TEST_EQUAL(tokens[5].token, "return");
         TEST_EQUAL(tokens[6].token, "2");
         TEST_EQUAL(tokens[7].token, ";");
@@ -87,6 +125,1198 @@ class Tokenize_Tokenizer_Test
         //     std::cout << t.token << std::endl;
         // }
     }
+
+    void Tokenize_ViewTest()
+    {
+        // バッファ全体ではなく部分ビューを字句解析できること
+        const char src[] = "int a; return 1;";
+        std::vector<Token> tokens;
+
+        Tokenizer tzr;
+        tzr.Tokenize(src, 6, &tokens);
+
+        TEST_EQUAL(tokens.size(), 3);
+        TEST_EQUAL(tokens[0].token, "int");
+        TEST_EQUAL(tokens[1].token, "a");
+        TEST_EQUAL(tokens[2].token, ";");
+
+        // トークンはソースバッファを直接指す
+        TEST_EQUAL(tokens[0].token.data(), src);
+        TEST_EQUAL(tokens[1].token.data(), src + 4);
+    }
+
+    void ClassifyKeyword_Test()
+    {
+        // 全予約語が分類できること
+        const char *words[] = {
+            "auto", "break", "case", "char", "const", "continue", "default", "do",
+            "double", "else", "enum", "extern", "float", "for", "goto", "if",
+            "int", "long", "register", "return", "short", "signed", "sizeof", "static",
+            "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while"};
+        int n = 0;
+        for (auto w : words)
+        {
+            if (ClassifyKeyword(w, std::strlen(w)) == tkAuto + n)
+                ++n;
+        }
+        TEST_EQUAL(n, 32);
+
+        // 予約語と同じハッシュ値・長さを持つ識別子は tkWord
+        TEST_EQUAL(ClassifyKeyword("main", 4), tkWord);
+        TEST_EQUAL(ClassifyKeyword("rexurn", 6), tkWord);
+        TEST_EQUAL(ClassifyKeyword("i", 1), tkWord);
+        TEST_EQUAL(ClassifyKeyword("integer", 7), tkWord);
+        TEST_EQUAL(ClassifyKeyword("unsigned_", 9), tkWord);
+    }
+
+    void Tokenize_OperatorTest()
+    {
+        // 演算子は最長一致で認識する
+        std::vector<Token> tokens;
+        auto inp = PrepareInput("a<<=b->c&&d!=e<=f>>g+++h...i..j#k##");
+        Tokenizer tzr;
+        tzr.Tokenize(inp, &tokens);
+
+        TokenType expected[] = {
+            tkWord, tkShiftLeftAssign, tkWord, tkArrow, tkWord, tkLogicalAnd,
+            tkWord, tkNotEqual, tkWord, tkLessEqual, tkWord, tkShiftRight,
+            tkWord, tkIncrement, tkPlus, tkWord, tkEllipsis, tkWord, tkDot,
+            tkDot, tkWord, tkHash, tkWord, tkHashHash};
+        TEST_EQUAL(tokens.size(), sizeof(expected) / sizeof(expected[0]));
+
+        bool ok = true;
+        for (size_t i = 0; i < tokens.size(); ++i)
+            ok &= (tokens[i].type == expected[i]);
+        TEST(ok);
+
+        TEST_EQUAL(tokens[1].token, "<<=");
+        TEST_EQUAL(tokens[13].token, "++");
+        TEST_EQUAL(tokens[16].token, "...");
+
+        // どのトークンにもならない文字は 1 文字ずつ tkStray にする
+        tokens.clear();
+        inp = PrepareInput("a @\\b");
+        tzr.Tokenize(inp, &tokens);
+        TEST_EQUAL(tokens.size(), 4);
+        TEST_EQUAL(tokens[1].type, tkStray);
+        TEST_EQUAL(tokens[1].token, "@");
+        TEST_EQUAL(tokens[2].type, tkStray);
+        TEST_EQUAL(tokens[2].token, "\\");
+        TEST_EQUAL(tokens[3].token, "b");
+    }
+
+    void Tokenize_NumberTest()
+    {
+        std::vector<Token> tokens;
+        auto inp = PrepareInput("123 0x1fUL 1.5 .5f 1e10 2E-3 10u");
+        Tokenizer tzr;
+        tzr.Tokenize(inp, &tokens);
+
+        TEST_EQUAL(tokens.size(), 7);
+        TEST_EQUAL(tokens[0].type, tkDecimal);
+        TEST_EQUAL(tokens[1].type, tkHexDecimal);
+        TEST_EQUAL(tokens[1].token, "0x1fUL");
+        TEST_EQUAL(tokens[2].type, tkFloatNumber);
+        TEST_EQUAL(tokens[3].type, tkFloatNumber);
+        TEST_EQUAL(tokens[3].token, ".5f");
+        TEST_EQUAL(tokens[4].type, tkFloatNumber);
+        TEST_EQUAL(tokens[5].token, "2E-3");
+        TEST_EQUAL(tokens[6].token, "10u");
+
+        // 値とサフィックス
+        TEST_EQUAL(tokens[0].value.integer, 123);
+        TEST_EQUAL(tokens[0].number_flags, 0);
+        TEST_EQUAL(tokens[1].value.integer, 0x1f);
+        TEST_EQUAL(tokens[1].number_flags, nfUnsigned | nfLong);
+        TEST_EQUAL(tokens[2].value.real, 1.5);
+        TEST_EQUAL(tokens[3].value.real, 0.5);
+        TEST_EQUAL(tokens[3].number_flags, nfFloat);
+        TEST_EQUAL(tokens[4].value.real, 1e10);
+        TEST_EQUAL(tokens[5].value.real, 2E-3);
+        TEST_EQUAL(tokens[6].number_flags, nfUnsigned);
+    }
+
+    // 文字列リテラル・文字定数は 1 つのトークンになり、値が解かれること
+    void Tokenize_LiteralTest()
+    {
+        std::vector<Token> tokens;
+        auto inp = PrepareInput("s = \"a\\tb\\\"/*\" \"a\\tb\\\"/*\"; '\\n' '\\x41' 'ab' '\\''");
+        SymbolTable literals;
+        Tokenizer tzr;
+        tzr.SetLiteralPool(&literals);
+        tzr.Tokenize(inp, &tokens);
+
+        TEST_EQUAL(tokens.size(), 9);
+        TEST_EQUAL(tokens[2].type, tkString);
+        TEST_EQUAL(tokens[2].token, "\"a\\tb\\\"/*\"");
+        TEST_EQUAL(literals.Name(tokens[2].value.integer), "a\tb\"/*");
+        TEST_EQUAL(tokens[2].number_flags, 0);
+        // 同じ内容のリテラルは同じ ID
+        TEST_EQUAL(tokens[3].value.integer, tokens[2].value.integer);
+        TEST_EQUAL(literals.size(), 1);
+        TEST_EQUAL(tokens[4].type, tkSemicolon);
+
+        TEST_EQUAL(tokens[5].type, tkCharacter);
+        TEST_EQUAL(tokens[5].value.integer, '\n');
+        TEST_EQUAL(tokens[6].value.integer, 0x41);
+        TEST_EQUAL(tokens[7].value.integer, ('a' << 8) | 'b');
+        TEST_EQUAL(tokens[8].token, "'\\''");
+        TEST_EQUAL(tokens[8].value.integer, '\'');
+
+        // 閉じていない文字列は行末までで、次の行は通常どおり字句解析する
+        tokens.clear();
+        inp = PrepareInput("\"abc\nx '\\\r\n;");
+        tzr.Tokenize(inp, &tokens);
+        TEST_EQUAL(tokens.size(), 4);
+        TEST_EQUAL(tokens[0].token, "\"abc");
+        TEST_EQUAL(tokens[1].token, "x");
+        TEST_EQUAL(tokens[2].token, "'\\");
+        TEST_EQUAL(tokens[3].type, tkSemicolon);
+        TEST(tokens[0].number_flags & nfUnterminated);
+        TEST(tokens[2].number_flags & nfUnterminated);
+
+        // 行末の引用符がエスケープされている文字列も閉じていない
+        tokens.clear();
+        inp = PrepareInput("\"abc\\\"\n\"abc\\\\\"");
+        tzr.Tokenize(inp, &tokens);
+        TEST_EQUAL(tokens.size(), 2);
+        TEST_EQUAL(tokens[0].token, "\"abc\\\"");
+        TEST(tokens[0].number_flags & nfUnterminated);
+        TEST_EQUAL(tokens[1].token, "\"abc\\\\\"");
+        TEST_EQUAL(tokens[1].number_flags & nfUnterminated, 0);
+
+        // 不正なエスケープ・空の文字定数
+        uint64_t v = 0;
+        std::string s;
+        TEST(DecodeStringLiteral("\\q", "\\q" + 2, &s) & nfInvalid);
+        TEST(DecodeStringLiteral("\\x", "\\x" + 2, &s) & nfInvalid);
+        TEST(DecodeCharacterLiteral("", "", &v) & nfInvalid);
+        TEST_EQUAL(DecodeStringLiteral("\\101\\0", "\\101\\0" + 6, &s), 0);
+        TEST_EQUAL(s, std::string("A\0", 2));
+        TEST_EQUAL(DecodeCharacterLiteral("\\377", "\\377" + 4, &v), 0);
+        TEST_EQUAL(static_cast<int64_t>(v), -1);
+    }
+
+    // 数値リテラルの値の変換
+    void ParseNumber_Test()
+    {
+        struct
+        {
+            const char *src;
+            uint64_t value;
+            uint8_t flags;
+        } integers[] = {
+            {"0", 0, 0},
+            {"0755", 0755, 0},
+            {"0x7fffffffffffffff", 0x7fffffffffffffffull, 0},
+            {"123456789012", 123456789012ull, 0},
+            {"18446744073709551615", 18446744073709551615ull, 0},
+            {"18446744073709551616", 0, nfOverflow},
+            {"0x10000000000000000", 0, nfOverflow},
+            {"10LLu", 10, nfUnsigned | nfLongLong},
+            {"10uLL", 10, nfUnsigned | nfLongLong},
+            {"10lL", 10, nfInvalid},
+            {"10ul2", 10, nfInvalid},
+            {"09", 0, nfInvalid},
+            {"0x", 0, nfInvalid}};
+
+        bool ok = true;
+        for (auto &c : integers)
+        {
+            uint64_t v = 0;
+            uint8_t flags = ParseIntegerLiteral(c.src, c.src + std::strlen(c.src), &v);
+            // エラーの場合はフラグだけを確認する
+            if (c.flags & (nfInvalid | nfOverflow))
+                ok &= (flags & c.flags) != 0;
+            else
+                ok &= (flags == c.flags) && (v == c.value);
+        }
+        TEST(ok);
+
+        // SWAR の 8 桁変換と 1 桁ずつの変換が一致すること
+        unsigned long long seed = 3;
+        ok = true;
+        for (int i = 0; i < 2000; ++i)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            std::string s = std::to_string(seed >> (i % 64));
+            uint64_t v = 0;
+            ok &= ParseIntegerLiteral(s.data(), s.data() + s.size(), &v) == 0 && v == (seed >> (i % 64));
+        }
+        TEST(ok);
+
+        // 浮動小数点数は strtod と同じ値になること
+        const char *floats[] = {"1.5", ".5", "1e10", "2E-3", "3.14159265358979323846", "1e-320",
+                                "123456789012345678901234567890.0", "0.000001", "9007199254740993.0", "1e22", "1e23"};
+        ok = true;
+        for (auto f : floats)
+        {
+            double v = 0;
+            ok &= ParseFloatLiteral(f, f + std::strlen(f), &v) == 0 && v == std::strtod(f, nullptr);
+        }
+        TEST(ok);
+
+        double v = 0;
+        TEST_EQUAL(ParseFloatLiteral("1e999", "1e999" + 5, &v), nfOverflow);
+        TEST_EQUAL(ParseFloatLiteral("1.5L", "1.5L" + 4, &v), nfLong);
+        TEST_EQUAL(ParseFloatLiteral("1.5ff", "1.5ff" + 5, &v), nfInvalid);
+    }
+
+    void Tokenize_CommentTest()
+    {
+        std::vector<Token> tokens;
+        auto inp = PrepareInput("a /* x\n y */ / b // c\n\td");
+        Tokenizer tzr;
+        tzr.Tokenize(inp, &tokens);
+
+        TEST_EQUAL(tokens.size(), 4);
+        TEST_EQUAL(tokens[1].type, tkSlash);
+        TEST_EQUAL(tokens[3].token, "d");
+
+        LineTable lines;
+        lines.Reset(inp.data(), inp.size());
+        TEST_EQUAL(lines.Line(tokens[2].pos), 2);
+        TEST_EQUAL(lines.Line(tokens[3].pos), 3);
+        TEST_EQUAL(lines.Column(tokens[3].pos), 2);
+    }
+
+    // SIMD カーネルがスカラー版と同じ結果を返すこと
+    void Scan_KernelTest()
+    {
+        std::vector<scan::ScanKernels> kernels;
+        kernels.push_back(scan::kKernels);
+#ifdef KCC_SCAN_X86
+        kernels.push_back({"sse2", scan::SkipBlanksSSE2, scan::FindCommentEndSSE2, scan::CollectLineStartsSSE2});
+#endif
+
+        const char alphabet[] = {' ', ' ', '\t', '\n', '\r', '*', '/', 'a'};
+        unsigned int seed = 1;
+        bool ok = true;
+        for (int i = 0; i < 2000; ++i)
+        {
+            std::string src;
+            size_t len = i % 100;
+            for (size_t j = 0; j < len; ++j)
+            {
+                seed = seed * 1103515245 + 12345;
+                // 先頭側は空白と改行を多めに出す
+                int n = (j < len / 2) ? 5 : 8;
+                src += alphabet[(seed >> 16) % n];
+            }
+            const char *p = src.data();
+            const char *end = p + src.size();
+
+            const char *expected = scan::SkipBlanksScalar(p, end);
+            const char *expected_comment = scan::FindCommentEndScalar(p, end);
+            std::vector<uint32_t> expected_lines;
+            scan::CollectLineStartsScalar(p, end, &expected_lines);
+
+            for (auto &k : kernels)
+            {
+                ok &= (k.skip_blanks(p, end) == expected);
+                ok &= (k.find_comment_end(p, end) == expected_comment);
+                std::vector<uint32_t> lines;
+                k.collect_line_starts(p, end, &lines);
+                ok &= (lines == expected_lines);
+            }
+        }
+        TEST(ok);
+    }
+
+    void TokenStream_Test()
+    {
+        // リングバッファより十分長い入力
+        std::string src;
+        for (int i = 0; i < 1000; ++i)
+            src += "x" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+        std::vector<char> inp(src.begin(), src.end());
+
+        std::vector<Token> expected;
+        Tokenizer tzr;
+        tzr.Tokenize(inp, &expected);
+
+        TokenStream stream;
+        stream.Open(inp.data(), inp.size());
+
+        // 先読みしながら最後まで読むと Tokenize と同じ列になる
+        bool ok = true;
+        size_t n = 0;
+        while (!stream.IsEnd())
+        {
+            ok &= (stream.Peek().token == expected[n].token) && (stream.Peek().pos == expected[n].pos);
+            if (!stream.IsEnd(3))
+                ok &= (stream.Peek(3).token == expected[n + 3].token);
+            stream.Fwd();
+            ++n;
+        }
+        TEST(ok);
+        TEST_EQUAL(n, expected.size());
+
+        // リングに残っている範囲は後戻りできる
+        stream.Bwd(10);
+        TEST_EQUAL(stream.Peek().token, expected[n - 10].token);
+
+        // 終端から先は番兵 (tkEof) が続き、進めても例外にならない
+        stream.Fwd(10);
+        TEST(stream.IsEnd());
+        TEST_EQUAL(stream.PeekType(TokenStream::kMaxLookahead - 1), tkEof);
+        TEST_EQUAL(stream.Peek().pos, inp.size());
+        TEST_EQUAL(stream.Peek().token.size(), 0);
+        stream.Fwd(TokenStream::kWindowSize * 2);
+        TEST(stream.IsEnd());
+
+        // 先読みはコピーせずリングの要素を返す
+        stream.Open(inp.data(), inp.size());
+        TEST_EQUAL(&stream.Peek(1), &stream.Peek(1));
+        const Token &ahead = stream.Peek(TokenStream::kMaxLookahead - 1);
+        stream.Fwd(TokenStream::kMaxLookahead - 1);
+        TEST_EQUAL(&stream.Peek(), &ahead);
+        TEST_EQUAL(stream.Peek().token, expected[TokenStream::kMaxLookahead - 1].token);
+
+        // 後戻りした分を進め直してもリングは上書きされず、さらに後戻りできる
+        std::string names;
+        for (int i = 0; i < 200; ++i)
+            names += "a" + std::to_string(i) + " ";
+        stream.Open(names.data(), names.size());
+        stream.Fwd(40);
+        stream.Bwd(10);
+        stream.Fwd(10);
+        stream.Bwd(30);
+        TEST_EQUAL(stream.Position(), 10);
+        TEST_EQUAL(stream.Peek().token, "a10");
+        TEST_EQUAL(stream.Peek(TokenStream::kMaxLookahead - 1).token, "a41");
+
+        // 空の入力・短いトークン列
+        stream.Open("", 0);
+        TEST(stream.IsEnd());
+        std::vector<Token> few(expected.begin(), expected.begin() + 3);
+        stream.Assign(few);
+        TEST_EQUAL(stream.PeekType(2), expected[2].type);
+        TEST(stream.IsEnd(3));
+        TEST_EQUAL(stream.Peek(3).pos, expected[2].pos + expected[2].token.size());
+
+        // 字句解析済みの列の一部だけを読む
+        TokenStream whole;
+        whole.Assign(expected);
+        TEST(whole.IsStored());
+        TEST_EQUAL(whole.StoredSize(), expected.size());
+        stream.Slice(whole, 4, 8);
+        TEST_EQUAL(stream.StoredSize(), 4);
+        TEST_EQUAL(stream.StoredType(0), expected[4].type);
+        TEST_EQUAL(stream.Peek().token, expected[4].token);
+        TEST_EQUAL(stream.Peek(3).token, expected[7].token);
+        TEST(stream.IsEnd(4));
+        TEST_EQUAL(stream.Peek(4).pos, expected[7].pos + expected[7].token.size());
+
+        // 字句解析済みの列の任意の位置へ移る
+        whole.Seek(100);
+        TEST_EQUAL(whole.Position(), 100);
+        TEST_EQUAL(whole.Peek().token, expected[100].token);
+        TEST_EQUAL(whole.Peek(5).token, expected[105].token);
+        whole.Seek(expected.size());
+        TEST(whole.IsEnd());
+        whole.Seek(2);
+        TEST_EQUAL(whole.Peek().token, expected[2].token);
+    }
+
+    // 並列字句解析の結果が逐次の字句解析と同一であること
+    void ParallelTokenizer_Test()
+    {
+        const char *pieces[] = {
+            "int a = 1;\n", "/* comment\n spanning\n lines */\n", "b += c / d;\r\n",
+            "// line /* not a comment\n", "x /*/ still comment\n */ y\n", "e->f;\r",
+            "/**/ g\n", "h /* a */ /* b\n*/ i\n", "\n\n", "0x1f + 1.5e3;\n",
+            "s = \"/* not a comment\";\n", "c = '\"' + '\\'';\n", "t = \"unterminated /*\n"};
+
+        ThreadPool pool(4);
+        unsigned int seed = 7;
+        bool ok = true;
+        for (int round = 0; round < 50; ++round)
+        {
+            std::string src;
+            for (int i = 0; i < 200; ++i)
+            {
+                seed = seed * 1103515245 + 12345;
+                src += pieces[(seed >> 16) % 13];
+            }
+            // 閉じていないコメントで終わる入力
+            if (round % 10 == 9)
+                src += "z /* unterminated\n";
+            std::vector<char> inp(src.begin(), src.end());
+
+            std::vector<Token> expected;
+            Tokenizer tzr;
+            tzr.Tokenize(inp, &expected);
+
+            std::vector<Token> tokens;
+            ParallelTokenizer ptzr(pool, 16 + round);
+            ptzr.Tokenize(inp, &tokens);
+
+            ok &= (tokens.size() == expected.size());
+            for (size_t i = 0; ok && i < tokens.size(); ++i)
+            {
+                ok &= tokens[i].token.data() == expected[i].token.data() &&
+                      tokens[i].token.size() == expected[i].token.size() &&
+                      tokens[i].type == expected[i].type &&
+                      tokens[i].pos == expected[i].pos &&
+                      tokens[i].symbol == expected[i].symbol &&
+                      tokens[i].value.integer == expected[i].value.integer;
+            }
+
+            TokenArray array;
+            ptzr.Tokenize(inp.data(), inp.size(), &array);
+            ok &= (array.size() == expected.size());
+            for (size_t i = 0; ok && i < array.size(); ++i)
+            {
+                ok &= array.Text(i).data() == expected[i].token.data() &&
+                      array.Type(i) == expected[i].type &&
+                      array.Symbol(i) == expected[i].symbol;
+            }
+        }
+        TEST(ok);
+    }
+
+    // TokenArray が Tokenize と同じトークン列を保持すること
+    void TokenArray_Test()
+    {
+        std::vector<char> inp = PrepareInput("int main()\r\n{\r  /* a\n b */ return 0x1f;\n\n}\n");
+
+        std::vector<Token> expected;
+        Tokenizer tzr;
+        tzr.Tokenize(inp, &expected);
+
+        TokenArray array;
+        array.Build(inp.data(), inp.size());
+        TEST_EQUAL(array.size(), expected.size());
+
+        bool ok = true;
+        for (size_t i = 0; i < array.size() && i < expected.size(); ++i)
+        {
+            Token tok = array.At(i);
+            ok &= tok.token.data() == expected[i].token.data() &&
+                  tok.token.size() == expected[i].token.size() &&
+                  tok.type == expected[i].type &&
+                  tok.pos == expected[i].pos;
+        }
+        TEST(ok);
+        TEST_EQUAL(array.Line(6), 4);
+        TEST_EQUAL(array.Line(array.size() - 1), 6);
+
+        // TokenStream からは種別だけを先読みできる
+        TokenStream stream;
+        stream.Assign(array);
+        TEST_EQUAL(stream.PeekType(), tkInt);
+        TEST_EQUAL(stream.PeekType(5), tkReturn);
+        TEST_EQUAL(stream.Peek(6).token, "0x1f");
+        TEST_EQUAL(stream.Peek(6).pos, expected[6].pos);
+        TEST_EQUAL(&stream.Peek(6), &stream.Peek(6));
+        TEST(stream.IsEnd(array.size()));
+        stream.Fwd(6);
+        TEST_EQUAL(stream.PeekType(), expected[6].type);
+        TEST_EQUAL(stream.Peek().token, "0x1f");
+        stream.Bwd(6);
+        TEST_EQUAL(stream.Peek().token, expected[0].token);
+    }
+
+    // 同じ綴りの識別子には同じシンボル ID が割り当てられること
+    void SymbolTable_Test()
+    {
+        SymbolTable table;
+        SymbolID a = table.Intern("alpha");
+        SymbolID b = table.Intern("beta");
+        TEST_NOT_EQUAL(a, kNoSymbol);
+        TEST_NOT_EQUAL(a, b);
+        TEST_EQUAL(table.Intern(std::string("alpha")), a);
+        TEST_EQUAL(table.Find("beta"), b);
+        TEST_EQUAL(table.Find("gamma"), kNoSymbol);
+        TEST_EQUAL(table.Name(b), "beta");
+
+        // テーブルの拡張後も ID と綴りが保たれる
+        bool ok = true;
+        for (int i = 0; i < 5000; ++i)
+            ok &= table.Name(table.Intern("v" + std::to_string(i))) == "v" + std::to_string(i);
+        ok &= table.Find("alpha") == a && table.size() == 5002;
+        TEST(ok);
+
+        // 複数のスレッドから同時に登録しても、同じ綴りは同じ ID になる
+        ThreadPool pool(4);
+        std::vector<SymbolID> ids(8000);
+        pool.ParallelFor(ids.size(), [&table, &ids](size_t i) {
+            ids[i] = table.Intern("w" + std::to_string(i % 4000));
+        });
+        ok = table.size() == 9002;
+        for (size_t i = 0; i < ids.size(); ++i)
+            ok &= ids[i] == ids[i % 4000] && table.Name(ids[i]) == "w" + std::to_string(i % 4000);
+        TEST(ok);
+
+        // 字句解析時に識別子へシンボル ID が付く. 予約語・記号には付かない
+        std::vector<char> inp = PrepareInput("int foo = bar + foo;");
+        std::vector<Token> tokens;
+        Tokenizer tzr;
+        tzr.SetSymbolTable(&table);
+        tzr.Tokenize(inp, &tokens);
+        TEST_EQUAL(tokens[0].symbol, kNoSymbol);
+        TEST_EQUAL(tokens[1].symbol, table.Find("foo"));
+        TEST_EQUAL(tokens[2].symbol, kNoSymbol);
+        TEST_EQUAL(tokens[3].symbol, table.Find("bar"));
+        TEST_EQUAL(tokens[5].symbol, tokens[1].symbol);
+    }
+
+    // LF, CR, CR+LF をそれぞれ 1 つの改行として行番号・桁番号を求めること
+    // src を前処理し、出力したトークンを空白区切りで連結して返す
+    std::string Preprocess(HeaderCache &cache, const char *src, bool *ok = nullptr,
+                           const PrecompiledHeader *pch = nullptr)
+    {
+        SourceFile file;
+        file.path = "main.c";
+        file.text = src;
+        file.src = file.text.data();
+        file.size = file.text.size();
+        file.Prepare();
+
+        Preprocessor pp(cache);
+        pp.AddIncludePath("inc");
+        pp.UsePch(pch);
+        std::vector<Token> tokens;
+        bool result = pp.Run(file, &tokens);
+        if (ok)
+            *ok = result;
+
+        std::string joined;
+        for (auto &tok : tokens)
+            joined += (joined.empty() ? "" : " ") + tok.token;
+        return joined;
+    }
+
+    void Preprocessor_MacroTest()
+    {
+        HeaderCache cache;
+        TEST_EQUAL(Preprocess(cache, "#define N 10\n"
+                                     "#define ADD(a, b) ((a) + (b))\n"
+                                     "int x = ADD(N, ADD(1,\n 2));\n"),
+                   "int x = ( ( 10 ) + ( ( ( 1 ) + ( 2 ) ) ) ) ;");
+
+        // 展開中のマクロは再帰的に展開しない
+        TEST_EQUAL(Preprocess(cache, "#define SELF SELF + 1\n"
+                                     "#define f(x) g(x)\n"
+                                     "#define g(x) f(x) + x\n"
+                                     "SELF; f(2);\n"),
+                   "SELF + 1 ; f ( 2 ) + 2 ;");
+
+        // ( が続かない関数形式マクロ・#undef・可変長引数
+        TEST_EQUAL(Preprocess(cache, "#define f(x) x\n"
+                                     "#define P(fmt, ...) printf(fmt, __VA_ARGS__)\n"
+                                     "f; f(); P(\"%d\", 1, (2, 3));\n"
+                                     "#undef f\n"
+                                     "f(1)\n"),
+                   "f ; ; printf ( \"%d\" , 1 , ( 2 , 3 ) ) ; f ( 1 )");
+
+        // 行の継続 (\ + 改行) でつないだ指令
+        TEST_EQUAL(Preprocess(cache, "#define ADD(a, b) \\\n"
+                                     "    ((a) + \\\r\n"
+                                     "     (b))\n"
+                                     "int x = AD\\\nD(1, 2);\n"),
+                   "int x = ( ( 1 ) + ( 2 ) ) ;");
+
+        bool ok = true;
+        Preprocess(cache, "#define f(x, y) x\nf(1)\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#define f(x) x\nf(1\n", &ok);
+        TEST_NOT(ok);
+    }
+
+    // # と ## を含む展開 (C 規格 6.10.3.5 の例)
+    void Preprocessor_ExpansionTest()
+    {
+        HeaderCache cache;
+        TEST_EQUAL(Preprocess(cache, "#define x 3\n"
+                                     "#define f(a) f(x * (a))\n"
+                                     "#undef x\n"
+                                     "#define x 2\n"
+                                     "#define g f\n"
+                                     "#define z z[0]\n"
+                                     "#define h g(~\n"
+                                     "#define m(a) a(w)\n"
+                                     "#define w 0,1\n"
+                                     "#define t(a) a\n"
+                                     "#define p() int\n"
+                                     "#define q(x) x\n"
+                                     "#define r(x,y) x ## y\n"
+                                     "#define str(x) # x\n"
+                                     "f(y+1) + f(f(z)) % t(t(g)(0) + t)(1);\n"
+                                     "g(x+(3,4)-w) | h 5) & m\n"
+                                     "(f)^m(m);\n"
+                                     "p() i[q()] = { q(1), r(2,3), r(4,), r(,5), r(,) };\n"
+                                     "char c[2][6] = { str(hello), str() };\n"),
+                   "f ( 2 * ( y + 1 ) ) + f ( 2 * ( f ( 2 * ( z [ 0 ] ) ) ) ) % f ( 2 * ( 0 ) ) + t ( 1 ) ; "
+                   "f ( 2 * ( 2 + ( 3 , 4 ) - 0 , 1 ) ) | f ( 2 * ( ~ 5 ) ) & f ( 2 * ( 0 , 1 ) ) ^ m ( 0 , 1 ) ; "
+                   "int i [ ] = { 1 , 23 , 4 , 5 , } ; "
+                   "char c [ 2 ] [ 6 ] = { \"hello\" , \"\" } ;");
+
+        // 文字列化のエスケープと空白の正規化、連結した識別子の再走査
+        TEST_EQUAL(Preprocess(cache, "#define str(x) #x\n"
+                                     "#define xstr(x) str(x)\n"
+                                     "#define cat(a, b) a ## b\n"
+                                     "#define ab 42\n"
+                                     "str( \"a\\n\"  +   'b' ) xstr(cat(a, b)) cat(a, b) cat(x, 1) cat(+, =)\n"),
+                   "\"\\\"a\\\\n\\\" + 'b'\" \"42\" 42 x1 +=");
+
+        // 連結・文字列化したトークンの種別と値
+        SourceFile file;
+        file.path = "main.c";
+        file.text = "#define cat(a, b) a ## b\n#define str(x) #x\ncat(0x, 1f) cat(foo, bar) str(s)\n";
+        file.src = file.text.data();
+        file.size = file.text.size();
+        file.Prepare();
+        std::vector<Token> tokens;
+        Preprocessor pp(cache);
+        TEST(pp.Run(file, &tokens));
+        TEST_EQUAL(tokens.size(), 3);
+        TEST_EQUAL(tokens[0].type, tkHexDecimal);
+        TEST_EQUAL(tokens[0].value.integer, 0x1f);
+        TEST_EQUAL(tokens[1].symbol, GlobalSymbols().Find("foobar"));
+        TEST_EQUAL(tokens[2].type, tkString);
+        TEST_EQUAL(GlobalLiterals().Name(tokens[2].value.integer), "s");
+
+        bool ok = true;
+        Preprocess(cache, "#define cat(a, b) a ## b\ncat(+, /)\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#define bad(a) # b\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#define bad ## x\n", &ok);
+        TEST_NOT(ok);
+
+        // X マクロ: 展開結果の大きさに比例する時間で展開できること
+        std::string list = "#define LIST";
+        for (int i = 0; i < 2000; ++i)
+            list += " X(e" + std::to_string(i) + ")";
+        list += "\n#define X(n) n,\nLIST\n#undef X\n#define X(n) case n: return #n;\nLIST\n";
+        std::string out = Preprocess(cache, list.c_str(), &ok);
+        TEST(ok);
+        TEST_EQUAL(out.substr(0, 12), "e0 , e1 , e2");
+        TEST(out.find("case e1999 : return \"e1999\" ;") != std::string::npos);
+    }
+
+    void Preprocessor_ConditionalTest()
+    {
+        HeaderCache cache;
+        TEST_EQUAL(Preprocess(cache, "#define N 10\n"
+                                     "#if defined(N) && N > 5\n"
+                                     "a\n"
+                                     "#elif 1\n"
+                                     "no\n"
+                                     "#else\n"
+                                     "no\n"
+                                     "#endif\n"
+                                     "#ifdef UNDEFINED\n"
+                                     "no\n"
+                                     "#else\n"
+                                     "b\n"
+                                     "#endif\n"
+                                     "#if 0\n"
+                                     "#if 1\n"
+                                     "no\n"
+                                     "#endif\n"
+                                     "#elif (N - 10) ? 0 : 'A' == 0x41\n"
+                                     "c\n"
+                                     "#endif\n"
+                                     "#if 1 || 1 / 0\n"
+                                     "d\n"
+                                     "#endif\n"
+                                     "#if -1 < 0 && ~0 == -1 && (7 >> 1) == 3 && !defined UNDEFINED\n"
+                                     "e\n"
+                                     "#endif\n"),
+                   "a b c d e");
+
+        bool ok = true;
+        Preprocess(cache, "#if 1\na\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#endif\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#if 1 / 0\n#endif\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#error stop\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#if 0\n#error skipped\n#bogus\n#endif\n", &ok);
+        TEST(ok);
+    }
+
+    void Preprocessor_IncludeTest()
+    {
+        HeaderCache cache;
+        cache.AddFile("inc/a.h", "#ifndef A_H\n#define A_H\nint a;\n#endif\n");
+        cache.AddFile("inc/b.h", "#pragma once\nint b;\n");
+        cache.AddFile("inc/c.h", "#ifndef C_H\n#define C_H\n#endif\nint c;\n");
+        cache.AddFile("inc/sub/d.h", "#include \"e.h\"\n");
+        cache.AddFile("inc/sub/e.h", "int e;\n");
+        cache.AddFile("inc/self.h", "#include \"self.h\"\n");
+
+        // インクルードガードの検出
+        TEST_EQUAL(cache.Load("inc/a.h")->guard, GlobalSymbols().Find("A_H"));
+        TEST_EQUAL(cache.Load("inc/b.h")->guard, kNoSymbol);
+        TEST_EQUAL(cache.Load("inc/c.h")->guard, kNoSymbol);
+
+        const char *src = "#include \"a.h\"\n"
+                          "#include \"a.h\"\n"
+                          "#include <b.h>\n"
+                          "#include <b.h>\n"
+                          "#include <c.h>\n"
+                          "#include <c.h>\n"
+                          "#define HEADER <sub/d.h>\n"
+                          "#include HEADER\n";
+        size_t loaded = cache.LoadCount();
+        bool ok = false;
+        TEST_EQUAL(Preprocess(cache, src, &ok), "int a ; int b ; int c ; int c ; int e ;");
+        TEST(ok);
+
+        // 2 つ目の翻訳単位ではヘッダを読み込み直さない
+        TEST_EQUAL(Preprocess(cache, src, &ok), "int a ; int b ; int c ; int c ; int e ;");
+        TEST_EQUAL(cache.LoadCount(), loaded);
+
+        Preprocess(cache, "#include \"missing.h\"\n", &ok);
+        TEST_NOT(ok);
+        Preprocess(cache, "#include <self.h>\n", &ok);
+        TEST_NOT(ok);
+    }
+
+    void Pch_Test()
+    {
+        const std::string path = "/tmp/kcc_pch_test.pch";
+
+        // ヘッダを前処理した後の状態を書き出す
+        {
+            HeaderCache cache;
+            cache.AddFile("inc/config.h", "#ifndef CONFIG_H\n"
+                                          "#define CONFIG_H\n"
+                                          "#define VERSION 3\n"
+                                          "#define MAX(a, b) ((a) > (b) ? (a) : (b)) /* comment */\n"
+                                          "#define LOG(fmt, ...) log(fmt, __VA_ARGS__)\n"
+                                          "#define STR(x) #x\n"
+                                          "#endif\n");
+            SourceFile file;
+            file.path = "config.c";
+            file.text = "#include <config.h>\n";
+            file.src = file.text.data();
+            file.size = file.text.size();
+            file.Prepare();
+
+            Preprocessor pp(cache);
+            pp.AddIncludePath("inc");
+            std::vector<Token> tokens;
+            TEST(pp.Run(file, &tokens));
+            TEST(tokens.empty());
+
+            PchWriter writer;
+            pp.ExportMacros(&writer);
+            TEST_EQUAL(writer.MacroCount(), 5);
+
+            PchType point = {"point", false, 16, {{"x", "long"}, {"y", "long"}}};
+            writer.AddType(point);
+            PchIdentifier main_id = {"global", "main", "config.c", 1, 0};
+            writer.AddIdentifier(main_id);
+            TEST(writer.Write(path));
+        }
+
+        PrecompiledHeader pch;
+        TEST(pch.Open(path));
+
+        // マクロは参照した時に取り出す. ガードのマクロも定義済みなのでヘッダは読まない
+        HeaderCache cache;
+        cache.AddFile("inc/config.h", "#ifndef CONFIG_H\n#define CONFIG_H\nnot_skipped\n#endif\n");
+        TEST_EQUAL(Preprocess(cache, "#include <config.h>\n"
+                                     "int v = MAX(VERSION, 2);\n"
+                                     "LOG(\"%d\", STR(v));\n", nullptr, &pch),
+                   "int v = ( ( 3 ) > ( 2 ) ? ( 3 ) : ( 2 ) ) ; log ( \"%d\" , \"v\" ) ;");
+        TEST_EQUAL(Preprocess(cache, "#undef VERSION\n"
+                                     "#ifdef VERSION\nyes\n#else\nno\n#endif\n"
+                                     "#define MAX 1\nVERSION MAX\n", nullptr, &pch),
+                   "no VERSION 1");
+
+        PchType type;
+        TEST(pch.FindType("point", &type));
+        TEST_EQUAL(type.size, 16);
+        TEST_EQUAL(type.members.size(), 2);
+        TEST_EQUAL(type.members[1].first, "y");
+        TEST_EQUAL(type.members[1].second, "long");
+        TEST_NOT(pch.FindType("pointer", &type));
+
+        PchIdentifier id;
+        TEST(pch.FindIdentifier("global", "main", &id));
+        TEST_EQUAL(id.module_name, "config.c");
+        TEST_EQUAL(id.id_type, 1);
+        TEST_NOT(pch.FindIdentifier("main", "global", &id));
+
+        PchMacro macro;
+        TEST_NOT(pch.FindMacro("VERSIONS", 8, &macro));
+
+        // PCH ではないファイル・途中で切れたファイルは開かない
+        std::string image;
+        {
+            SourceBuffer buffer;
+            TEST(buffer.Open(path));
+            image.assign(buffer.data(), buffer.size());
+        }
+        FILE *fp = std::fopen(path.c_str(), "wb");
+        std::fwrite(image.data(), 1, image.size() - 1, fp);
+        std::fclose(fp);
+        PrecompiledHeader truncated;
+        TEST_NOT(truncated.Open(path));
+
+        fp = std::fopen(path.c_str(), "wb");
+        std::fputs("#define VERSION 3\n", fp);
+        std::fclose(fp);
+        PrecompiledHeader text;
+        TEST_NOT(text.Open(path));
+        TEST_NOT(text.FindMacro("VERSION", 7, &macro));
+        std::remove(path.c_str());
+    }
+
+    void Arena_Test()
+    {
+        struct Tracked
+        {
+            Tracked(std::vector<int> *log, int id) : log(log), id(id), name("node" + std::to_string(id)) {}
+            ~Tracked() { log->push_back(id); }
+            std::vector<int> *log;
+            int id;
+            std::string name;
+        };
+
+        std::vector<int> log;
+        Arena arena;
+        Tracked *a = arena.New<Tracked>(&log, 1);
+        Tracked *b = arena.New<Tracked>(&log, 2);
+        int *n = arena.New<int>(7);
+        TEST_EQUAL(b->name, "node2");
+        TEST_EQUAL(*n, 7);
+        TEST(reinterpret_cast<uintptr_t>(a) % alignof(Tracked) == 0);
+
+        // デストラクタは Reset でまとめて、作った順と逆順に呼ぶ
+        TEST(log.empty());
+        arena.Reset();
+        TEST_EQUAL(log.size(), 2);
+        TEST_EQUAL(log[0], 2);
+        TEST_EQUAL(log[1], 1);
+        TEST_EQUAL(arena.BytesUsed(), 0);
+    }
+
+    // int main() { return 2; } に相当する AST
+    void FlatAST_Test()
+    {
+        FlatAST ast;
+        AssemblyConfig conf;
+        TEST_EQUAL(FlatAssembler(ast, conf).Assemble(), "");
+
+        NodeIndex literal = ast.Add(kIntegerLiteral, ast.AddString("2"));
+        NodeIndex primary = ast.Add(kPrimaryExpr, 0, 0, &literal, 1);
+        NodeIndex stmts[] = {ast.Add(kVariableDecl, 8, 8), ast.Add(kReturnStmt, 0, 0, &primary, 1)};
+        NodeIndex function = ast.Add(kFuncDefinition, ast.AddString("main"), 0, stmts, 2);
+        NodeIndex program = ast.Add(kProgram, 0, 0, &function, 1);
+
+        // 後順に並び、根は最後のノード
+        TEST_EQUAL(ast.size(), 6);
+        TEST_EQUAL(ast.Root(), program);
+        TEST_EQUAL(ast[function].count, 2);
+        TEST_EQUAL(ast.Child(function, 1), stmts[1]);
+        TEST_EQUAL(ast.Child(ast.Child(function, 1), 0), primary);
+        for (NodeIndex i = 0; i < ast.size(); ++i)
+        {
+            for (uint32_t k = 0; k < ast[i].count; ++k)
+                TEST(ast.Child(i, k) < i);
+        }
+
+        TEST_EQUAL(FlatAssembler(ast, conf).Assemble(), ".intel_syntax noprefix\n"
+                                                        ".globl _main\n"
+                                                        "_main:\n"
+                                                        "    push rbp\n"
+                                                        "    mov rbp,rsp\n"
+                                                        "    mov rax,2\n"
+                                                        "    mov rsp,rbp\n"
+                                                        "    pop rbp\n"
+                                                        "    ret\n");
+    }
+
+    void ScopeStack_Test()
+    {
+        SymbolTable &symbols = GlobalSymbols();
+        const SymbolID x = symbols.Intern("scope_x"), y = symbols.Intern("scope_y"), f = symbols.Intern("scope_f");
+
+        ScopeStack<int> scopes;
+        TEST(scopes.Lookup(x) == nullptr);
+        TEST(scopes.Declare(x, 1));
+        TEST_NOT(scopes.Declare(x, 2)); // 同じスコープでの再定義
+
+        // 内側のスコープの宣言は外側を隠す
+        scopes.Push(f);
+        TEST_EQUAL(scopes.Depth(), 1);
+        TEST_EQUAL(scopes.Label(1), f);
+        TEST_EQUAL(*scopes.Lookup(x), 1);
+        TEST(scopes.LookupCurrent(x) == nullptr);
+        TEST(scopes.Declare(x, 10));
+        TEST(scopes.Declare(y, 20));
+        TEST_EQUAL(*scopes.Lookup(x), 10);
+
+        scopes.Push();
+        TEST(scopes.Declare(x, 100));
+        TEST_EQUAL(*scopes.Lookup(x), 100);
+        scopes.Pop();
+        TEST_EQUAL(*scopes.Lookup(x), 10);
+
+        scopes.Pop();
+        TEST_EQUAL(scopes.Depth(), 0);
+        TEST_EQUAL(*scopes.Lookup(x), 1);
+        TEST(scopes.Lookup(y) == nullptr);
+        scopes.Pop(); // ファイルスコープは抜けない
+        TEST_EQUAL(*scopes.Lookup(x), 1);
+
+        // 表の拡張をまたいでも束縛を保つ
+        std::vector<SymbolID> names;
+        for (int i = 0; i < 200; ++i)
+            names.push_back(symbols.Intern("scope_v" + std::to_string(i)));
+        scopes.Push();
+        bool all = true;
+        for (int i = 0; i < 200; ++i)
+            all = scopes.Declare(names[i], i) && all;
+        for (int i = 0; i < 200; ++i)
+            all = all && *scopes.Lookup(names[i]) == i;
+        TEST(all);
+        scopes.Pop();
+        TEST(scopes.Lookup(names[0]) == nullptr);
+
+        int count = 0;
+        scopes.ForEach(0, [&](SymbolID name, int value) { count += (name == x && value == 1); });
+        TEST_EQUAL(count, 1);
+    }
+
+    void Trace_Test()
+    {
+        // 無効なトレースは引数を評価しない
+        int evaluated = 0;
+        TRACE_TOKEN(std::to_string(++evaluated));
+        TEST_EQUAL(evaluated, KCC_TRACE_LEVEL >= KCC_TRACE_TOKEN ? 1 : 0);
+
+        TraceBuffer trace;
+        trace.Record(KCC_TRACE_CALL, TraceBuffer::kEnter, "a.cc", 1, "Parse");
+        trace.Record(KCC_TRACE_DEBUG, TraceBuffer::kMessage, "a.cc", 2, std::string("x = 1"));
+        trace.Record(KCC_TRACE_CALL, TraceBuffer::kLeave, "a.cc", 3, "Parse");
+        std::ostringstream os;
+        trace.Dump(os);
+        TEST_EQUAL(os.str(), "a.cc(1) : Parse\n"
+                             " a.cc(2) : x = 1\n"
+                             "a.cc(3) : Parse-> out\n");
+
+        // 一杯になると古いものから上書きする. 長いテキストは切り詰める
+        for (size_t i = 0; i < TraceBuffer::kCapacity; ++i)
+            trace.Record(KCC_TRACE_DEBUG, TraceBuffer::kMessage, "b.cc", static_cast<int>(i), std::string(200, 'x'));
+        os.str("");
+        trace.Dump(os);
+        std::string dump = os.str();
+        TEST_EQUAL(std::count(dump.begin(), dump.end(), '\n'), TraceBuffer::kCapacity);
+        TEST_EQUAL(dump.compare(0, 10, "b.cc(0) : "), 0);
+        TEST_EQUAL(dump.find('\n'), 10 + TraceBuffer::kTextSize);
+
+        // 複数のスレッドから同時に記録する
+        ThreadPool pool(4);
+        const uint64_t before = trace.RecordCount();
+        pool.ParallelFor(1000, [&trace](size_t i) {
+            trace.Record(KCC_TRACE_DEBUG, TraceBuffer::kMessage, "c.cc", static_cast<int>(i), "msg");
+        });
+        TEST_EQUAL(trace.RecordCount(), before + 1000);
+        os.str("");
+        trace.Dump(os);
+        dump = os.str();
+        TEST_EQUAL(std::count(dump.begin(), dump.end(), '\n'), TraceBuffer::kCapacity);
+    }
+
+    void TypeTable_Test()
+    {
+        SymbolTable &symbols = GlobalSymbols();
+        TypeTable types;
+        const TypeID c = types.Basic(symbols.Intern("char"), 1);
+        const TypeID i = types.Basic(symbols.Intern("int"), 8);
+        TEST(c != kNoType);
+        TEST_EQUAL(types.Basic(symbols.Intern("int"), 4), i);
+
+        // 同じ型は同じ ID になる
+        const TypeID pc = types.PointerTo(c);
+        TEST_EQUAL(types.PointerTo(c), pc);
+        TEST(types.PointerTo(i) != pc);
+        TEST_EQUAL(types.PointerTo(pc), types.PointerTo(types.PointerTo(c)));
+        TEST_EQUAL(types.ArrayOf(i, 4), types.ArrayOf(i, 4));
+        TEST(types.ArrayOf(i, 4) != types.ArrayOf(i, 5));
+        TEST_EQUAL(types.size(), 7);
+
+        TEST_EQUAL(types.Name(types.PointerTo(pc)), "char**");
+        TEST_EQUAL(types.Name(types.ArrayOf(i, 4)), "int[4]");
+        TEST_EQUAL(types[types.ArrayOf(c, 3)].size, 3);
+        TEST_EQUAL(types[pc].size, TypeTable::kPointerSize);
+
+        // 構造体のメンバは大きさの境界に揃える
+        const SymbolID a = symbols.Intern("type_a"), b = symbols.Intern("type_b"), d = symbols.Intern("type_d");
+        const TypeID s = types.NewStruct(symbols.Intern("type_s"), {{a, c}, {b, i}, {d, types.ArrayOf(c, 3)}});
+        TEST_EQUAL(types.Name(s), "struct type_s");
+        TEST_EQUAL(types[s].size, 24);
+        TEST_EQUAL(types.MembersEnd(s) - types.MembersBegin(s), 3);
+        TEST_EQUAL(types.FindMember(s, b)->offset, 8);
+        TEST_EQUAL(types.FindMember(s, d)->offset, 16);
+        TEST_EQUAL(types.FindMember(s, d)->type, types.ArrayOf(c, 3));
+        TEST(types.FindMember(s, symbols.Intern("type_x")) == nullptr);
+
+        // 構造体は定義ごとに別の型
+        TEST(types.NewStruct(symbols.Intern("type_s"), {{a, c}}) != s);
+    }
+
+    void SpliceLines_Test()
+    {
+        // 継続を取り除いた分は論理行の末尾に空白と改行で補い、後ろの行の位置は変えない
+        std::string src = "#define A \\\n  1 \\\r\n+ 2\nx\n";
+        TEST(FindLineSplice(src.data(), src.data() + src.size()) == src.data() + 10);
+        std::string out;
+        SpliceLines(src.data(), src.size(), &out);
+        TEST_EQUAL(out, "#define A   1 + 2  \n\n\r\nx\n");
+        TEST_EQUAL(out.size(), src.size());
+
+        // 継続は文字列リテラル・エスケープより前に取り除くので、\\ + 改行 の 2 つ目の \ も継続になる
+        src = "a \\\\\n\\ b\n";
+        SpliceLines(src.data(), src.size(), &out);
+        TEST_EQUAL(out, "a \\\\ b \n\n");
+
+        // 継続のない入力
+        src = "a \\ b\n";
+        TEST(FindLineSplice(src.data(), src.data() + src.size()) == nullptr);
+
+        // 継続で終わる入力
+        src = "a\\\n";
+        SpliceLines(src.data(), src.size(), &out);
+        TEST_EQUAL(out, "a \n");
+    }
+
+    void LineTable_Test()
+    {
+        std::vector<char> inp = PrepareInput("ab\ncd\r\nef\rgh\n\r\nij");
+
+        LineTable lines;
+        TEST_EQUAL(lines.Line(0), 0);
+
+        lines.Reset(inp.data(), inp.size());
+        TEST_EQUAL(lines.Line(0), 1);
+        TEST_EQUAL(lines.Line(2), 1);  // LF
+        TEST_EQUAL(lines.Line(3), 2);  // c
+        TEST_EQUAL(lines.Line(6), 2);  // CR+LF の LF
+        TEST_EQUAL(lines.Line(7), 3);  // e
+        TEST_EQUAL(lines.Line(10), 4); // g
+        TEST_EQUAL(lines.Line(13), 5); // 空行の CR
+        TEST_EQUAL(lines.Line(15), 6); // i
+        TEST_EQUAL(lines.Column(1), 2);
+        TEST_EQUAL(lines.Column(11), 2);
+        TEST_EQUAL(lines.Column(16), 2);
+    }
+
+    // doc のトークンが、ソース全体を字句解析し直した結果と同一であること
+    bool SameAsFullTokenize(const TokenDocument &doc)
+    {
+        std::string text = doc.Text();
+        std::vector<char> buf(text.begin(), text.end());
+        std::vector<Token> expected;
+        Tokenizer full;
+        full.Tokenize(buf, &expected);
+
+        bool ok = (doc.size() == expected.size() && doc.TextSize() == buf.size());
+        for (size_t i = 0; ok && i < expected.size(); ++i)
+        {
+            const Token tok = doc.At(i);
+            ok &= tok.token == expected[i].token && tok.type == expected[i].type && tok.pos == expected[i].pos &&
+                  tok.symbol == expected[i].symbol;
+        }
+        return ok;
+    }
+
+    // 編集後に部分的に字句解析し直した結果が全体の字句解析と同一であること
+    void Retokenize_Test()
+    {
+        // 編集位置より手前のトークンが変わる場合
+        struct
+        {
+            const char *src;
+            size_t offset;
+            size_t length;
+            const char *text;
+        } cases[] = {
+            {"a 1e+ b", 5, 0, "5"},      // 1e+5
+            {"a .. b", 4, 0, "."},       // ...
+            {"a / *x*/ b", 3, 1, ""},    // コメントになる
+            {"a /* x */ b", 8, 1, ""},   // コメントが閉じなくなる
+            {"a /* x b", 6, 0, "*/"},    // コメントが閉じる
+            {"ab", 2, 0, "c"}};
+
+        bool ok = true;
+        for (auto &c : cases)
+        {
+            TokenDocument doc;
+            doc.Assign(c.src, std::strlen(c.src));
+            doc.Edit(c.offset, c.length, c.text);
+            ok &= SameAsFullTokenize(doc);
+        }
+        TEST(ok);
+
+        const char *pieces[] = {"int", " ", "a1", "=", "/", "*", "\n", ".", "1e", "+", "5", ">", "\r\n", "x", "\"", "'", "\\"};
+
+        // 小さなチャンクに分け、チャンクの境界をまたぐ編集・結合・分割も試す
+        unsigned int seed = 11;
+        std::string src;
+        for (int i = 0; i < 300; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            src += pieces[(seed >> 16) % 17];
+        }
+        TokenDocument doc(16);
+        doc.Assign(src.data(), src.size());
+        TEST(doc.ChunkCount() > 1);
+
+        for (int round = 0; round < 500; ++round)
+        {
+            seed = seed * 1103515245 + 12345;
+            size_t size = doc.TextSize();
+            size_t offset = (seed >> 8) % (size + 1);
+            size_t length = std::min<size_t>((seed >> 4) % (round % 5 == 0 ? 40 : 4), size - offset);
+            const char *text = pieces[(seed >> 16) % 17];
+            if (round % 3 == 0)
+                text = "";
+
+            doc.Edit(offset, length, text);
+            ok &= SameAsFullTokenize(doc);
+        }
+        TEST(ok);
+
+        // 1 文字の編集では周辺のトークンだけを字句解析し直し、他のチャンクには触れない
+        std::string large;
+        for (int i = 0; i < 1000; ++i)
+            large += "x" + std::to_string(i) + " = y + 1;\n";
+        TokenDocument big(256);
+        big.Assign(large.data(), large.size());
+        size_t count = big.size();
+        size_t chunks = big.ChunkCount();
+        TEST(chunks > 1);
+
+        // "x500" の直後に挿入すると "x500z" だけを字句解析し直す
+        size_t offset = large.find("x500 ") + 4;
+        TEST_EQUAL(big.Edit(offset, 0, "z"), 1);
+        TEST_EQUAL(big.size(), count);
+        TEST_EQUAL(big.ChunkCount(), chunks);
+        TEST_EQUAL(big.At(500 * 6).token, "x500z");
+        TEST_EQUAL(big.At(count - 1).pos, large.size() - 1);
+        TEST(SameAsFullTokenize(big));
+
+        // 閉じないコメントはチャンクの境界を越えて後ろをすべて字句解析し直し、閉じれば元に戻る
+        big.Edit(0, 0, "/*");
+        TEST_EQUAL(big.size(), 0);
+        TEST(SameAsFullTokenize(big));
+        big.Edit(0, 2, "");
+        TEST_EQUAL(big.size(), count);
+        TEST(big.ChunkCount() > 1);
+        TEST(SameAsFullTokenize(big));
+        TEST_EQUAL(big.Text(), large.insert(large.find("x500 ") + 4, "z"));
+    }
 };
 
 } // namespace kcc2
@@ -0,0 +1,137 @@
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kcc
+{
+
+// 固定数のワーカースレッドで処理を並列実行するスレッドプール
+class ThreadPool
+{
+  public:
+    // num_threads == 0 の場合はハードウェアスレッド数を使う
+    explicit ThreadPool(size_t num_threads = 0)
+        : job_(nullptr), job_size_(0), next_(0), active_(0), generation_(0), stop_(false)
+    {
+        if (num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0)
+            num_threads = 1;
+
+        // 呼び出し元のスレッドも処理に参加するので 1 つ少なく起動する
+        for (size_t i = 1; i < num_threads; ++i)
+            workers_.emplace_back([this]() { Worker(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto &w : workers_)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // 処理に参加するスレッド数
+    size_t Size() const { return workers_.size() + 1; }
+
+    // fn(i) を i = 0 .. n-1 について並列に実行し、すべて終わるまで待つ.
+    // fn が例外を投げた場合は最初の例外をここで再送出する.
+    void ParallelFor(size_t n, const std::function<void(size_t)> &fn)
+    {
+        if (n == 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &fn;
+            job_size_ = n;
+            next_ = 0;
+            active_ = workers_.size();
+            error_ = nullptr;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+
+        Run(fn, n);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return active_ == 0; });
+        job_ = nullptr;
+
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+  private:
+    void Worker()
+    {
+        unsigned long long seen = 0;
+        for (;;)
+        {
+            const std::function<void(size_t)> *job;
+            size_t n;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_cv_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+                if (stop_)
+                    return;
+                seen = generation_;
+                job = job_;
+                n = job_size_;
+            }
+
+            Run(*job, n);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--active_ == 0)
+                done_cv_.notify_all();
+        }
+    }
+
+    void Run(const std::function<void(size_t)> &fn, size_t n)
+    {
+        for (size_t i = next_++; i < n; i = next_++)
+        {
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_)
+                    error_ = std::current_exception();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+
+    const std::function<void(size_t)> *job_;
+    size_t job_size_;
+    std::atomic<size_t> next_;
+    size_t active_;
+    unsigned long long generation_;
+    bool stop_;
+    std::exception_ptr error_;
+};
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef TOKEN_ARRAY_HH
+#define TOKEN_ARRAY_HH
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "line_table.hh"
+#include "tokenizer.hh"
+#include "util.hh"
+
+namespace kcc
+{
+
+static_assert(tkNull <= std::numeric_limits<uint8_t>::max(), "TokenType must fit in uint8_t");
+
+// 字句解析済みのトークン列 (struct of arrays)
+// トークンの種別・位置・長さ・シンボル ID を別々の配列に持つ. 数値・文字列リテラルの値は別の配列に出現順に持つ. 種別だけを見る先読みは 1 トークン 1 byte で済む.
+// 行番号は保持せず、必要になった時点で LineTable から求める.
+class TokenArray
+{
+  public:
+    TokenArray() : src_(nullptr) {}
+
+    // src を字句解析してトークン列を作る
+    // src はこのオブジェクトより長く生存させること
+    void Build(const char *src, size_t size)
+    {
+        Tokenizer tzr;
+        Build(src, size, &tzr);
+    }
+
+    // 設定済みの Tokenizer (シンボルテーブル等) で字句解析する
+    void Build(const char *src, size_t size, Tokenizer *tzr)
+    {
+        Reset(src, size);
+
+        tzr->Init(src, size);
+        Token tok;
+        while (tzr->Next(&tok))
+            Append(tok);
+    }
+
+    // 空のトークン列にして入力バッファを設定する
+    void Reset(const char *src, size_t size)
+    {
+        src_ = src;
+        types_.clear();
+        offsets_.clear();
+        lengths_.clear();
+        extra_.clear();
+        numbers_.clear();
+        lines_.Reset(src, size);
+    }
+
+    // tok は Reset で設定したバッファのトークンであること
+    void Append(const Token &tok)
+    {
+        types_.push_back(static_cast<uint8_t>(tok.type));
+        offsets_.push_back(tok.pos);
+        lengths_.push_back(static_cast<uint32_t>(tok.token.size()));
+        if (HasValue(tok.type))
+        {
+            extra_.push_back(static_cast<uint32_t>(numbers_.size()));
+            numbers_.push_back({tok.value, tok.number_flags});
+        }
+        else
+        {
+            extra_.push_back(tok.symbol);
+        }
+    }
+
+    size_t size() const { return types_.size(); }
+    bool empty() const { return types_.empty(); }
+
+    TokenType Type(size_t i) const { return static_cast<TokenType>(types_[i]); }
+    uint32_t Offset(size_t i) const { return offsets_[i]; }
+    StringRef Text(size_t i) const { return StringRef(src_ + offsets_[i], lengths_[i]); }
+    SymbolID Symbol(size_t i) const { return HasValue(Type(i)) ? kNoSymbol : extra_[i]; }
+
+    // リテラルの値. i は数値・文字列リテラルのトークンであること
+    NumberValue Value(size_t i) const { return numbers_[extra_[i]].value; }
+    uint8_t NumberFlags(size_t i) const { return numbers_[extra_[i]].flags; }
+
+    // 行番号 (1 始まり). 初回呼び出し時に行頭位置の表を作る
+    size_t Line(size_t i) { return lines_.Line(offsets_[i]); }
+
+    Token At(size_t i) const
+    {
+        Token tok = {Text(i), Type(i), Offset(i), Symbol(i), 0, {0}};
+        if (HasValue(tok.type))
+        {
+            tok.value = Value(i);
+            tok.number_flags = NumberFlags(i);
+        }
+        return tok;
+    }
+
+  private:
+    struct NumberLiteral
+    {
+        NumberValue value;
+        uint8_t flags;
+    };
+
+    static bool HasValue(TokenType type)
+    {
+        return type == tkDecimal || type == tkHexDecimal || type == tkFloatNumber ||
+               type == tkString || type == tkCharacter;
+    }
+
+    const char *src_;
+
+    std::vector<uint8_t> types_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> lengths_;
+    std::vector<uint32_t> extra_; // 識別子はシンボル ID, リテラルは numbers_ の添字
+    std::vector<NumberLiteral> numbers_;
+
+    LineTable lines_;
+};
+
+} // namespace kcc
+
+#endif
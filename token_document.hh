@@ -0,0 +1,211 @@
+#ifndef TOKEN_DOCUMENT_HH
+#define TOKEN_DOCUMENT_HH
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "tokenizer.hh"
+
+namespace kcc
+{
+
+// エディタ連携用の、編集できるソースとその字句解析結果
+// ソースを chunk_size バイト程度のチャンクに分け、チャンクごとにテキストとトークンを持つ.
+// トークンの位置はチャンクの先頭からの相対位置なので、編集では編集したチャンクだけを書き換えて字句解析し直し、
+// 後ろのチャンクは先頭の位置とトークン番号をずらすだけで済む (手間はチャンク数に比例する).
+// チャンクの境界は、直前が空白であるトークンの先頭に置く. 境界をまたぐトークン・コメントはなく、
+// 先読みも境界を越えないので、チャンクは互いに独立に字句解析できる.
+class TokenDocument
+{
+  public:
+    static const size_t kDefaultChunkSize = 4096;
+
+    explicit TokenDocument(size_t chunk_size = kDefaultChunkSize) : chunk_size_(chunk_size), count_(0)
+    {
+        chunks_.emplace_back();
+    }
+
+    TokenDocument(const TokenDocument &) = delete;
+    TokenDocument &operator=(const TokenDocument &) = delete;
+
+    // ソース全体を置き換えて字句解析する
+    void Assign(const char *src, size_t size)
+    {
+        chunks_.assign(1, Chunk());
+        chunks_[0].text.assign(src, src + size);
+        Tokenizer tzr;
+        tzr.Tokenize(chunks_[0].text, &chunks_[0].tokens);
+        Split(0);
+        Renumber(0);
+    }
+
+    // ソースの [offset, offset + length) を text で置き換え、編集したチャンクを字句解析し直す
+    //   戻り値 : 字句解析し直したトークン数
+    size_t Edit(size_t offset, size_t length, const std::string &text)
+    {
+        // 編集範囲が複数のチャンクにまたがる場合はつなげる
+        const size_t c = FindChunk(offset);
+        Merge(c, FindChunk(offset + length) - c);
+
+        Chunk &chunk = chunks_[c];
+        const size_t local = offset - chunk.base;
+        if (text.size() > length)
+            chunk.text.insert(chunk.text.begin() + local + length, text.size() - length, '\0');
+        else
+            chunk.text.erase(chunk.text.begin() + local + text.size(), chunk.text.begin() + local + length);
+        std::copy(text.begin(), text.end(), chunk.text.begin() + local);
+
+        Tokenizer tzr;
+        bool synced = false;
+        size_t lexed = tzr.Retokenize(chunk.text.data(), chunk.text.size(), {local, length, text.size()},
+                                      &chunk.tokens, &synced);
+
+        // チャンクの終端まで一致しなければ、後ろのチャンクをつなげて境界から字句解析し直す.
+        // 閉じないコメント等で一致しない間はつなげる数を倍にしていき、字句解析し直す量をソースの長さ程度に抑える
+        for (size_t n = 1; !synced && c + 1 < chunks_.size(); n *= 2)
+        {
+            const size_t boundary = chunks_[c].text.size();
+            Merge(c, std::min(n, chunks_.size() - c - 1));
+            lexed += tzr.Retokenize(chunks_[c].text.data(), chunks_[c].text.size(), {boundary, 0, 0},
+                                    &chunks_[c].tokens, &synced);
+        }
+
+        Split(c);
+        Renumber(c);
+        return lexed;
+    }
+
+    // トークン数
+    size_t size() const { return count_; }
+
+    // i 番目のトークン. pos はソースの先頭からの位置. token は次の編集まで有効
+    Token At(size_t i) const
+    {
+        auto it = std::upper_bound(chunks_.begin(), chunks_.end(), i,
+                                   [](size_t index, const Chunk &chunk) { return index < chunk.first; }) - 1;
+        Token tok = it->tokens[i - it->first];
+        tok.pos = static_cast<uint32_t>(tok.pos + it->base);
+        return tok;
+    }
+
+    // ソースのバイト数
+    size_t TextSize() const { return chunks_.back().base + chunks_.back().text.size(); }
+
+    // ソース全体
+    std::string Text() const
+    {
+        std::string text;
+        text.reserve(TextSize());
+        for (auto &chunk : chunks_)
+            text.append(chunk.text.begin(), chunk.text.end());
+        return text;
+    }
+
+    // チャンク数
+    size_t ChunkCount() const { return chunks_.size(); }
+
+  private:
+    struct Chunk
+    {
+        Chunk() : base(0), first(0) {}
+
+        size_t base;               // ソースの先頭からの位置
+        size_t first;              // 先頭のトークンの通し番号
+        std::vector<char> text;    // チャンクのテキスト
+        std::vector<Token> tokens; // pos はチャンクの先頭からの位置. token は text を参照する
+    };
+
+    // offset を含むチャンク. チャンクの境界であれば手前のチャンク
+    size_t FindChunk(size_t offset) const
+    {
+        auto it = std::lower_bound(chunks_.begin(), chunks_.end(), offset,
+                                   [](const Chunk &chunk, size_t offset) { return chunk.base < offset; });
+        return (it == chunks_.begin()) ? 0 : static_cast<size_t>(it - chunks_.begin()) - 1;
+    }
+
+    // c 番目のチャンクに後ろの count 個のチャンクをつなげる
+    void Merge(size_t c, size_t count)
+    {
+        if (count == 0)
+            return;
+
+        Chunk &chunk = chunks_[c];
+        for (size_t i = c + 1; i <= c + count; ++i)
+        {
+            const size_t at = chunk.text.size();
+            chunk.text.insert(chunk.text.end(), chunks_[i].text.begin(), chunks_[i].text.end());
+            for (auto &tok : chunks_[i].tokens)
+            {
+                tok.pos = static_cast<uint32_t>(tok.pos + at);
+                chunk.tokens.push_back(tok);
+            }
+        }
+        for (auto &tok : chunk.tokens)
+            tok.token = StringRef(chunk.text.data() + tok.pos, tok.token.size());
+        chunks_.erase(chunks_.begin() + c + 1, chunks_.begin() + c + 1 + count);
+    }
+
+    // c 番目のチャンクが大きくなりすぎていれば chunk_size_ 程度ずつに分ける
+    // 分ける位置は、直前が空白で前後が chunk_size_ 以上になるトークンの先頭
+    void Split(size_t c)
+    {
+        if (chunks_[c].text.size() <= 2 * chunk_size_)
+            return;
+
+        const Chunk whole = std::move(chunks_[c]);
+        std::vector<Chunk> pieces;
+        size_t at = 0;    // 次に分けるチャンクの先頭の位置
+        size_t first = 0; // 次に分けるチャンクの先頭のトークン
+        for (size_t i = 0; i <= whole.tokens.size(); ++i)
+        {
+            size_t end = whole.text.size();
+            if (i < whole.tokens.size())
+            {
+                end = whole.tokens[i].pos;
+                if (end - at < chunk_size_ || whole.text.size() - end < chunk_size_ ||
+                    !(CharFlags(whole.text[end - 1]) & (ccSpace | ccNewline)))
+                    continue;
+            }
+
+            Chunk piece;
+            piece.text.assign(whole.text.begin() + at, whole.text.begin() + end);
+            piece.tokens.assign(whole.tokens.begin() + first, whole.tokens.begin() + i);
+            for (auto &tok : piece.tokens)
+            {
+                tok.pos = static_cast<uint32_t>(tok.pos - at);
+                tok.token = StringRef(piece.text.data() + tok.pos, tok.token.size());
+            }
+            pieces.push_back(std::move(piece));
+            at = end;
+            first = i;
+        }
+
+        pieces[0].base = whole.base;
+        pieces[0].first = whole.first;
+        chunks_[c] = std::move(pieces[0]);
+        chunks_.insert(chunks_.begin() + c + 1, std::make_move_iterator(pieces.begin() + 1),
+                       std::make_move_iterator(pieces.end()));
+    }
+
+    // c 番目より後ろのチャンクの先頭の位置とトークン番号を求め直す
+    void Renumber(size_t c)
+    {
+        for (++c; c < chunks_.size(); ++c)
+        {
+            const Chunk &prev = chunks_[c - 1];
+            chunks_[c].base = prev.base + prev.text.size();
+            chunks_[c].first = prev.first + prev.tokens.size();
+        }
+        count_ = chunks_.back().first + chunks_.back().tokens.size();
+    }
+
+    size_t chunk_size_;
+    size_t count_;
+    std::vector<Chunk> chunks_;
+};
+
+} // namespace kcc
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef TOKEN_STREAM_HH
+#define TOKEN_STREAM_HH
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "token_array.hh"
+#include "tokenizer.hh"
+
+namespace kcc
+{
+
+// 構文解析器へトークンを供給するストリーム
+// 入力全体を先に字句解析せず、先読みで必要になった分だけ Tokenizer から取り出す.
+// 取り出したトークンは固定長のリングバッファに保持するので、
+// 入力サイズによらずトークン用のメモリは一定になる.
+//
+// リングには常にカーソルから kMaxLookahead 個先までのトークンが入っている.
+// 入力の終端から先は種別が tkEof の番兵で埋めるので、先読みは範囲の検査も例外もなく
+// リングの要素への参照を返すだけで済む. 字句解析 (取り出し) はカーソルを進める Fwd で、
+// まだリングに入っていない範囲についてだけ行う (後戻りした分を進め直してもリングは書き換えない).
+//
+//   先読み     : Peek(n) (n < kMaxLookahead). 参照は Fwd で kMaxLookahead 個進むまで有効
+//   後戻り     : Bwd(n)  (n <= kMaxBacktrack)
+//
+// 字句解析済みのトークン列 (std::vector<Token>, TokenArray) をそのまま供給することもできる.
+// その場合はリングを使わずに列を直接読む. TokenArray の種別の先読みは種別の配列だけを見て、
+// Token への展開は Peek で要求されたトークンについてだけ行う.
+// 列の一部だけを別のストリームで読むこともできる (Slice. 並列構文解析用).
+// また任意の位置へカーソルを移せる (Seek. 関数本体の遅延構文解析用).
+class TokenStream
+{
+  public:
+    // リングバッファのサイズ (2 のべき乗)
+    static const size_t kWindowSize = 64;
+    static const size_t kMaxLookahead = kWindowSize / 2;
+    static const size_t kMaxBacktrack = kWindowSize - kMaxLookahead;
+
+    TokenStream()
+        : stored_(nullptr), array_(nullptr), array_offset_(0), stored_size_(0), cursor_(0), filled_(0), eof_(true)
+    {
+        Prime(0);
+    }
+
+    TokenStream(const TokenStream &) = delete;
+    TokenStream &operator=(const TokenStream &) = delete;
+
+    // ソースバッファから逐次字句解析する
+    // src はストリームとそこから取り出したトークンより長く生存させること
+    void Open(const char *src, size_t size)
+    {
+        tokenizer_.Init(src, size);
+        stored_ = nullptr;
+        array_ = nullptr;
+        array_offset_ = 0;
+        stored_size_ = 0;
+        eof_ = false;
+        Prime(static_cast<uint32_t>(size));
+    }
+
+    // 字句解析済みのトークン列を供給する
+    void Assign(const std::vector<Token> &tokens)
+    {
+        const Token *last = tokens.empty() ? nullptr : &tokens.back();
+        AssignStored(tokens.data(), nullptr, 0, tokens.size(),
+                     last ? last->pos + static_cast<uint32_t>(last->token.size()) : 0);
+    }
+
+    void Assign(TokenArray &tokens)
+    {
+        const size_t n = tokens.size();
+        AssignStored(nullptr, &tokens, 0, n, n ? EndOf(tokens, n - 1) : 0);
+    }
+
+    // whole の [begin, end) 番目のトークンを供給する. whole は字句解析済みのトークン列を供給していること
+    // whole が参照しているトークン列はこのストリームより長く生存させること
+    void Slice(const TokenStream &whole, size_t begin, size_t end)
+    {
+        const uint32_t eof = (begin == end) ? 0 : whole.EndOfStored(end - 1);
+        if (whole.stored_)
+            AssignStored(whole.stored_ + begin, nullptr, 0, end - begin, eof);
+        else
+            AssignStored(nullptr, whole.array_, whole.array_offset_ + begin, end - begin, eof);
+    }
+
+    // 字句解析済みのトークン列を供給しているか
+    bool IsStored() const { return stored_ || array_; }
+
+    // 字句解析済みのトークン列の長さと i 番目のトークン (カーソルによらない)
+    size_t StoredSize() const { return stored_size_; }
+
+    TokenType StoredType(size_t i) const
+    {
+        return stored_ ? stored_[i].type : array_->Type(array_offset_ + i);
+    }
+
+    Token StoredToken(size_t i) const
+    {
+        return stored_ ? stored_[i] : array_->At(array_offset_ + i);
+    }
+
+    // カーソル位置から n 個先のトークン (入力の終端から先は tkEof)
+    const Token &Peek(size_t n = 0) const
+    {
+        assert(n < kMaxLookahead);
+        const uint64_t i = cursor_ + n;
+        if (stored_)
+            return (i < stored_size_) ? stored_[i] : eof_token_;
+        if (array_)
+            return Unpack(i);
+        return ring_[i & (kWindowSize - 1)];
+    }
+
+    // カーソル位置から n 個先のトークンの種別
+    TokenType PeekType(size_t n = 0) const
+    {
+        assert(n < kMaxLookahead);
+        const uint64_t i = cursor_ + n;
+        if (IsStored())
+            return (i < stored_size_) ? StoredType(i) : tkEof;
+        return ring_[i & (kWindowSize - 1)].type;
+    }
+
+    // カーソル位置から n 個先が入力の終端であるか
+    bool IsEnd(size_t n = 0) const
+    {
+        return PeekType(n) == tkEof;
+    }
+
+    // 終端を越えて進めてもよい (tkEof が続く)
+    void Fwd(size_t n = 1)
+    {
+        if (!IsStored())
+        {
+            while (filled_ < cursor_ + n + kMaxLookahead)
+                FillNext();
+        }
+        cursor_ += n;
+    }
+
+    // 戻り先はリングから追い出されていないこと
+    void Bwd(size_t n = 1)
+    {
+        assert(n <= kMaxBacktrack && n <= cursor_);
+        assert(IsStored() || cursor_ - n + kWindowSize >= filled_);
+        cursor_ -= n;
+    }
+
+    // 先頭からのトークン番号
+    uint64_t Position() const { return cursor_; }
+
+    // カーソルを字句解析済みのトークン列の i 番目 (i <= StoredSize()) へ移す
+    void Seek(size_t i)
+    {
+        assert(IsStored() && i <= stored_size_);
+        eof_ = false;
+        FillFrom(i);
+    }
+
+  private:
+    void AssignStored(const Token *tokens, TokenArray *array, size_t array_offset, size_t size, uint32_t end)
+    {
+        stored_ = tokens;
+        array_ = array;
+        array_offset_ = array_offset;
+        stored_size_ = size;
+        eof_ = false;
+        Prime(end);
+    }
+
+    static uint32_t EndOf(const TokenArray &tokens, size_t i)
+    {
+        return tokens.Offset(i) + static_cast<uint32_t>(tokens.Text(i).size());
+    }
+
+    // 字句解析済みの i 番目のトークンの終わりのバイト位置
+    uint32_t EndOfStored(size_t i) const
+    {
+        return stored_ ? stored_[i].pos + static_cast<uint32_t>(stored_[i].token.size())
+                       : EndOf(*array_, array_offset_ + i);
+    }
+
+    // カーソルを先頭に戻して先読みの範囲を埋める. end は番兵の位置 (入力の終端のバイト位置)
+    void Prime(uint32_t end)
+    {
+        eof_token_ = Token();
+        eof_token_.type = tkEof;
+        eof_token_.pos = end;
+        eof_token_.symbol = kNoSymbol;
+        for (auto &index : unpacked_)
+            index = kNotUnpacked;
+        FillFrom(0);
+    }
+
+    // カーソルを i 番目のトークンに置いて先読みの範囲を埋める
+    void FillFrom(uint64_t i)
+    {
+        cursor_ = i;
+        filled_ = i;
+        if (IsStored())
+            return;
+        for (size_t n = 0; n < kMaxLookahead; ++n)
+            FillNext();
+    }
+
+    // TokenArray の i 番目のトークンを Token に展開する. 展開したトークンはリングに置く
+    // (参照の有効期間は Peek の説明のとおり)
+    const Token &Unpack(uint64_t i) const
+    {
+        if (i >= stored_size_)
+            return eof_token_;
+        const size_t slot = i & (kWindowSize - 1);
+        if (unpacked_[slot] != i)
+        {
+            ring_[slot] = array_->At(array_offset_ + i);
+            unpacked_[slot] = i;
+        }
+        return ring_[slot];
+    }
+
+    // filled_ 番目のトークンをリングに入れる (ソースバッファから逐次字句解析する場合). 入力の終端から先は番兵
+    void FillNext()
+    {
+        Token &slot = ring_[filled_ & (kWindowSize - 1)];
+        if (eof_ || !tokenizer_.Next(&slot))
+        {
+            eof_ = true;
+            slot = eof_token_;
+        }
+        ++filled_;
+    }
+
+    static const uint64_t kNotUnpacked = ~static_cast<uint64_t>(0);
+
+    Tokenizer tokenizer_;
+    mutable Token ring_[kWindowSize];
+    mutable uint64_t unpacked_[kWindowSize]; // TokenArray を供給しているとき、リングの各要素に展開したトークン番号
+    Token eof_token_;
+
+    // 字句解析済みのトークン列 (Assign 時)
+    const Token *stored_;
+    TokenArray *array_;
+    size_t array_offset_; // Slice した TokenArray の先頭
+    size_t stored_size_;
+
+    uint64_t cursor_; // 現在のトークン番号
+    uint64_t filled_; // リングに入れたトークン数 (cursor_ + kMaxLookahead 以上. 字句解析済みのトークン列の供給時は使わない)
+    bool eof_;
+};
+
+} // namespace kcc
+
+#endif
@@ -1,11 +1,19 @@
 #ifndef TOKENIZER2_HH
 #define TOKENIZER2_HH
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "literal.hh"
+#include "number.hh"
+#include "scan.hh"
+#include "symbol.hh"
 #include "util.hh"
 
 #define ERROR(str) \
@@ -20,16 +28,25 @@ enum TokenType
     tkHexDecimal,
     tkFloatNumber,
     tkWord,
+    tkString,    // "..."  (value.integer はリテラルプールの ID)
+    tkCharacter, // '...'  (value.integer は文字定数の値)
 
     // 記号
-    tkOpenBrace,   // {
-    tkCloseBrace,  // }
-    tkOpenParent,  // (
-    tkCloseParent, // )
-    tkAsterisk,    // *
-    tkSlash,       // /
-    tkColon,       // :
-    tkSemicolon,   // ;
+    tkOpenBrace,    // {
+    tkCloseBrace,   // }
+    tkOpenParent,   // (
+    tkCloseParent,  // )
+    tkOpenBracket,  // [
+    tkCloseBracket, // ]
+    tkAsterisk,     // *
+    tkSlash,        // /
+    tkPercent,      // %
+    tkColon,        // :
+    tkSemicolon,    // ;
+    tkComma,        // ,
+    tkDot,          // .
+    tkEllipsis,     // ...
+    tkArrow,        // ->
 
     tkQuestion,  // ?
     tkPlus,      // +
@@ -37,10 +54,36 @@ enum TokenType
     tkMinus,     // -
     tkDecrement, // --
 
-    tkNot,         // !
-    tkQuote,       // '
-    tkDoubleQuote, // "
-    tkEqual,        // =
+    tkNot,          // !
+    tkTilde,        // ~
+    tkAmpersand,    // &
+    tkBar,          // |
+    tkCaret,        // ^
+    tkLogicalAnd,   // &&
+    tkLogicalOr,    // ||
+    tkShiftLeft,    // <<
+    tkShiftRight,   // >>
+    tkLess,         // <
+    tkGreater,      // >
+    tkLessEqual,    // <=
+    tkGreaterEqual, // >=
+    tkEqualEqual,   // ==
+    tkNotEqual,     // !=
+    tkHash,         // #
+    tkHashHash,     // ##
+
+    // 代入演算子
+    tkEqual,            // =
+    tkAddAssign,        // +=
+    tkSubAssign,        // -=
+    tkMulAssign,        // *=
+    tkDivAssign,        // /=
+    tkModAssign,        // %=
+    tkAndAssign,        // &=
+    tkOrAssign,         // |=
+    tkXorAssign,        // ^=
+    tkShiftLeftAssign,  // <<=
+    tkShiftRightAssign, // >>=
 
     // 予約語
     tkAuto,
@@ -76,369 +119,747 @@ enum TokenType
     tkVolatile,
     tkWhile,
 
+    tkStray, // どのトークンにもならない文字 (構文解析でエラーにする)
+    tkEof,   // 入力の終端 (TokenStream の番兵)
     tkNull
 };
 
+// ソースバッファ中の文字列を指すビュー (コピーを持たない)
+// 参照先のバッファはコンパイル中ずっと生存している必要がある.
+class StringRef
+{
+  public:
+    StringRef() : data_(nullptr), size_(0) {}
+    StringRef(const char *data, size_t size) : data_(data), size_(size) {}
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t length() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    char operator[](size_t i) const { return data_[i]; }
+
+    std::string str() const { return std::string(data_, size_); }
+    operator std::string() const { return str(); }
+
+    int compare(const char *s, size_t n) const
+    {
+        int r = std::memcmp(data_, s, size_ < n ? size_ : n);
+        if (r != 0)
+            return r;
+        return size_ < n ? -1 : (size_ > n ? 1 : 0);
+    }
+    int compare(const char *s) const { return compare(s, std::strlen(s)); }
+    int compare(const std::string &s) const { return compare(s.data(), s.size()); }
+    int compare(const StringRef &s) const { return compare(s.data(), s.size()); }
+
+  private:
+    const char *data_;
+    size_t size_;
+};
+
+static inline bool operator==(const StringRef &a, const StringRef &b)
+{
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+}
+static inline bool operator==(const StringRef &a, const char *b) { return a == StringRef(b, std::strlen(b)); }
+static inline bool operator==(const StringRef &a, const std::string &b) { return a == StringRef(b.data(), b.size()); }
+static inline bool operator==(const char *a, const StringRef &b) { return b == a; }
+static inline bool operator==(const std::string &a, const StringRef &b) { return b == a; }
+static inline bool operator!=(const StringRef &a, const StringRef &b) { return !(a == b); }
+static inline bool operator!=(const StringRef &a, const char *b) { return !(a == b); }
+static inline bool operator!=(const StringRef &a, const std::string &b) { return !(a == b); }
+
+static inline std::string operator+(const std::string &a, const StringRef &b) { return std::string(a).append(b.data(), b.size()); }
+static inline std::string operator+(const char *a, const StringRef &b) { return std::string(a).append(b.data(), b.size()); }
+static inline std::string operator+(const StringRef &a, const std::string &b) { return a.str() + b; }
+static inline std::string operator+(const StringRef &a, const char *b) { return a.str() + b; }
+
+static inline std::ostream &operator<<(std::ostream &os, const StringRef &s)
+{
+    return os.write(s.data(), s.size());
+}
+
 struct Token
 {
-    std::string token;
+    StringRef token;
     TokenType type;
-    int line;
-    int pos;
+    uint32_t pos;    // 先頭からのバイト位置. 行番号は LineTable で求める
+    SymbolID symbol; // 識別子のシンボル ID (識別子以外は kNoSymbol)
+
+    // 数値・文字定数の値とサフィックス・オーバーフロー等のフラグ (NumberFlag)
+    // 文字列リテラルは value.integer にリテラルプールの ID を持つ
+    uint8_t number_flags;
+    NumberValue value;
 
     std::string ToString() {
-        return "struct Token { token=" + token + ", type=" + std::to_string(type) + ", line=" + std::to_string(line) + ", pos=" + std::to_string(pos) + " }";
+        return "struct Token { token=" + token + ", type=" + std::to_string(type) + ", pos=" + std::to_string(pos) + " }";
     }
 };
 
-static inline bool IsPrintable(char c)
+// ソースの編集
+// 編集前の [offset, offset + removed) を inserted バイトの文字列で置き換えたことを表す
+struct SourceEdit
 {
-    if (0x21 <= c && c <= 0x7e)
-        return true;
-    return false;
+    size_t offset;
+    size_t removed;
+    size_t inserted;
+};
+
+// 文字クラス (ビットフラグ)
+enum CharClass
+{
+    ccSpace = 1 << 0,   // SP, HT, VT, FF
+    ccNewline = 1 << 1, // CR, LF
+    ccDigit = 1 << 2,   // 0-9
+    ccAlpha = 1 << 3,   // a-z, A-Z, _
+    ccHex = 1 << 4,     // 0-9, a-f, A-F
+    ccPunct = 1 << 5,   // 演算子・区切り記号
+    ccQuote = 1 << 6,   // ', "
+};
+
+static const char *kPunctChars = "{}()[]*/%:;,.?+-!~&|^<>=#";
+
+// 256 エントリの文字クラステーブル
+struct CharTable
+{
+    CharTable()
+    {
+        for (int c = 0; c < 256; ++c)
+        {
+            unsigned char f = 0;
+            if (c == ' ' || c == '\t' || c == '\v' || c == '\f')
+                f |= ccSpace;
+            if (c == '\r' || c == '\n')
+                f |= ccNewline;
+            if ('0' <= c && c <= '9')
+                f |= ccDigit | ccHex;
+            if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_')
+                f |= ccAlpha;
+            if (('a' <= c && c <= 'f') || ('A' <= c && c <= 'F'))
+                f |= ccHex;
+            if (c != 0 && std::strchr(kPunctChars, c))
+                f |= ccPunct;
+            if (c == '\'' || c == '"')
+                f |= ccQuote;
+            flags[c] = f;
+        }
+    }
+
+    unsigned char flags[256];
+};
+
+static const CharTable kCharTable;
+
+static inline unsigned char CharFlags(char c) { return kCharTable.flags[static_cast<unsigned char>(c)]; }
+
+static inline bool IsNumber(char c) { return CharFlags(c) & ccDigit; }
+
+static inline bool IsHexdecimal(char c) { return CharFlags(c) & ccHex; }
+
+// C言語の識別子として使える文字を判定
+static inline bool IsWord(char c) { return CharFlags(c) & (ccAlpha | ccDigit); }
+
+// 予約語テーブル
+// 予約語は KeywordHash による完全ハッシュで 64 スロットに衝突なく配置してあり、
+// 識別子 1 つにつき高々 1 回の memcmp で予約語かどうかを判定できる.
+struct KeywordEntry
+{
+    const char *word;
+    unsigned int length;
+    TokenType type;
+};
+
+// 先頭文字・末尾文字・長さから求めるハッシュ値 (n >= 1)
+constexpr unsigned int KeywordHash(const char *s, size_t n)
+{
+    return (static_cast<unsigned char>(s[0]) * 54u +
+            static_cast<unsigned char>(s[n - 1]) +
+            static_cast<unsigned int>(n)) & 63u;
 }
 
-static inline bool IsNumber(char c) { return ('0' <= c && c <= '9'); }
+static const size_t kKeywordTableSize = 64;
+static const size_t kKeywordMinLength = 2;
+static const size_t kKeywordMaxLength = 8;
+
+#define KEYWORD(word, type) {word, sizeof(word) - 1, type}
+#define KEYWORD_NONE {"", 0, tkWord}
+static constexpr KeywordEntry kKeywordTable[kKeywordTableSize] = {
+    KEYWORD("return", tkReturn),     // 0
+    KEYWORD_NONE,                    // 1
+    KEYWORD("extern", tkExtern),     // 2
+    KEYWORD("double", tkDouble),     // 3
+    KEYWORD("while", tkWhile),       // 4
+    KEYWORD_NONE,                    // 5
+    KEYWORD("register", tkRegister), // 6
+    KEYWORD_NONE,                    // 7
+    KEYWORD_NONE,                    // 8
+    KEYWORD("do", tkDo),             // 9
+    KEYWORD_NONE,                    // 10
+    KEYWORD("case", tkCase),         // 11
+    KEYWORD("void", tkVoid),         // 12
+    KEYWORD_NONE,                    // 13
+    KEYWORD("if", tkIf),             // 14
+    KEYWORD("continue", tkContinue), // 15
+    KEYWORD_NONE,                    // 16
+    KEYWORD("volatile", tkVolatile), // 17
+    KEYWORD_NONE,                    // 18
+    KEYWORD("default", tkDefault),   // 19
+    KEYWORD_NONE,                    // 20
+    KEYWORD_NONE,                    // 21
+    KEYWORD_NONE,                    // 22
+    KEYWORD_NONE,                    // 23
+    KEYWORD("char", tkChar),         // 24
+    KEYWORD_NONE,                    // 25
+    KEYWORD("unsigned", tkUnsigned), // 26
+    KEYWORD("const", tkConst),       // 27
+    KEYWORD("break", tkBreak),       // 28
+    KEYWORD("int", tkInt),           // 29
+    KEYWORD_NONE,                    // 30
+    KEYWORD_NONE,                    // 31
+    KEYWORD_NONE,                    // 32
+    KEYWORD("union", tkUnion),       // 33
+    KEYWORD_NONE,                    // 34
+    KEYWORD_NONE,                    // 35
+    KEYWORD_NONE,                    // 36
+    KEYWORD("typedef", tkTypedef),   // 37
+    KEYWORD_NONE,                    // 38
+    KEYWORD_NONE,                    // 39
+    KEYWORD_NONE,                    // 40
+    KEYWORD("auto", tkAuto),         // 41
+    KEYWORD_NONE,                    // 42
+    KEYWORD("static", tkStatic),     // 43
+    KEYWORD("signed", tkSigned),     // 44
+    KEYWORD("goto", tkGoto),         // 45
+    KEYWORD("sizeof", tkSizeof),     // 46
+    KEYWORD_NONE,                    // 47
+    KEYWORD("switch", tkSwitch),     // 48
+    KEYWORD_NONE,                    // 49
+    KEYWORD_NONE,                    // 50
+    KEYWORD("long", tkLong),         // 51
+    KEYWORD_NONE,                    // 52
+    KEYWORD_NONE,                    // 53
+    KEYWORD_NONE,                    // 54
+    KEYWORD("else", tkElse),         // 55
+    KEYWORD_NONE,                    // 56
+    KEYWORD("for", tkFor),           // 57
+    KEYWORD_NONE,                    // 58
+    KEYWORD("short", tkShort),       // 59
+    KEYWORD("struct", tkStruct),     // 60
+    KEYWORD("float", tkFloat),       // 61
+    KEYWORD_NONE,                    // 62
+    KEYWORD("enum", tkEnum),         // 63
+};
+#undef KEYWORD
+#undef KEYWORD_NONE
 
-static inline bool IsHexdecimal(char c)
+// 各予約語が自身のハッシュ値のスロットに置かれていることをコンパイル時に検証する
+constexpr bool IsValidKeywordSlot(size_t i)
 {
-    return IsNumber(c) || ('A' <= c && c <= 'F') || ('a' <= c && c <= 'f');
+    return kKeywordTable[i].length == 0 ||
+           KeywordHash(kKeywordTable[i].word, kKeywordTable[i].length) == i;
 }
 
-// C言語の識別子として使える文字を判定
-static inline bool IsWord(char c)
+constexpr bool IsValidKeywordTable(size_t i = 0)
 {
-    if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') ||
-        ('0' <= c && c <= '9') || c == '_')
-        return true;
-    else
-        return false;
+    return i == kKeywordTableSize || (IsValidKeywordSlot(i) && IsValidKeywordTable(i + 1));
+}
+
+static_assert(IsValidKeywordTable(), "keyword table is not a perfect hash");
+
+// 識別子を予約語に分類する. 予約語でなければ tkWord を返す
+static inline TokenType ClassifyKeyword(const char *s, size_t n)
+{
+    if (n < kKeywordMinLength || n > kKeywordMaxLength)
+        return tkWord;
+
+    const KeywordEntry &e = kKeywordTable[KeywordHash(s, n)];
+    if (e.length == n && std::memcmp(e.word, s, n) == 0)
+        return e.type;
+    return tkWord;
 }
 
+// 演算子・区切り記号
+struct Punctuator
+{
+    const char *text;
+    TokenType type;
+};
+
+static const Punctuator kPunctuators[] = {
+    {"{", tkOpenBrace}, {"}", tkCloseBrace}, {"(", tkOpenParent}, {")", tkCloseParent},
+    {"[", tkOpenBracket}, {"]", tkCloseBracket}, {"*", tkAsterisk}, {"/", tkSlash},
+    {"%", tkPercent}, {":", tkColon}, {";", tkSemicolon}, {",", tkComma},
+    {".", tkDot}, {"...", tkEllipsis}, {"->", tkArrow}, {"?", tkQuestion},
+    {"+", tkPlus}, {"++", tkIncrement}, {"-", tkMinus}, {"--", tkDecrement},
+    {"!", tkNot}, {"~", tkTilde}, {"&", tkAmpersand}, {"|", tkBar},
+    {"^", tkCaret}, {"&&", tkLogicalAnd}, {"||", tkLogicalOr}, {"<<", tkShiftLeft},
+    {">>", tkShiftRight}, {"<", tkLess}, {">", tkGreater}, {"<=", tkLessEqual},
+    {">=", tkGreaterEqual}, {"==", tkEqualEqual}, {"!=", tkNotEqual},
+    {"#", tkHash}, {"##", tkHashHash}, {"=", tkEqual},
+    {"+=", tkAddAssign}, {"-=", tkSubAssign}, {"*=", tkMulAssign}, {"/=", tkDivAssign},
+    {"%=", tkModAssign}, {"&=", tkAndAssign}, {"|=", tkOrAssign}, {"^=", tkXorAssign},
+    {"<<=", tkShiftLeftAssign}, {">>=", tkShiftRightAssign},
+};
+
+// 演算子を最長一致で認識する DFA
+// 状態 0 が初期状態. next[state][c] が 0 なら遷移なし.
+// accept[state] が tkNull でなければその状態で受理できる.
+struct PunctuatorDFA
+{
+    static const int kMaxStates = 64;
+
+    PunctuatorDFA() : num_states(1)
+    {
+        std::memset(next, 0, sizeof(next));
+        for (int i = 0; i < kMaxStates; ++i)
+            accept[i] = tkNull;
+
+        for (auto &p : kPunctuators)
+        {
+            int state = 0;
+            for (const char *c = p.text; *c; ++c)
+            {
+                unsigned char &n = next[state][static_cast<unsigned char>(*c)];
+                if (n == 0)
+                    n = num_states++;
+                state = n;
+            }
+            accept[state] = p.type;
+        }
+    }
+
+    // src から最長一致する演算子の長さを返す (一致しなければ 0)
+    size_t Match(const char *src, const char *end, TokenType *type) const
+    {
+        int state = 0;
+        size_t len = 0;
+        size_t accepted = 0;
+        while (src + len != end)
+        {
+            int n = next[state][static_cast<unsigned char>(src[len])];
+            if (n == 0)
+                break;
+            state = n;
+            ++len;
+            if (accept[state] != tkNull)
+            {
+                *type = accept[state];
+                accepted = len;
+            }
+        }
+        return accepted;
+    }
+
+    unsigned char next[kMaxStates][256];
+    TokenType accept[kMaxStates];
+    int num_states;
+};
+
+static const PunctuatorDFA kPunctuatorDFA;
+
 class Tokenizer
 {
     FRIEND_TEST(Tokenize, Tokenizer);
 
   public:
-    Tokenizer() : line_(0), pos_(0) {}
+    // トークンの終端より先に読む最大のバイト数 (指数部 "e+1" の判定, "..." の最長一致)
+    static const size_t kMaxLookahead = 3;
+
+    Tokenizer() : begin_(nullptr), end_(nullptr), it_(nullptr), symbols_(&GlobalSymbols()), literals_(&GlobalLiterals()) {}
 
     int Tokenize(const std::vector<char> &buf, std::vector<Token> *dest)
     {
-        Init(buf);
+        return Tokenize(buf.data(), buf.size(), dest);
+    }
 
-        bool may_be_comment = false;
-        bool may_be_increment = false;
-        bool may_be_decrement = false;
+    // トークンはバッファを参照するため一時オブジェクトは受け付けない
+    int Tokenize(std::vector<char> &&buf, std::vector<Token> *dest) = delete;
 
-        while (!IsEOB())
+    // ソースをコピーせずに (先頭ポインタ, バイト数) のビューから字句解析する
+    // 生成したトークンは src を参照するので、src はトークンより長く生存させること
+    int Tokenize(const char *src, size_t size, std::vector<Token> *dest)
+    {
+        Init(src, size);
+
+        Token tok;
+        while (Next(&tok))
         {
-            if (Ch() == '/')
-            {
-                may_be_comment = true;
-                Fwd();
-                continue;
-            }
+            dest->push_back(tok);
+        }
 
-            if (may_be_comment && Ch() == '*')
-            {
-                // skip comment
-                SkipBlockComment();
-                may_be_comment = false;
-                continue;
-            }
-            else
-                may_be_comment = false;
+        return 0;
+    }
 
-            if (SkipSpace())
+    // 編集後のソース (src, size) について、編集前のトークン列 tokens を更新する
+    // 編集位置の手前の再開位置から字句解析し直し、編集前のトークンと位置が一致した時点で打ち切る.
+    // 以降のトークンは位置をずらすだけで済む. ずらす手間はソースの長さに比例するので、
+    // 大きなファイルの編集には TokenDocument (チャンクごとに呼ぶ) を使う.
+    //   戻り値 : 字句解析し直したトークン数
+    //   synced : 編集前のトークンと一致したか (false であれば終端まで字句解析し直した)
+    size_t Retokenize(const char *src, size_t size, const SourceEdit &edit, std::vector<Token> *tokens,
+                      bool *synced_out = nullptr)
+    {
+        std::vector<Token> &old = *tokens;
+        const int64_t delta = static_cast<int64_t>(edit.inserted) - static_cast<int64_t>(edit.removed);
+
+        // 再開位置: 終端 + 先読み幅が編集位置に届く最初のトークン
+        // その直前のトークンの終端は常にコード中 (コメント外) なので、そこから字句解析を始めてよい
+        size_t restart = std::lower_bound(old.begin(), old.end(), edit.offset, [](const Token &t, size_t offset) {
+                             return t.pos + t.token.size() + kMaxLookahead < offset;
+                         }) - old.begin();
+        const char *start = (restart > 0) ? src + old[restart - 1].pos + old[restart - 1].token.size() : src;
+
+        // 編集範囲より後ろにある最初の編集前のトークン
+        size_t next = std::lower_bound(old.begin() + restart, old.end(), edit.offset + edit.removed, [](const Token &t, size_t offset) {
+                          return t.pos < offset;
+                      }) - old.begin();
+
+        Init(src, start, src + size);
+
+        std::vector<Token> fresh;
+        Token tok;
+        bool synced = false;
+        while (!synced && Next(&tok))
+        {
+            if (tok.pos >= edit.offset + edit.inserted)
             {
-                continue;
+                while (next < old.size() && old[next].pos + delta < tok.pos)
+                    ++next;
+                // 同じ位置から始まるトークンがあれば以降は編集前と同じ
+                synced = (next < old.size() && old[next].pos + delta == tok.pos);
             }
+            if (!synced)
+                fresh.push_back(tok);
+        }
+        if (!synced)
+            next = old.size();
+        if (synced_out)
+            *synced_out = synced;
 
-            if (IsNumber(Ch()))
-            {
-                std::vector<char> tok;
-
-                int n = 0;
+        // 編集前の位置を参照しているトークンを付け替える
+        if (restart > 0 && old[0].token.data() != src + old[0].pos)
+        {
+            for (size_t i = 0; i < restart; ++i)
+                old[i].token = StringRef(src + old[i].pos, old[i].token.size());
+        }
 
-                // 16進数認識用
-                bool may_be_hex_0 = false;
-                bool may_be_hex_x = false;
+        // [restart, next) を字句解析し直したトークンで置き換える
+        size_t replaced = next - restart;
+        if (fresh.size() > replaced)
+            old.insert(old.begin() + next, fresh.size() - replaced, Token());
+        else
+            old.erase(old.begin() + restart + fresh.size(), old.begin() + next);
+        std::copy(fresh.begin(), fresh.end(), old.begin() + restart);
 
-                if (Ch() == '0')
-                {
-                    may_be_hex_0 = true;
-                    tok.push_back(Ch());
-                    Fwd();
-                }
+        for (size_t i = restart + fresh.size(); i < old.size(); ++i)
+        {
+            old[i].pos = static_cast<uint32_t>(old[i].pos + delta);
+            old[i].token = StringRef(src + old[i].pos, old[i].token.size());
+        }
+        return fresh.size();
+    }
 
-                if (Ch() == 'x')
-                {
-                    may_be_hex_x = true;
-                    tok.push_back(Ch());
-                    Fwd();
-                }
+    // 次のトークンを 1 つ切り出す
+    //   true  : tok にトークンを格納した
+    //   false : 入力バッファの終端
+    bool Next(Token *tok)
+    {
+        for (;;)
+        {
+            if (IsEOB())
+                return false;
 
-                TokenType tt = tkNull;
-                if (may_be_hex_0 && may_be_hex_x)
-                {
-                    tt = tkHexDecimal;
-                    while (IsHexdecimal(Ch()) && it_ != std::end(buffer_))
-                    {
-                        tok.push_back(Ch());
-                        Fwd();
-                    }
-                }
-                else
-                {
-                    tt = tkDecimal;
-                    while (IsNumber(Ch()) && it_ != std::end(buffer_))
-                    {
-                        tok.push_back(Ch());
-                        Fwd();
-                    }
-                }
+            const char c = Ch();
+            const unsigned char flags = CharFlags(c);
 
-                dest->push_back({std::string(tok.begin(), tok.end()), tt, line_, pos_});
+            // 空白・改行
+            if (flags & (ccSpace | ccNewline))
+            {
+                SkipSpace();
                 continue;
             }
 
-            // 識別子を認識
-            if (IsWord(Ch()))
+            // コメント
+            if (c == '/' && Ch(1) == '*')
             {
-                std::vector<char> tok;
-                while (IsWord(Ch()) && it_ != std::end(buffer_))
-                {
-                    tok.push_back(Ch());
-                    Fwd();
-                }
-
-                // 予約語かどうかを判定
-                auto str = std::string(tok.begin(), tok.end());
-                TokenType tt = GetTokenType(str);
-
-                dest->push_back({str, tt,
-                                 line_, pos_});
+                SkipBlockComment();
+                continue;
+            }
+            if (c == '/' && Ch(1) == '/')
+            {
+                SkipLineComment();
                 continue;
             }
 
-            // 識別子以外の記号を認識
-            if (IsPrintable(Ch()))
+            const char *start = it_;
+            TokenType tt = tkNull;
+
+            if ((flags & ccDigit) || (c == '.' && IsNumber(Ch(1))))
+            {
+                tt = LexNumber();
+            }
+            else if (flags & ccAlpha)
+            {
+                // 識別子・予約語
+                while (IsWord(Ch()))
+                    Fwd();
+                tt = GetTokenType(StringRef(start, it_ - start));
+            }
+            else if (flags & ccQuote)
+            {
+                // 文字列リテラル・文字定数
+                tt = LexQuoted(c);
+            }
+            else if (flags & ccPunct)
             {
-                std::vector<char> tok;
+                // 演算子・区切り記号 (最長一致)
+                size_t len = kPunctuatorDFA.Match(it_, end_, &tt);
+                Fwd(len);
+            }
+            else
+            {
+                // 1 文字のトークンとして前処理・構文解析に渡す
+                tt = tkStray;
+                Fwd();
+            }
 
-                TokenType tt;
+            *tok = {StringRef(start, it_ - start), tt, static_cast<uint32_t>(start - begin_), kNoSymbol, 0, {0}};
+            switch (tt)
+            {
+            case tkDecimal:
+            case tkHexDecimal:
+                tok->number_flags = ParseIntegerLiteral(start, it_, &tok->value.integer);
+                break;
+            case tkFloatNumber:
+                tok->number_flags = ParseFloatLiteral(start, it_, &tok->value.real);
+                break;
+            case tkCharacter:
+                tok->number_flags =
+                    DecodeCharacterLiteral(start + 1, QuotedEnd(*tok), &tok->value.integer) | QuoteFlags(*tok);
+                break;
+            case tkString:
+                tok->number_flags = QuoteFlags(*tok);
+                Intern(tok);
+                break;
+            case tkWord:
+                Intern(tok);
+                break;
+            default:
+                break;
+            }
+            return true;
+        }
+    }
 
-                switch (Ch())
-                {
-                case '{':
-                    tt = tkOpenBrace;
-                    break;
-                case '}':
-                    tt = tkCloseBrace;
-                    break;
-                case '(':
-                    tt = tkOpenParent;
-                    break;
-                case ')':
-                    tt = tkCloseParent;
-                    break;
-                case '*':
-                    tt = tkAsterisk;
-                    break;
-                case '/':
-                    tt = tkSlash;
-                    break;
-                case ':':
-                    tt = tkColon;
-                    break;
-                case ';':
-                    tt = tkSemicolon;
-                    break;
-                case '\'':
-                    tt = tkQuote;
-                    break;
-                case '"':
-                    tt = tkDoubleQuote;
-                    break;
-                case '?':
-                    tt = tkQuestion;
-                    break;
-                case '=':
-                    tt = tkEqual;
-                    break;
-                case '+':
-
-                    // 1byte 先が + だった場合、++演算子であるため
-                    // 現在のループではトークンとして登録せずに
-                    // 次のループで登録する.
-                    if (may_be_increment)
-                    {
-                        tt = tkIncrement;
-                        tok.push_back(Ch());
-                        Fwd();
-                        dest->push_back(
-                            {std::string(tok.begin(), tok.end()), tt, line_, pos_});
-                        may_be_increment = false; // フラグを戻しておく
-                        continue;
-                    }
-
-                    // 1byte 先が + でなければ (単項または二項の) + 演算子である
-                    if (Ch(1) == '+')
-                    {
-                        may_be_increment = true;
-                        tok.push_back(Ch());
-                        Fwd();
-                        continue;
-                    }
-                    else
-                    {
-                        tt = tkPlus;
-                    }
-                    break;
+    // 識別子をシンボルテーブルに、文字列リテラルをリテラルプールに登録する
+    // 登録先が設定されていなければ何もしない
+    void Intern(Token *tok)
+    {
+        if (tok->type == tkWord && symbols_)
+        {
+            tok->symbol = symbols_->Intern(tok->token.data(), tok->token.size());
+        }
+        else if (tok->type == tkString && literals_)
+        {
+            std::string decoded;
+            tok->number_flags = DecodeStringLiteral(tok->token.data() + 1, QuotedEnd(*tok), &decoded) | QuoteFlags(*tok);
+            tok->value.integer = literals_->Intern(decoded);
+        }
+    }
 
-                case '-':
-
-                    // 1byte 先が - だった場合、--演算子であるため
-                    // 現在のループではトークンとして登録せずに
-                    // 次のループで登録する.
-                    if (may_be_decrement)
-                    {
-                        tt = tkDecrement;
-                        tok.push_back(Ch());
-                        Fwd();
-                        dest->push_back(
-                            {std::string(tok.begin(), tok.end()), tt, line_, pos_});
-                        may_be_decrement = false; // フラグを戻しておく
-                        continue;
-                    }
-
-                    // 1byte 先が - でなければ (単項または二項の) - 演算子である
-                    if (Ch(1) == '-')
-                    {
-                        may_be_decrement = true;
-                        tok.push_back(Ch());
-                        Fwd();
-                        continue;
-                    }
-                    else
-                    {
-                        tt = tkMinus;
-                    }
-                    break;
-                }
+    // Next() で逐次字句解析する入力を設定する
+    void Init(const char *src, size_t size)
+    {
+        Init(src, src, src + size);
+    }
 
-                tok.push_back(Ch());
-                Fwd();
-                dest->push_back({std::string(tok.begin(), tok.end()), tt, line_, pos_});
-                continue;
-            }
+    // バッファの途中 (start) から字句解析を始める.
+    // トークンの pos は begin からのバイト位置になる. 位置は 32bit なので 4GB までの入力に限る
+    void Init(const char *begin, const char *start, const char *end)
+    {
+        if (static_cast<size_t>(end - begin) > std::numeric_limits<uint32_t>::max())
+        {
+            throw_ln("tokenizer : input is too large");
         }
 
-        return 0;
+        begin_ = begin;
+        end_ = end;
+        it_ = start;
+    }
+
+    // 識別子を登録するシンボルテーブル (既定は GlobalSymbols())
+    // nullptr の場合は登録せず、識別子の symbol は kNoSymbol になる
+    void SetSymbolTable(SymbolTable *symbols)
+    {
+        symbols_ = symbols;
+    }
+
+    // 文字列リテラルを登録するリテラルプール (既定は GlobalLiterals())
+    // nullptr の場合は登録しない
+    void SetLiteralPool(SymbolTable *literals)
+    {
+        literals_ = literals;
     }
 
   private:
     void Init(const std::vector<char> &buf)
     {
-        buffer_ = buf;
-        it_ = std::begin(buffer_);
+        Init(buf.data(), buf.size());
     }
 
     // 現在の位置の文字を取得.
     // 引数指定することで先読み可能
     // eob の場合 '\0' を返す
-    inline char Ch(unsigned int offset = 0)
+    inline char Ch(size_t offset = 0)
     {
-        if ((pos_ + offset) >= buffer_.size())
+        if (offset >= static_cast<size_t>(end_ - it_))
             return '\0';
         return *(it_ + offset);
     }
 
     // 現在のポジションを 1byte 進める
-    inline void Fwd(unsigned int offset = 1)
+    inline void Fwd(size_t offset = 1)
     {
         it_ += offset;
-        pos_ += offset;
     }
 
     // 入力バッファの最後であるかの判定
-    inline bool IsEOB(unsigned int offset = 0)
+    inline bool IsEOB(size_t offset = 0)
     {
-        return (it_ + offset) == std::end(buffer_);
+        return (it_ + offset) == end_;
     }
 
-    // ブロックコメント /* ... */ をスキップする
-    bool SkipBlockComment()
+    // 数値リテラル
+    //   10 進数 / 8 進数 : 123, 0755
+    //   16 進数         : 0x1f
+    //   浮動小数点数     : 1.5, .5, 1e10, 1.5e-3f
+    // 末尾のサフィックス (u, l, f 等) もトークンに含める. 値は Next で number.hh の関数により求める
+    TokenType LexNumber()
     {
-        bool may_be_end = false;
-        for (;;)
+        TokenType tt = tkDecimal;
+
+        if (Ch() == '0' && (Ch(1) == 'x' || Ch(1) == 'X'))
         {
-            // EOF
-            if (Ch() == '\0')
+            tt = tkHexDecimal;
+            Fwd(2);
+            while (IsHexdecimal(Ch()))
+                Fwd();
+        }
+        else
+        {
+            while (IsNumber(Ch()))
+                Fwd();
+
+            if (Ch() == '.')
             {
-                ERROR("incomplete end of block comment");
-                return false;
+                tt = tkFloatNumber;
+                Fwd();
+                while (IsNumber(Ch()))
+                    Fwd();
             }
 
-            if (may_be_end && Ch() == '/')
-                return true;
+            if ((Ch() == 'e' || Ch() == 'E') &&
+                (IsNumber(Ch(1)) || ((Ch(1) == '+' || Ch(1) == '-') && IsNumber(Ch(2)))))
+            {
+                tt = tkFloatNumber;
+                Fwd(2);
+                while (IsNumber(Ch()))
+                    Fwd();
+            }
+        }
 
-            may_be_end = (Ch() == '*');
+        // サフィックス
+        while (CharFlags(Ch()) & ccAlpha)
             Fwd();
-        }
-        return true;
+
+        return tt;
     }
 
-    // SP, CR, LF, CR+LF をスキップする
-    bool SkipSpace()
+    // 文字列リテラル "..." / 文字定数 '...'
+    // エスケープされた引用符は読み飛ばす. 閉じずに行末に達した場合は行末までをトークンとする
+    // (閉じていないことはトークンの nfUnterminated で前処理・構文解析に伝える)
+    TokenType LexQuoted(char quote)
     {
-        bool ok = false;
-        bool may_be_lf = false;
-        while (!IsPrintable(Ch()) && !IsEOB())
+        Fwd();
+        while (!IsEOB())
         {
-            // CR+LF のスキップ
-            if (Ch() == '\r')
+            char c = Ch();
+            if (c == quote)
             {
                 Fwd();
+                return quote == '"' ? tkString : tkCharacter;
+            }
+            if (c == '\n' || c == '\r')
+                break;
+            // 行の継続 (\ + 改行) は入力バッファを読み込むときにつなげてある (SpliceLines)
+            Fwd((c == '\\' && !IsEOB(1) && !(CharFlags(Ch(1)) & ccNewline)) ? 2 : 1);
+        }
 
-                // 次の文字が eob であれば break
-                if (IsEOB(1))
-                {
-                    break;
-                }
+        return quote == '"' ? tkString : tkCharacter;
+    }
 
-                // 次の文字が LF でなければ改行
-                if (Ch(1) != '\n')
-                {
-                    ++line_;
-                }
+    // 閉じていない文字列リテラル・文字定数であれば nfUnterminated
+    static uint8_t QuoteFlags(const Token &tok)
+    {
+        return (QuotedEnd(tok) == tok.token.data() + tok.token.size()) ? nfUnterminated : 0;
+    }
 
-                continue;
-            }
+    // 引用符の内側の終端 (閉じていない場合はトークンの終端)
+    static const char *QuotedEnd(const Token &tok)
+    {
+        const char *end = tok.token.data() + tok.token.size();
+        if (tok.token.size() >= 2 && end[-1] == tok.token[0])
+        {
+            // 末尾の引用符がエスケープされていないか
+            size_t backslashes = 0;
+            for (const char *p = end - 2; p > tok.token.data() && *p == '\\'; --p)
+                ++backslashes;
+            if (backslashes % 2 == 0)
+                return end - 1;
+        }
+        return end;
+    }
 
-            if (Ch() == '\n')
-            {
-                ++line_;
+    // ブロックコメント /* ... */ をスキップする
+    bool SkipBlockComment()
+    {
+        Fwd(2); // "/*"
 
-                Fwd();
-                continue;
-            }
+        it_ = scan::kKernels.find_comment_end(it_, end_);
 
-            if (Ch() == ' ')
-            {
-                Fwd();
-                continue;
-            }
+        // EOF
+        if (IsEOB())
+        {
+            ERROR("incomplete end of block comment");
+            return false;
         }
 
-        return ok;
+        Fwd(2); // "*/"
+        return true;
     }
 
-    // buffer_ から 1行切り出して返す
+    // 行コメント // ... をスキップする (改行は残す)
+    void SkipLineComment()
+    {
+        while (!IsEOB() && Ch() != '\n' && Ch() != '\r')
+            Fwd();
+    }
+
+    // SP, HT, VT, FF, CR, LF, CR+LF をスキップする
+    //   true  : 1 文字以上スキップした
+    //   false : 空白がなかった
+    bool SkipSpace()
+    {
+        const char *start = it_;
+        it_ = scan::kKernels.skip_blanks(it_, end_);
+        return it_ != start;
+    }
+
+    // 入力バッファから 1行切り出して返す
     int GetLine(std::vector<char> &dst_buf)
     {
-        auto it = std::begin(buffer_);
-        while (it != std::end(buffer_))
+        auto it = begin_;
+        while (it != end_)
         {
             if (Ch() == '\r')
             {
@@ -459,79 +880,18 @@ class Tokenizer
         return 0;
     }
 
-    TokenType GetTokenType(std::string &str)
+    TokenType GetTokenType(const StringRef &str)
     {
-        if (str == "auto")
-            return tkAuto;
-        if (str == "break")
-            return tkBreak;
-        if (str == "case")
-            return tkCase;
-        if (str == "char")
-            return tkChar;
-        if (str == "const")
-            return tkConst;
-        if (str == "continue")
-            return tkContinue;
-        if (str == "default")
-            return tkDefault;
-        if (str == "do")
-            return tkDo;
-        if (str == "double")
-            return tkDouble;
-        if (str == "else")
-            return tkElse;
-        if (str == "enum")
-            return tkEnum;
-        if (str == "extern")
-            return tkExtern;
-        if (str == "float")
-            return tkFloat;
-        if (str == "for")
-            return tkFor;
-        if (str == "goto")
-            return tkGoto;
-        if (str == "if")
-            return tkIf;
-        if (str == "int")
-            return tkInt;
-        if (str == "long")
-            return tkLong;
-        if (str == "register")
-            return tkRegister;
-        if (str == "return")
-            return tkReturn;
-        if (str == "short")
-            return tkShort;
-        if (str == "signed")
-            return tkSigned;
-        if (str == "sizeof")
-            return tkSizeof;
-        if (str == "static")
-            return tkStatic;
-        if (str == "struct")
-            return tkStruct;
-        if (str == "switch")
-            return tkSwitch;
-        if (str == "typedef")
-            return tkTypedef;
-        if (str == "union")
-            return tkUnion;
-        if (str == "unsigned")
-            return tkUnsigned;
-        if (str == "void")
-            return tkVoid;
-        if (str == "volatile")
-            return tkVolatile;
-        if (str == "while")
-            return tkWhile;
-        return tkWord;
+        return ClassifyKeyword(str.data(), str.size());
     }
 
-    std::vector<char> buffer_;
-    std::vector<char>::const_iterator it_;
-    int line_;
-    int pos_;
+    // 入力バッファ (呼び出し側が所有する)
+    const char *begin_;
+    const char *end_;
+    const char *it_;
+
+    SymbolTable *symbols_;
+    SymbolTable *literals_;
 };
 
 } // namespace kcc
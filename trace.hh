@@ -0,0 +1,182 @@
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// トレースのレベル
+// KCC_TRACE_LEVEL 以下のレベルのトレースだけを埋め込む. 既定は 0 (すべて無効).
+// 無効なトレースは空の式に展開され、引数も評価しない.
+//   g++ -DKCC_TRACE_LEVEL=2 ...
+#define KCC_TRACE_PHASE 1 // コンパイルの段階
+#define KCC_TRACE_CALL 2  // 構文解析の関数の出入り
+#define KCC_TRACE_DEBUG 3 // 個々の処理の詳細
+#define KCC_TRACE_TOKEN 4 // 参照したトークン
+
+#ifndef KCC_TRACE_LEVEL
+#define KCC_TRACE_LEVEL 0
+#endif
+
+#define KCC_TRACE_RECORD(level, kind, message) \
+    ::kcc::GlobalTrace().Record((level), ::kcc::TraceBuffer::kind, __FILE__, __LINE__, (message))
+
+#if KCC_TRACE_LEVEL >= KCC_TRACE_PHASE
+#define TRACE_PHASE(message) KCC_TRACE_RECORD(KCC_TRACE_PHASE, kMessage, message)
+#else
+#define TRACE_PHASE(message) ((void)0)
+#endif
+
+#if KCC_TRACE_LEVEL >= KCC_TRACE_CALL
+#define TRACE_IN(function) KCC_TRACE_RECORD(KCC_TRACE_CALL, kEnter, function)
+#define TRACE_OUT(function) KCC_TRACE_RECORD(KCC_TRACE_CALL, kLeave, function)
+#else
+#define TRACE_IN(function) ((void)0)
+#define TRACE_OUT(function) ((void)0)
+#endif
+
+#if KCC_TRACE_LEVEL >= KCC_TRACE_DEBUG
+#define TRACE_DEBUG(message) KCC_TRACE_RECORD(KCC_TRACE_DEBUG, kMessage, message)
+#else
+#define TRACE_DEBUG(message) ((void)0)
+#endif
+
+#if KCC_TRACE_LEVEL >= KCC_TRACE_TOKEN
+#define TRACE_TOKEN(message) KCC_TRACE_RECORD(KCC_TRACE_TOKEN, kMessage, message)
+#else
+#define TRACE_TOKEN(message) ((void)0)
+#endif
+
+namespace kcc
+{
+
+// トレースのリングバッファ
+// 記録は固定長のエントリへのコピーだけで、ロックも出力もしない. 一杯になると古いものから上書きする.
+// 出力は Dump を呼んだ時だけ行う.
+//
+// 複数のスレッドから同時に記録できる. エントリは通し番号で確保し、書き終えたら seq に番号を書く.
+// Dump は書き込み中や上書きされたエントリを読み飛ばす.
+class TraceBuffer
+{
+  public:
+    static const size_t kCapacity = 4096; // 2 のべき乗
+    static const size_t kTextSize = 112;
+
+    enum Kind
+    {
+        kEnter,
+        kLeave,
+        kMessage,
+    };
+
+    TraceBuffer() : entries_(new Entry[kCapacity]), head_(0)
+    {
+        for (size_t i = 0; i < kCapacity; ++i)
+            entries_[i].seq.store(0, std::memory_order_relaxed);
+    }
+
+    TraceBuffer(const TraceBuffer &) = delete;
+    TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+    void Record(int level, Kind kind, const char *file, int line, const char *text)
+    {
+        Record(level, kind, file, line, text, std::strlen(text));
+    }
+
+    void Record(int level, Kind kind, const char *file, int line, const std::string &text)
+    {
+        Record(level, kind, file, line, text.data(), text.size());
+    }
+
+    // 長すぎるテキストは切り詰める
+    void Record(int level, Kind kind, const char *file, int line, const char *text, size_t n)
+    {
+        // 関数の出入りの深さはスレッドごと
+        static thread_local int depth = 0;
+        if (kind == kLeave && depth > 0)
+            --depth;
+
+        const uint64_t seq = head_.fetch_add(1, std::memory_order_relaxed);
+        Entry &e = entries_[seq & (kCapacity - 1)];
+        e.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        e.file = file;
+        e.line = line;
+        e.level = static_cast<uint8_t>(level);
+        e.kind = static_cast<uint8_t>(kind);
+        e.depth = static_cast<uint16_t>(depth);
+        e.length = static_cast<uint32_t>((n < kTextSize) ? n : kTextSize);
+        std::memcpy(e.text, text, e.length);
+        e.seq.store(seq + 1, std::memory_order_release);
+
+        if (kind == kEnter)
+            ++depth;
+    }
+
+    // 記録した件数 (上書きされたものを含む)
+    uint64_t RecordCount() const { return head_.load(std::memory_order_relaxed); }
+
+    // 残っているエントリを古い順に出力する
+    //   file(line) : text
+    // 関数の出入りは深さで字下げし、出る時は末尾に "-> out" をつける
+    void Dump(std::ostream &os) const
+    {
+        const uint64_t end = head_.load(std::memory_order_acquire);
+        const uint64_t begin = (end > kCapacity) ? end - kCapacity : 0;
+        for (uint64_t seq = begin; seq < end; ++seq)
+        {
+            const Entry &e = entries_[seq & (kCapacity - 1)];
+            if (e.seq.load(std::memory_order_acquire) != seq + 1)
+                continue;
+
+            Entry copy;
+            copy.file = e.file;
+            copy.line = e.line;
+            copy.kind = e.kind;
+            copy.depth = e.depth;
+            copy.length = e.length;
+            std::memcpy(copy.text, e.text, sizeof(copy.text));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e.seq.load(std::memory_order_relaxed) != seq + 1)
+                continue;
+
+            os << std::string(copy.depth, ' ') << copy.file << "(" << copy.line << ") : ";
+            os.write(copy.text, copy.length);
+            if (copy.kind == kLeave)
+                os << "-> out";
+            os << '\n';
+        }
+        os.flush();
+    }
+
+  private:
+    struct Entry
+    {
+        std::atomic<uint64_t> seq; // 書き終えたエントリの通し番号 + 1. 書き込み中は 0
+        const char *file;
+        int line;
+        uint8_t level;
+        uint8_t kind;
+        uint16_t depth;
+        uint32_t length;
+        char text[kTextSize];
+    };
+
+    std::unique_ptr<Entry[]> entries_;
+    std::atomic<uint64_t> head_;
+};
+
+// トレースマクロの記録先
+inline TraceBuffer &GlobalTrace()
+{
+    static TraceBuffer trace;
+    return trace;
+}
+
+} // namespace kcc
+
+#endif
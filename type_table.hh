@@ -0,0 +1,230 @@
+#ifndef TYPE_TABLE_HH
+#define TYPE_TABLE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "symbol.hh"
+
+namespace kcc
+{
+
+// 型 ID. 0 (kNoType) は型がないことを表す
+typedef uint32_t TypeID;
+static const TypeID kNoType = 0;
+
+enum TypeKind
+{
+    kTypeNone,
+    kTypeBasic,   // char, int, ...
+    kTypePointer, // base へのポインタ
+    kTypeArray,   // base の配列
+    kTypeStruct,
+};
+
+struct TypeMember
+{
+    SymbolID name;
+    TypeID type;
+    uint32_t offset; // 構造体の先頭からのバイト数
+};
+
+struct Type
+{
+    TypeKind kind;
+    SymbolID name;             // 基本型・構造体の名前
+    TypeID base;               // ポインタの指す型・配列の要素型
+    uint32_t length;           // 配列の要素数
+    uint32_t size;             // バイト数
+    const TypeMember *members; // 構造体のメンバ
+    uint32_t member_count;
+};
+
+// 型表
+// 同じ型 (同じ名前の基本型、同じ型へのポインタ、同じ要素型・要素数の配列) は一度だけ作り、32bit の ID で参照する.
+// 型の比較は ID の比較で済む. 構造体は定義ごとに別の型になる.
+//
+// 型の追加は複数のスレッドから同時に行える (並列構文解析のキャスト等). 追加はロックして行い、
+// 参照 (operator[], Name) はロックしない. 型は固定長のチャンクに置き、追加しても移動しない.
+class TypeTable
+{
+  public:
+    static const uint32_t kPointerSize = 8;
+
+    TypeTable() : count_(0)
+    {
+        Add(Type{kTypeNone, kNoSymbol, kNoType, 0, 0, nullptr, 0});
+    }
+
+    TypeTable(const TypeTable &) = delete;
+    TypeTable &operator=(const TypeTable &) = delete;
+
+    // name の基本型. 同じ名前で 2 回目以降に呼んだ場合は最初の型を返す (size は無視する)
+    TypeID Basic(SymbolID name, uint32_t size)
+    {
+        return Canonical(Key{kTypeBasic, name, 0}, Type{kTypeBasic, name, kNoType, 0, size, nullptr, 0});
+    }
+
+    TypeID PointerTo(TypeID base)
+    {
+        return Canonical(Key{kTypePointer, base, 0}, Type{kTypePointer, kNoSymbol, base, 0, kPointerSize, nullptr, 0});
+    }
+
+    TypeID ArrayOf(TypeID element, uint32_t length)
+    {
+        const uint32_t size = (*this)[element].size * length;
+        return Canonical(Key{kTypeArray, element, length}, Type{kTypeArray, kNoSymbol, element, length, size, nullptr, 0});
+    }
+
+    // 構造体を定義する. メンバは宣言順に、各メンバの大きさ (最大 8) の境界に揃えて並べる
+    TypeID NewStruct(SymbolID name, const std::vector<std::pair<SymbolID, TypeID>> &members)
+    {
+        std::unique_ptr<TypeMember[]> block(new TypeMember[members.size()]);
+        Type t = {kTypeStruct, name, kNoType, 0, 0, block.get(), static_cast<uint32_t>(members.size())};
+        uint32_t align = 1;
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            const uint32_t a = Alignment(members[i].second);
+            t.size = (t.size + a - 1) / a * a;
+            block[i] = TypeMember{members[i].first, members[i].second, t.size};
+            t.size += (*this)[members[i].second].size;
+            if (align < a)
+                align = a;
+        }
+        t.size = (t.size + align - 1) / align * align;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        member_blocks_.push_back(std::move(block));
+        return Add(t);
+    }
+
+    const Type &operator[](TypeID id) const { return chunks_[id >> kChunkBits][id & (kChunkSize - 1)]; }
+
+    const TypeMember *MembersBegin(TypeID id) const { return (*this)[id].members; }
+    const TypeMember *MembersEnd(TypeID id) const { return MembersBegin(id) + (*this)[id].member_count; }
+
+    // 構造体のメンバ. なければ nullptr
+    const TypeMember *FindMember(TypeID id, SymbolID name) const
+    {
+        for (const TypeMember *m = MembersBegin(id); m != MembersEnd(id); ++m)
+        {
+            if (m->name == name)
+                return m;
+        }
+        return nullptr;
+    }
+
+    // 型の表記 (int, char*, int[4], struct point)
+    std::string Name(TypeID id) const
+    {
+        const Type &t = (*this)[id];
+        switch (t.kind)
+        {
+        case kTypeBasic:
+            return GlobalSymbols().Name(t.name);
+        case kTypePointer:
+            return Name(t.base) + "*";
+        case kTypeArray:
+            return Name(t.base) + "[" + std::to_string(t.length) + "]";
+        case kTypeStruct:
+            return "struct " + GlobalSymbols().Name(t.name);
+        default:
+            return std::string();
+        }
+    }
+
+    // 登録されている型の数 (kNoType を除く)
+    size_t size() const { return count_.load(std::memory_order_acquire) - 1; }
+
+  private:
+    static const uint32_t kChunkBits = 12;
+    static const uint32_t kChunkSize = 1u << kChunkBits;
+    static const uint32_t kMaxChunks = 1024;
+
+    struct Key
+    {
+        TypeKind kind;
+        uint32_t a;
+        uint32_t b;
+
+        bool operator==(const Key &k) const { return kind == k.kind && a == k.a && b == k.b; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &k) const
+        {
+            return std::hash<uint64_t>()((static_cast<uint64_t>(k.a) << 32) | k.b) * 31 + k.kind;
+        }
+    };
+
+    TypeID Canonical(const Key &key, const Type &type)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = canonical_.find(key);
+        if (it != canonical_.end())
+            return it->second;
+
+        const TypeID id = Add(type);
+        canonical_[key] = id;
+        return id;
+    }
+
+    // 型を追加する (mutex_ をロックして呼ぶこと. コンストラクタを除く)
+    TypeID Add(const Type &type)
+    {
+        const uint32_t id = count_.load(std::memory_order_relaxed);
+        if ((id >> kChunkBits) >= kMaxChunks)
+            throw std::length_error("type table : too many types");
+        std::unique_ptr<Type[]> &chunk = chunks_[id >> kChunkBits];
+        if (!chunk)
+            chunk.reset(new Type[kChunkSize]);
+        chunk[id & (kChunkSize - 1)] = type;
+        count_.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    uint32_t Alignment(TypeID id) const
+    {
+        const Type &t = (*this)[id];
+        if (t.kind == kTypeArray)
+            return Alignment(t.base);
+        if (t.kind == kTypeStruct)
+        {
+            uint32_t align = 1;
+            for (const TypeMember *m = MembersBegin(id); m != MembersEnd(id); ++m)
+            {
+                const uint32_t a = Alignment(m->type);
+                if (align < a)
+                    align = a;
+            }
+            return align;
+        }
+        return (t.size == 0) ? 1 : (t.size < 8) ? t.size : 8;
+    }
+
+    std::unique_ptr<Type[]> chunks_[kMaxChunks];
+    std::atomic<uint32_t> count_;
+    std::vector<std::unique_ptr<TypeMember[]>> member_blocks_;
+    std::unordered_map<Key, TypeID, KeyHash> canonical_;
+    std::mutex mutex_;
+};
+
+// 翻訳単位間で共有する型表
+inline TypeTable &GlobalTypes()
+{
+    static TypeTable types;
+    return types;
+}
+
+} // namespace kcc
+
+#endif
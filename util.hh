@@ -5,12 +5,7 @@
 #include <sstream>
 #include <vector>
 
-static int num_fn_call = 0;
-
-static inline void PDEBUG(std::string message)
-{
-    std::cout << message << std::endl;
-}
+#include "trace.hh"
 
 static int global_loop_counter = 0;
 #define IF_N_RUN(n, runner)           \
@@ -23,28 +18,6 @@ static int global_loop_counter = 0;
         ++global_loop_counter;        \
     } while (0)
 
-#define DBG_IN(message) pdebug((message), (__FILE__), (__LINE__), true)
-#define DBG_OUT(message) pdebug((message), (__FILE__), (__LINE__), false)
-static inline void pdebug(std::string message, const char *file, int line, bool indent)
-{
-    if (indent)
-    {
-        std::string sp;
-        for (int i = 0; i < num_fn_call; ++i)
-            sp += " ";
-        std::cout << sp << file << "(" << line << ") : " << message << std::endl;
-        ++num_fn_call;
-    }
-    else
-    {
-        --num_fn_call;
-        std::string sp;
-        for (int i = 0; i < num_fn_call; ++i)
-            sp += " ";
-        std::cout << sp << file << "(" << line << ") : " << message << "-> out" << std::endl;
-    }
-}
-
 static inline void PrintBool(bool condition)
 {
     std::cout << (condition ? "true" : "false") << std::endl;